@@ -0,0 +1,921 @@
+/*
+    bench.c
+
+    Microbenchmarks for the hot functions of dpmaster
+
+    Copyright (C) 2026  The ravenmaster contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+/*
+    This program links the regular dpmaster objects (everything but
+    dpmaster.o) and times the functions that run for every packet. Each
+    benchmark configuration runs in its own child process, since the server
+    and client tables can only be initialized once per process.
+
+    The results are printed on stdout, one line per measure, as a list of
+    "key=value" pairs separated by blank spaces. For instance:
+
+        bench=sv_getbyaddr_hit servers=4096 iterations=1000000 ns_per_op=41.27
+
+    Outgoing packets are never sent: the program is linked with
+    "-Wl,--wrap=sendto,--wrap=sendmsg" and the wrappers below only count
+    them. Only the receive benchmark sends real packets, on the loopback
+    interface.
+
+    UNIX only (fork, clock_gettime and the GNU linker are required).
+*/
+
+
+#include "common.h"
+#include "system.h"
+
+#include <sys/wait.h>
+#include <netinet/udp.h>
+
+#include "clients.h"
+#include "games.h"
+#include "messages.h"
+#include "servers.h"
+
+
+// ---------- Constants ---------- //
+
+// Default number of iterations for the cheapest benchmarks
+#define DEFAULT_ITERATIONS 1000000
+
+// Game used by the registered servers
+#define BENCH_GAMENAME "BenchGame"
+#define BENCH_PROTOCOL 3
+
+
+// ---------- Private variables ---------- //
+
+// Base number of iterations (may be changed on the command line)
+static unsigned int base_iterations = DEFAULT_ITERATIONS;
+
+// Statistics gathered by the "sendto" and "sendmsg" wrappers
+static unsigned long nb_sent_packets = 0;
+static unsigned long nb_sent_bytes = 0;
+
+// Should the wrappers really send the packets?
+static qboolean real_sends = false;
+
+// Sink for the results we don't use, so the compiler can't optimize them away
+static volatile unsigned int result_sink;
+
+
+// ---------- Private functions ---------- //
+
+// The real "sendto" and "sendmsg", for the benchmarks using the loopback interface
+ssize_t __real_sendto (int sock, const void* buf, size_t len, int flags,
+                       const struct sockaddr* dest_addr, socklen_t addrlen);
+ssize_t __real_sendmsg (int sock, const struct msghdr* msg, int flags);
+
+/*
+====================
+__wrap_sendto
+
+Replacement for "sendto", thanks to the "--wrap" option of the linker
+====================
+*/
+ssize_t __wrap_sendto (int sock, const void* buf, size_t len, int flags,
+                       const struct sockaddr* dest_addr, socklen_t addrlen)
+{
+    nb_sent_packets++;
+    nb_sent_bytes += len;
+    if (real_sends)
+        return __real_sendto (sock, buf, len, flags, dest_addr, addrlen);
+    return (ssize_t)len;
+}
+
+
+/*
+====================
+__wrap_sendmsg
+
+Replacement for "sendmsg", thanks to the "--wrap" option of the linker.
+The buffers split by the kernel (UDP GSO) count as several packets
+====================
+*/
+ssize_t __wrap_sendmsg (int sock, const struct msghdr* msg, int flags)
+{
+    struct cmsghdr* cmsg;
+    size_t len = 0;
+    size_t segment_size = 0;
+    size_t ind;
+
+    for (ind = 0; ind < msg->msg_iovlen; ind++)
+        len += msg->msg_iov[ind].iov_len;
+
+    for (cmsg = CMSG_FIRSTHDR (msg); cmsg != NULL; cmsg = CMSG_NXTHDR ((struct msghdr*)msg, cmsg))
+        if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_SEGMENT)
+        {
+            uint16_t gso_size;
+
+            memcpy (&gso_size, CMSG_DATA (cmsg), sizeof (gso_size));
+            segment_size = gso_size;
+        }
+
+    nb_sent_packets += (segment_size > 0 ? (len + segment_size - 1) / segment_size : 1);
+    nb_sent_bytes += len;
+    if (real_sends)
+        return __real_sendmsg (sock, msg, flags);
+    return (ssize_t)len;
+}
+
+
+/*
+====================
+GetTime
+
+Return a monotonic time, in nanoseconds
+====================
+*/
+static double GetTime (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+
+/*
+====================
+BuildAddress
+
+Build the address of the "index"th fake host
+====================
+*/
+static void BuildAddress (unsigned int index, qboolean ipv6,
+                          struct sockaddr_storage* address, socklen_t* addrlen)
+{
+    memset (address, 0, sizeof (*address));
+
+    if (ipv6)
+    {
+        struct sockaddr_in6* addr6 = (struct sockaddr_in6*)address;
+
+        // A few hosts in a lot of different /64 subnets
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_addr.s6_addr[0] = 0x20;
+        addr6->sin6_addr.s6_addr[1] = 0x01;
+        addr6->sin6_addr.s6_addr[5] = (qbyte)(index >> 16);
+        addr6->sin6_addr.s6_addr[6] = (qbyte)(index >> 8);
+        addr6->sin6_addr.s6_addr[7] = (qbyte)index;
+        addr6->sin6_addr.s6_addr[15] = 1;
+        addr6->sin6_port = htons (26000);
+        *addrlen = sizeof (*addr6);
+    }
+    else
+    {
+        struct sockaddr_in* addr4 = (struct sockaddr_in*)address;
+
+        addr4->sin_family = AF_INET;
+        addr4->sin_addr.s_addr = htonl (0x0A000000 | (index & 0x00FFFFFF));
+        addr4->sin_port = htons (26000);
+        *addrlen = sizeof (*addr4);
+    }
+}
+
+
+/*
+====================
+PrintResult
+
+Print the result of a measure
+====================
+*/
+static void PrintResult (const char* bench_name, const char* params,
+                         unsigned int iterations, double elapsed)
+{
+    printf ("bench=%s%s%s iterations=%u ns_per_op=%.2f\n",
+            bench_name, params[0] != '\0' ? " " : "", params,
+            iterations, elapsed / iterations);
+}
+
+
+/*
+====================
+RegisterServer
+
+Register a fake server the regular way, with an heartbeat and an infoResponse
+====================
+*/
+static qboolean RegisterServer (unsigned int index, qboolean ipv6, const char* gamename)
+{
+    static const char heartbeat [] = "heartbeat DarkPlaces\x0A";
+    char inforesponse [512];
+    struct sockaddr_storage address;
+    socklen_t addrlen;
+    server_t* sv;
+
+    BuildAddress (index, ipv6, &address, &addrlen);
+
+    HandleMessage (heartbeat, sizeof (heartbeat) - 1, &address, addrlen, INVALID_SOCKET);
+    sv = Sv_GetByAddr (&address, addrlen, false);
+    if (sv == NULL)
+        return false;
+
+    snprintf (inforesponse, sizeof (inforesponse),
+              "infoResponse\x0A\\sv_maxclients\\16\\clients\\%u"
+              "\\gamename\\%s\\protocol\\%d"
+              "\\hostname\\Benchmark server #%u\\mapname\\dm%u"
+              "\\gametype\\%u\\challenge\\%s",
+              index % 17, gamename, BENCH_PROTOCOL, index, index % 7, index % 4,
+              sv->challenge);
+    HandleMessage (inforesponse, strlen (inforesponse), &address, addrlen, INVALID_SOCKET);
+
+    return (sv->state > sv_state_uninitialized);
+}
+
+
+/*
+====================
+Bench_AddressHash
+
+Time Com_AddressHash, for IPv4 and IPv6 addresses
+====================
+*/
+static void Bench_AddressHash (void)
+{
+    const size_t hash_sizes [] = { 6, 10, 16 };
+    const unsigned int nb_addresses = 4096;
+    struct sockaddr_storage* addresses;
+    unsigned int family_ind;
+
+    addresses = malloc (nb_addresses * sizeof (addresses[0]));
+    if (addresses == NULL)
+        return;
+
+    for (family_ind = 0; family_ind < 2; family_ind++)
+    {
+        qboolean ipv6 = (family_ind != 0);
+        unsigned int size_ind;
+        unsigned int ind;
+
+        for (ind = 0; ind < nb_addresses; ind++)
+        {
+            socklen_t addrlen;
+            BuildAddress (ind * 2654435761U, ipv6, &addresses[ind], &addrlen);
+        }
+
+        for (size_ind = 0; size_ind < sizeof (hash_sizes) / sizeof (hash_sizes[0]); size_ind++)
+        {
+            size_t hash_size = hash_sizes[size_ind];
+            unsigned int hash = 0;
+            char params [64];
+            double start;
+
+            start = GetTime ();
+            for (ind = 0; ind < base_iterations; ind++)
+                hash += Com_AddressHash (&addresses[ind % nb_addresses], hash_size);
+            result_sink = hash;
+
+            snprintf (params, sizeof (params), "family=%s hash_size=%u",
+                      ipv6 ? "ipv6" : "ipv4", (unsigned int)hash_size);
+            PrintResult ("address_hash", params, base_iterations, GetTime () - start);
+        }
+    }
+
+    free (addresses);
+}
+
+
+/*
+====================
+Bench_SvGetByAddr
+
+Time Sv_GetByAddr, for a given number of registered servers
+====================
+*/
+static void Bench_SvGetByAddr (unsigned int nb_servers)
+{
+    unsigned int ind, found;
+    char params [64];
+    double start;
+
+    if (! Sv_SetMaxNbServers (nb_servers) ||
+        ! Sv_SetMaxNbServersPerAddress (0) ||
+        ! Sv_Init ())
+        return;
+
+    snprintf (params, sizeof (params), "servers=%u", nb_servers);
+
+    // Fill the table
+    start = GetTime ();
+    for (ind = 0; ind < nb_servers; ind++)
+    {
+        struct sockaddr_storage address;
+        socklen_t addrlen;
+
+        BuildAddress (ind, false, &address, &addrlen);
+        Sv_GetByAddr (&address, addrlen, true);
+    }
+    PrintResult ("sv_getbyaddr_add", params, nb_servers, GetTime () - start);
+
+    // Look for registered servers
+    found = 0;
+    start = GetTime ();
+    for (ind = 0; ind < base_iterations; ind++)
+    {
+        struct sockaddr_storage address;
+        socklen_t addrlen;
+
+        BuildAddress ((ind * 2654435761U) % nb_servers, false, &address, &addrlen);
+        if (Sv_GetByAddr (&address, addrlen, false) != NULL)
+            found++;
+    }
+    PrintResult ("sv_getbyaddr_hit", params, base_iterations, GetTime () - start);
+    result_sink = found;
+
+    // Look for unknown servers
+    found = 0;
+    start = GetTime ();
+    for (ind = 0; ind < base_iterations; ind++)
+    {
+        struct sockaddr_storage address;
+        socklen_t addrlen;
+
+        BuildAddress (nb_servers + ind % 0x00100000, false, &address, &addrlen);
+        if (Sv_GetByAddr (&address, addrlen, false) != NULL)
+            found++;
+    }
+    PrintResult ("sv_getbyaddr_miss", params, base_iterations, GetTime () - start);
+    result_sink = found;
+}
+
+
+/*
+====================
+BuildCrowdedAddress
+
+Build the address of the "index"th fake host of a crowded network: all of
+them are behind the same IPv4 address (NAT), or in the same IPv6 /64 subnet
+====================
+*/
+static void BuildCrowdedAddress (unsigned int index, qboolean ipv6,
+                                 struct sockaddr_storage* address, socklen_t* addrlen)
+{
+    BuildAddress (0, ipv6, address, addrlen);
+
+    if (ipv6)
+    {
+        struct sockaddr_in6* addr6 = (struct sockaddr_in6*)address;
+
+        addr6->sin6_addr.s6_addr[13] = (qbyte)(index >> 16);
+        addr6->sin6_addr.s6_addr[14] = (qbyte)(index >> 8);
+        addr6->sin6_addr.s6_addr[15] = (qbyte)index;
+    }
+    else
+    {
+        struct sockaddr_in* addr4 = (struct sockaddr_in*)address;
+
+        addr4->sin_port = htons ((unsigned short)(1024 + index));
+    }
+}
+
+
+/*
+====================
+Bench_SvGetByAddrCrowded
+
+Time Sv_GetByAddr when all the servers share the same public address
+====================
+*/
+static void Bench_SvGetByAddrCrowded (unsigned int nb_servers, qboolean ipv6)
+{
+    unsigned int ind, found;
+    char params [64];
+    double start;
+
+    if (! Sv_SetMaxNbServers (nb_servers) ||
+        ! Sv_SetMaxNbServersPerAddress (0) ||
+        ! Sv_Init ())
+        return;
+
+    for (ind = 0; ind < nb_servers; ind++)
+    {
+        struct sockaddr_storage address;
+        socklen_t addrlen;
+
+        BuildCrowdedAddress (ind, ipv6, &address, &addrlen);
+        Sv_GetByAddr (&address, addrlen, true);
+    }
+
+    found = 0;
+    start = GetTime ();
+    for (ind = 0; ind < base_iterations; ind++)
+    {
+        struct sockaddr_storage address;
+        socklen_t addrlen;
+
+        BuildCrowdedAddress ((ind * 2654435761U) % nb_servers, ipv6, &address, &addrlen);
+        if (Sv_GetByAddr (&address, addrlen, false) != NULL)
+            found++;
+    }
+    result_sink = found;
+
+    snprintf (params, sizeof (params), "family=%s servers=%u",
+              ipv6 ? "ipv6" : "ipv4", nb_servers);
+    PrintResult ("sv_getbyaddr_crowded", params, base_iterations, GetTime () - start);
+}
+
+
+/*
+====================
+Bench_InfoResponse
+
+Time the parsing of a realistic infoResponse (mostly SearchInfostring calls)
+====================
+*/
+static void Bench_InfoResponse (void)
+{
+    struct sockaddr_storage address;
+    socklen_t addrlen;
+    server_t* sv;
+    char inforesponse [1024];
+    unsigned int ind, iterations;
+    double start;
+
+    if (! Sv_Init () || ! RegisterServer (0, false, BENCH_GAMENAME))
+        return;
+
+    BuildAddress (0, false, &address, &addrlen);
+    sv = Sv_GetByAddr (&address, addrlen, false);
+
+    // A typical Q3A-like infostring, with the keys dpmaster needs near the end
+    snprintf (inforesponse, sizeof (inforesponse),
+              "infoResponse\x0A\\voip\\opus\\g_needpass\\0\\pure\\1"
+              "\\gametype\\0\\sv_maxclients\\16\\g_humanplayers\\3\\clients\\5"
+              "\\mapname\\q3dm17\\hostname\\^1A ^2benchmark ^3server"
+              "\\protocol\\%d\\gamename\\" BENCH_GAMENAME "\\challenge\\%s",
+              BENCH_PROTOCOL, sv->challenge);
+
+    iterations = base_iterations / 4;
+    start = GetTime ();
+    for (ind = 0; ind < iterations; ind++)
+    {
+        // Keep the challenge valid, whatever the time spent in the loop
+        sv->challenge_timeout = crt_time + 2;
+        HandleMessage (inforesponse, strlen (inforesponse), &address, addrlen, INVALID_SOCKET);
+    }
+    PrintResult ("inforesponse_parse", "", iterations, GetTime () - start);
+}
+
+
+/*
+====================
+Bench_ClBlockedByThrottle
+
+Time Cl_BlockedByThrottle, with all client records in use
+====================
+*/
+static void Bench_ClBlockedByThrottle (void)
+{
+    const unsigned int nb_clients = DEFAULT_MAX_NB_CLIENTS;
+    unsigned int ind, blocked;
+    char params [64];
+    double start;
+
+    flood_protection = true;
+    if (! Cl_SetFPThrottle (INT_MAX) || ! Cl_Init ())
+        return;
+
+    blocked = 0;
+    start = GetTime ();
+    for (ind = 0; ind < base_iterations; ind++)
+    {
+        struct sockaddr_storage address;
+        socklen_t addrlen;
+
+        BuildAddress (ind % nb_clients, false, &address, &addrlen);
+        if (Cl_BlockedByThrottle (&address, addrlen, false))
+            blocked++;
+    }
+    result_sink = blocked;
+
+    snprintf (params, sizeof (params), "clients=%u hash_size=%u",
+              nb_clients, DEFAULT_CL_HASH_SIZE);
+    PrintResult ("cl_blocked_by_throttle", params, base_iterations, GetTime () - start);
+}
+
+
+/*
+====================
+Bench_HeartbeatLookup
+
+Time Game_GetPropertiesByHeartbeat, with a given number of additional games
+====================
+*/
+static void Bench_HeartbeatLookup (unsigned int nb_games)
+{
+    const char* tags [] = { "QuakeArena-1", "ETFlatline-1", "UnknownGame-1", "QuakeArena-1" };
+    unsigned int ind, found;
+    qboolean flatline;
+    char params [64];
+    double start;
+
+    for (ind = 0; ind < nb_games; ind++)
+    {
+        char gamename [32], heartbeat [48], flatline_tag [48];
+        const char* props [2];
+
+        snprintf (gamename, sizeof (gamename), "HbGame%u", ind);
+        snprintf (heartbeat, sizeof (heartbeat), "heartbeat=HbGame%u-1", ind);
+        snprintf (flatline_tag, sizeof (flatline_tag), "flatline=HbGameDead%u-1", ind);
+        props[0] = heartbeat;
+        props[1] = flatline_tag;
+        if (Game_UpdateProperties (gamename, props, 2) != CMDLINE_STATUS_OK)
+            return;
+    }
+
+    // New games are put at the head of the list, so the flatline tag of
+    // the first game added is the worst case for a linear search
+    if (nb_games > 0)
+        tags[3] = "HbGameDead0-1";
+
+    found = 0;
+    start = GetTime ();
+    for (ind = 0; ind < base_iterations; ind++)
+        if (Game_GetPropertiesByHeartbeat (tags[ind % 4], &flatline) != NULL)
+            found++;
+    result_sink = found;
+
+    snprintf (params, sizeof (params), "games=%u", nb_games + 3);
+    PrintResult ("heartbeat_lookup", params, base_iterations, GetTime () - start);
+}
+
+
+/*
+====================
+Bench_ProtocolLookup
+
+Time Game_GetNameByProtocol, for the built-in protocols and a large one
+====================
+*/
+static void Bench_ProtocolLookup (void)
+{
+    const int protocols [] = { 68, 84, 60, 12345 };
+    const char* props [] = { "protocols=12345" };
+    unsigned int ind, found;
+    double start;
+
+    if (Game_UpdateProperties ("LargeProtocolGame", props, 1) != CMDLINE_STATUS_OK)
+        return;
+
+    found = 0;
+    start = GetTime ();
+    for (ind = 0; ind < base_iterations; ind++)
+        if (Game_GetNameByProtocol (protocols[ind % 4], NULL) != NULL)
+            found++;
+    result_sink = found;
+
+    PrintResult ("protocol_lookup", "protocols=68,84,60,12345", base_iterations, GetTime () - start);
+}
+
+
+/*
+====================
+Bench_PolicyCheck
+
+Time Game_IsAccepted, with a reject list of a given size
+====================
+*/
+static void Bench_PolicyCheck (unsigned int nb_names)
+{
+    const char* names [4] = { "Quake3Arena", "Nexuiz", "SpamGame0", "SpamGame0" };
+    const char** rejected;
+    char* name_buffer;
+    unsigned int ind, accepted;
+    char params [64];
+    double start;
+
+    rejected = malloc (nb_names * sizeof (rejected[0]));
+    name_buffer = malloc (nb_names * 16);
+    if (rejected == NULL || name_buffer == NULL)
+        return;
+
+    for (ind = 0; ind < nb_names; ind++)
+    {
+        snprintf (&name_buffer[ind * 16], 16, "SpamGame%u", ind);
+        rejected[ind] = &name_buffer[ind * 16];
+    }
+    names[3] = rejected[nb_names - 1];
+    if (Game_DeclarePolicy ("reject", rejected, nb_names) != CMDLINE_STATUS_OK)
+        return;
+
+    accepted = 0;
+    start = GetTime ();
+    for (ind = 0; ind < base_iterations; ind++)
+        if (Game_IsAccepted (names[ind % 4]))
+            accepted++;
+    result_sink = accepted;
+
+    snprintf (params, sizeof (params), "rejected_games=%u", nb_names);
+    PrintResult ("policy_check", params, base_iterations, GetTime () - start);
+}
+
+
+/*
+====================
+Bench_GetServers
+
+Time the whole construction of a getservers response. The registered
+servers are spread over "nb_games" games, only one of them being queried.
+With "loopback", the response is really sent, on the loopback interface
+====================
+*/
+static void Bench_GetServers (unsigned int nb_servers, unsigned int nb_games, qboolean extended,
+                              qboolean loopback)
+{
+    static const char getservers [] = "getservers " BENCH_GAMENAME " 3 empty full";
+    static const char getserversext [] = "getserversExt " BENCH_GAMENAME " 3 empty full ipv4 ipv6";
+    struct sockaddr_storage address;
+    socklen_t addrlen;
+    const char* query;
+    unsigned int ind, iterations, nb_registered;
+    char params [112];
+    double duration = 0.0;
+    socket_t master_sock = INVALID_SOCKET;
+    socket_t client_sock = INVALID_SOCKET;
+
+    if (! Sv_SetMaxNbServers (nb_servers) ||
+        ! Sv_SetMaxNbServersPerAddress (0) ||
+        ! Sv_Init ())
+        return;
+
+    nb_registered = 0;
+    for (ind = 0; ind < nb_servers; ind++)
+    {
+        char gamename [GAMENAME_LENGTH];
+
+        if (ind % nb_games == 0)
+            strncpy (gamename, BENCH_GAMENAME, sizeof (gamename));
+        else
+            snprintf (gamename, sizeof (gamename), "OtherGame%u", ind % nb_games);
+
+        if (RegisterServer (ind, extended && (ind % 4) == 0, gamename))
+            nb_registered++;
+    }
+
+    query = (extended ? getserversext : getservers);
+    BuildAddress (0x00FFFFFF, false, &address, &addrlen);
+
+    // The client socket only receives the responses, we drop them
+    if (loopback)
+    {
+        struct sockaddr_in* addr4 = (struct sockaddr_in*)&address;
+
+        master_sock = socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        client_sock = socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        memset (&address, 0, sizeof (address));
+        addr4->sin_family = AF_INET;
+        addr4->sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+        addrlen = sizeof (*addr4);
+        if (master_sock < 0 || client_sock < 0 ||
+            bind (client_sock, (struct sockaddr*)&address, addrlen) != 0 ||
+            getsockname (client_sock, (struct sockaddr*)&address, &addrlen) != 0)
+        {
+            fprintf (stderr, "ERROR: can't create the sockets (%s)\n", strerror (errno));
+            return;
+        }
+        real_sends = true;
+    }
+
+    iterations = base_iterations / nb_servers;
+    if (iterations == 0)
+        iterations = 1;
+
+    nb_sent_packets = 0;
+    nb_sent_bytes = 0;
+    for (ind = 0; ind < iterations; ind++)
+    {
+        double start = GetTime ();
+
+        HandleMessage (query, strlen (query), &address, addrlen, master_sock);
+        duration += GetTime () - start;
+
+        if (loopback)
+        {
+            char packet [MAX_PACKET_SIZE_IN];
+
+            while (recv (client_sock, packet, sizeof (packet), MSG_DONTWAIT) >= 0)
+                ;
+        }
+    }
+
+    snprintf (params, sizeof (params),
+              "request=%s servers=%u games=%u packets_per_op=%lu bytes_per_op=%lu",
+              extended ? "getserversExt" : "getservers", nb_registered, nb_games,
+              nb_sent_packets / iterations, nb_sent_bytes / iterations);
+    PrintResult (loopback ? "getservers_loopback" : "getservers", params, iterations, duration);
+
+    if (loopback)
+    {
+        real_sends = false;
+        close (master_sock);
+        close (client_sock);
+    }
+}
+
+
+/*
+====================
+Bench_RecvPackets
+
+Time the reception of the packets waiting on a socket, "batch_size" packets
+at most per call. Only the time spent receiving them is measured
+====================
+*/
+static void Bench_RecvPackets (unsigned int batch_size)
+{
+    static const char getservers [] = "\xFF\xFF\xFF\xFFgetservers " BENCH_GAMENAME " 3 empty full";
+    static recv_packet_t packets [MAX_RECV_BATCH];
+    struct sockaddr_in address;
+    socklen_t addrlen = sizeof (address);
+    int recv_sock, send_sock;
+    unsigned int ind, iterations, nb_received, nb_calls, nb_dropped = 0;
+    char params [64];
+    double duration = 0.0;
+
+    recv_sock = socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    send_sock = socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    memset (&address, 0, sizeof (address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    if (recv_sock < 0 || send_sock < 0 ||
+        bind (recv_sock, (struct sockaddr*)&address, sizeof (address)) != 0 ||
+        getsockname (recv_sock, (struct sockaddr*)&address, &addrlen) != 0)
+    {
+        fprintf (stderr, "ERROR: can't create the sockets (%s)\n", strerror (errno));
+        return;
+    }
+
+    iterations = (base_iterations / 10 / MAX_RECV_BATCH) * MAX_RECV_BATCH;
+    if (iterations == 0)
+        iterations = MAX_RECV_BATCH;
+    nb_calls = 0;
+    for (ind = 0; ind < iterations; ind += MAX_RECV_BATCH)
+    {
+        unsigned int pkt_ind;
+        double start;
+
+        // Queue a full batch of packets
+        for (pkt_ind = 0; pkt_ind < MAX_RECV_BATCH; pkt_ind++)
+            __real_sendto (send_sock, getservers, sizeof (getservers) - 1, 0,
+                           (const struct sockaddr*)&address, sizeof (address));
+
+        start = GetTime ();
+        for (nb_received = 0; nb_received < MAX_RECV_BATCH; nb_calls++)
+        {
+            int nb_packets = Sys_RecvPackets (recv_sock, packets, batch_size, &nb_dropped);
+
+            if (nb_packets < 0)
+            {
+                fprintf (stderr, "ERROR: can't receive the packets (%s)\n", strerror (errno));
+                return;
+            }
+            nb_received += (unsigned int)nb_packets;
+        }
+        duration += GetTime () - start;
+    }
+
+    snprintf (params, sizeof (params), "batch=%u packets_per_call=%.1f",
+              batch_size, (double)iterations / nb_calls);
+    PrintResult ("recv_packets", params, iterations, duration);
+
+    close (recv_sock);
+    close (send_sock);
+}
+
+
+/*
+====================
+RunInChild
+
+Run a benchmark in a child process, so it gets fresh server and client tables
+====================
+*/
+static void RunInChild (void (*bench_func) (void))
+{
+    pid_t pid;
+
+    fflush (stdout);
+    pid = fork ();
+    if (pid == 0)
+    {
+        bench_func ();
+        fflush (stdout);
+        _exit (EXIT_SUCCESS);
+    }
+    else if (pid > 0)
+        waitpid (pid, NULL, 0);
+    else
+        fprintf (stderr, "ERROR: can't fork (%s)\n", strerror (errno));
+}
+
+
+// The benchmark configurations. Each one runs in its own process
+
+static void Run_SvGetByAddr_S1024 (void)      { Bench_SvGetByAddr (1024); }
+static void Run_SvGetByAddr_S4096 (void)      { Bench_SvGetByAddr (4096); }
+static void Run_SvGetByAddr_S16384 (void)     { Bench_SvGetByAddr (16384); }
+static void Run_SvGetByAddr_S65536 (void)     { Bench_SvGetByAddr (65536); }
+static void Run_SvGetByAddrCrowded_V4 (void)  { Bench_SvGetByAddrCrowded (4096, false); }
+static void Run_SvGetByAddrCrowded_V6 (void)  { Bench_SvGetByAddrCrowded (4096, true); }
+static void Run_HeartbeatLookup_G0 (void)     { Bench_HeartbeatLookup (0); }
+static void Run_HeartbeatLookup_G64 (void)    { Bench_HeartbeatLookup (64); }
+static void Run_PolicyCheck_N16 (void)        { Bench_PolicyCheck (16); }
+static void Run_PolicyCheck_N4096 (void)      { Bench_PolicyCheck (4096); }
+static void Run_GetServers_256 (void)         { Bench_GetServers (256, 1, false, false); }
+static void Run_GetServers_4096 (void)        { Bench_GetServers (4096, 1, false, false); }
+static void Run_GetServers_4096_G16 (void)    { Bench_GetServers (4096, 16, false, false); }
+static void Run_GetServersExt_4096 (void)     { Bench_GetServers (4096, 1, true, false); }
+static void Run_GetServersLoop_4096 (void)    { Bench_GetServers (4096, 1, false, true); }
+static void Run_GetServersExtLoop_4096 (void) { Bench_GetServers (4096, 1, true, true); }
+static void Run_RecvPackets_B1 (void)         { Bench_RecvPackets (1); }
+static void Run_RecvPackets_B32 (void)        { Bench_RecvPackets (MAX_RECV_BATCH); }
+
+static void (* const bench_funcs []) (void) =
+{
+    Bench_AddressHash,
+    Run_SvGetByAddr_S1024,
+    Run_SvGetByAddr_S4096,
+    Run_SvGetByAddr_S16384,
+    Run_SvGetByAddr_S65536,
+    Run_SvGetByAddrCrowded_V4,
+    Run_SvGetByAddrCrowded_V6,
+    Bench_InfoResponse,
+    Bench_ClBlockedByThrottle,
+    Run_HeartbeatLookup_G0,
+    Run_HeartbeatLookup_G64,
+    Bench_ProtocolLookup,
+    Run_PolicyCheck_N16,
+    Run_PolicyCheck_N4096,
+    Run_GetServers_256,
+    Run_GetServers_4096,
+    Run_GetServers_4096_G16,
+    Run_GetServersExt_4096,
+    Run_GetServersLoop_4096,
+    Run_GetServersExtLoop_4096,
+    Run_RecvPackets_B1,
+    Run_RecvPackets_B32,
+};
+
+
+// ---------- Public functions ---------- //
+
+/*
+====================
+main
+
+Main function
+====================
+*/
+int main (int argc, const char* argv [])
+{
+    size_t bench_ind;
+
+    // Optional parameter: the base number of iterations
+    if (argc > 1)
+    {
+        char* end_ptr;
+        long iterations = strtol (argv[1], &end_ptr, 0);
+
+        if (end_ptr == argv[1] || *end_ptr != '\0' || iterations <= 0)
+        {
+            fprintf (stderr, "Syntax: %s [iterations] (default: %u)\n",
+                     argv[0], DEFAULT_ITERATIONS);
+            return EXIT_FAILURE;
+        }
+        base_iterations = (unsigned int)iterations;
+    }
+
+    // No output from dpmaster itself, we want only the results on stdout
+    max_msg_level = MSG_NOPRINT;
+
+    crt_time = time (NULL);
+    srand ((unsigned int)crt_time);
+    Game_InitProperties ();
+
+    for (bench_ind = 0; bench_ind < sizeof (bench_funcs) / sizeof (bench_funcs[0]); bench_ind++)
+        RunInChild (bench_funcs[bench_ind]);
+
+    return EXIT_SUCCESS;
+}
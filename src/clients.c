@@ -36,6 +36,16 @@ typedef struct client_s
     time_t last_time;
 } client_t;
 
+// A server list sent to a client
+typedef struct
+{
+    struct sockaddr_storage address;
+    socklen_t addrlen;
+    unsigned int query_class;
+    unsigned int version;
+    time_t time;            // 0 if the record is unused
+} served_list_t;
+
 
 // ---------- Private variables ---------- //
 
@@ -52,12 +62,22 @@ static int last_used_slot = -1;
 static time_t fp_decay_time = DEFAULT_FP_DECAY_TIME;
 static int fp_throttle = DEFAULT_FP_THROTTLE;
 
+// Secret key of the client cookies
+static unsigned int cookie_key [2];
+
+// The server lists recently sent to clients
+static served_list_t* served_lists = NULL;
+static time_t unchanged_window = DEFAULT_UNCHANGED_WINDOW;
+
 
 // ---------- Public variables ---------- //
 
 // Enable/disabled the flood protection mechanism against abusive client requests
 qboolean flood_protection = false;
 
+// Enable/disable the cookies the clients must send back to get complete server lists
+qboolean client_cookies = false;
+
 
 // ---------- Private functions ---------- //
 
@@ -110,7 +130,7 @@ static qboolean Cl_AddClient( const struct sockaddr_storage *address, socklen_t
         if ( count == 0 )
         {
             // this entry is expired, remove from the hash
-            Com_UserHashTable_Remove( &client->user );
+            Com_UserHashTable_Remove( &hash_clients, &client->user );
             free_client = client;
             Com_Printf( MSG_DEBUG, "> Reusing expired client entry %d\n", (int)(client - clients) );
             break;
@@ -122,8 +142,6 @@ static qboolean Cl_AddClient( const struct sockaddr_storage *address, socklen_t
 
     if ( free_client != NULL )
     {
-        int hash;
-
         last_used_slot = free_slot;
 
         memcpy( &free_client->user.address, address, sizeof( free_client->user.address ) );
@@ -131,14 +149,13 @@ static qboolean Cl_AddClient( const struct sockaddr_storage *address, socklen_t
         free_client->count = 1;
         free_client->last_time = crt_time;
 
-        hash = Com_AddressHash( address, cl_hash_size );
-        Com_UserHashTable_Add( &hash_clients, &free_client->user, hash );
+        Com_UserHashTable_Add( &hash_clients, &free_client->user );
 
         Com_Printf( MSG_DEBUG,
                     "> New client added: %s\n"
                     "  - index: %u\n"
                     "  - hash: 0x%04X\n",
-                    peer_address, free_slot, hash );
+                    peer_address, free_slot, Com_AddressHash( address, hash_clients.hash_size ) );
         return true;
     }
     else
@@ -151,6 +168,77 @@ static qboolean Cl_AddClient( const struct sockaddr_storage *address, socklen_t
 }
 
 
+/*
+====================
+Cl_ComputeCookie
+
+Compute the cookie of a client address for a given period (HalfSipHash-2-4,
+keyed with "cookie_key"). Knowing the cookies of its own addresses doesn't
+help an attacker to guess the cookies of another address
+====================
+*/
+static unsigned int Cl_ComputeCookie (const struct sockaddr_storage* addr, unsigned int period)
+{
+    unsigned int words [6];
+    unsigned int v [4];
+    unsigned int word_ind;
+
+    memset (words, 0, sizeof (words));
+    if (addr->ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6* addr6 = (const struct sockaddr_in6*)addr;
+
+        words[0] = AF_INET6 | ((unsigned int)addr6->sin6_port << 16);
+        memcpy (&words[1], &addr6->sin6_addr.s6_addr, 16);
+    }
+    else
+    {
+        const struct sockaddr_in* addr4 = (const struct sockaddr_in*)addr;
+
+        words[0] = AF_INET | ((unsigned int)addr4->sin_port << 16);
+        memcpy (&words[1], &addr4->sin_addr.s_addr, 4);
+    }
+    words[5] = period;
+
+    v[0] = cookie_key[0];
+    v[1] = cookie_key[1];
+    v[2] = 0x6C796765U ^ cookie_key[0];
+    v[3] = 0x74656462U ^ cookie_key[1];
+
+    for (word_ind = 0; word_ind < sizeof (words) / sizeof (words[0]); word_ind++)
+    {
+        v[3] ^= words[word_ind];
+        Com_HalfSipRounds (v, 2);
+        v[0] ^= words[word_ind];
+    }
+
+    // The last block only contains the message length, in bytes
+    v[3] ^= (unsigned int)sizeof (words) << 24;
+    Com_HalfSipRounds (v, 2);
+    v[0] ^= (unsigned int)sizeof (words) << 24;
+
+    v[2] ^= 0xFF;
+    Com_HalfSipRounds (v, 4);
+
+    return v[1] ^ v[3];
+}
+
+
+/*
+====================
+Cl_GetServedList
+
+Get the record of the server lists sent to a client for a query
+====================
+*/
+static served_list_t* Cl_GetServedList (const struct sockaddr_storage* addr, unsigned int query_class)
+{
+    unsigned int hash = Com_AddressHash (addr, 16) ^ query_class;
+
+    return &served_lists[hash & (NB_SERVED_LISTS - 1)];
+}
+
+
 // ---------- Public functions ---------- //
 
 /*
@@ -225,6 +313,25 @@ qboolean Cl_SetFPThrottle (unsigned int throttle)
 }
 
 
+/*
+====================
+Cl_SetUnchangedWindow
+
+Set the time during which a client asking again for the same server list
+can be told it hasn't changed. 0 means the clients always get the list
+====================
+*/
+qboolean Cl_SetUnchangedWindow (unsigned int window)
+{
+    // Too late?
+    if (served_lists != NULL)
+        return false;
+
+    unchanged_window = window;
+    return true;
+}
+
+
 /*
 ====================
 Cl_Init
@@ -259,6 +366,18 @@ qboolean Cl_Init( void )
             return false;
     }
 
+    if (unchanged_window > 0)
+    {
+        served_lists = calloc (NB_SERVED_LISTS, sizeof (served_lists[0]));
+        if (served_lists == NULL)
+        {
+            Com_Printf (MSG_ERROR,
+                        "> ERROR: can't allocate the served lists array (%s)\n",
+                        strerror (errno));
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -267,19 +386,23 @@ qboolean Cl_Init( void )
 ====================
 Cl_BlockedByThrottle
 
-Return "true" if a client should be temporary ignored because he has sent too many requests recently
+Return "true" if a client should be temporary ignored because he has sent too many requests recently.
+In strict mode, a single recent request is already too many
 ====================
 */
-qboolean Cl_BlockedByThrottle( const struct sockaddr_storage* addr, socklen_t addrlen )
+qboolean Cl_BlockedByThrottle( const struct sockaddr_storage* addr, socklen_t addrlen, qboolean strict )
 {
-    unsigned int hash;
     client_t *client;
+    int throttle;
     qboolean (*IsSameAddress) (const struct sockaddr_storage* addr1, const struct sockaddr_storage* addr2, qboolean* same_public_address);
 
     // If the flood protection is disabled
     if ( !flood_protection )
         return false;
 
+    // In strict mode, a client is blocked as soon as it sends a second request before its decay time
+    throttle = ( strict && fp_throttle > 2 ? 2 : fp_throttle );
+
     if ( addr->ss_family == AF_INET6 )
         IsSameAddress = &Com_SameIPv6Addr;
     else
@@ -289,8 +412,7 @@ qboolean Cl_BlockedByThrottle( const struct sockaddr_storage* addr, socklen_t ad
     }
 
     // look for activity information about this client
-    hash = Com_AddressHash( addr, cl_hash_size );
-    client = (client_t*)hash_clients.entries[ hash ];
+    client = (client_t*)*Com_UserHashTable_GetList( &hash_clients, addr );
     while ( client != NULL )
     {
         if ( addr->ss_family == client->user.address.ss_family )
@@ -306,7 +428,7 @@ qboolean Cl_BlockedByThrottle( const struct sockaddr_storage* addr, socklen_t ad
                 const char* msg_result;
 
                 int new_count = Cl_QueryThrottleDecay( client ) + 1;
-                qboolean is_blocked = ( new_count >= fp_throttle );
+                qboolean is_blocked = ( new_count >= throttle );
                 if ( ! is_blocked )
                 {
                     client->count = new_count;
@@ -332,3 +454,108 @@ qboolean Cl_BlockedByThrottle( const struct sockaddr_storage* addr, socklen_t ad
     assert( client == NULL );
     return ( ! Cl_AddClient( addr, addrlen ) );
 }
+
+
+/*
+====================
+Cl_InitCookies
+
+Choose the secret key of the client cookies, if they're enabled
+====================
+*/
+qboolean Cl_InitCookies (void)
+{
+    if (! client_cookies)
+        return true;
+
+    if (! Sys_GetRandomBytes (cookie_key, sizeof (cookie_key)))
+    {
+        Com_Printf (MSG_ERROR, "> ERROR: can't get a secret key for the client cookies\n");
+        return false;
+    }
+
+    Com_Printf (MSG_NORMAL, "> Client cookies enabled\n");
+    return true;
+}
+
+
+/*
+====================
+Cl_GetCookie
+
+Compute the cookie of a client address for the current period
+====================
+*/
+unsigned int Cl_GetCookie (const struct sockaddr_storage* addr)
+{
+    return Cl_ComputeCookie (addr, (unsigned int)(crt_time / CLIENT_COOKIE_PERIOD));
+}
+
+
+/*
+====================
+Cl_CheckCookie
+
+Check a cookie sent back by a client. "expiring" is set to
+true if it's from the previous period, and should be replaced
+====================
+*/
+qboolean Cl_CheckCookie (const struct sockaddr_storage* addr, unsigned int cookie, qboolean* expiring)
+{
+    unsigned int period = (unsigned int)(crt_time / CLIENT_COOKIE_PERIOD);
+
+    *expiring = false;
+    if (cookie == Cl_ComputeCookie (addr, period))
+        return true;
+
+    *expiring = true;
+    return (cookie == Cl_ComputeCookie (addr, period - 1));
+}
+
+
+/*
+====================
+Cl_IsListUnchanged
+
+Check if a client has got, within the unchanged window, a complete server list
+for the same query ("query_class") with the same version as the current one
+====================
+*/
+qboolean Cl_IsListUnchanged (const struct sockaddr_storage* addr, socklen_t addrlen,
+                             unsigned int query_class, unsigned int version)
+{
+    const served_list_t* served_list;
+
+    if (served_lists == NULL)
+        return false;
+
+    served_list = Cl_GetServedList (addr, query_class);
+    return (served_list->time != 0 && crt_time - served_list->time < unchanged_window &&
+            served_list->query_class == query_class && served_list->version == version &&
+            served_list->addrlen == addrlen &&
+            memcmp (&served_list->address, addr, addrlen) == 0);
+}
+
+
+/*
+====================
+Cl_RememberList
+
+Remember that a client has got a complete server list
+====================
+*/
+void Cl_RememberList (const struct sockaddr_storage* addr, socklen_t addrlen,
+                      unsigned int query_class, unsigned int version)
+{
+    served_list_t* served_list;
+
+    if (served_lists == NULL)
+        return;
+
+    served_list = Cl_GetServedList (addr, query_class);
+    memcpy (&served_list->address, addr, addrlen);
+    served_list->addrlen = addrlen;
+    served_list->query_class = query_class;
+    served_list->version = version;
+    served_list->time = crt_time;
+}
@@ -38,12 +38,27 @@
 #define DEFAULT_FP_DECAY_TIME   3
 #define DEFAULT_FP_THROTTLE     5
 
+// Period of validity of the client cookies, in seconds. A cookie
+// is accepted during its period and during the next one
+#define CLIENT_COOKIE_PERIOD 60
+
+// Number of server lists sent to clients we remember, to tell them when a list hasn't changed.
+// Must be a power of 2. A new list replaces any other one using the same record
+#define NB_SERVED_LISTS 4096
+
+// During this time, in seconds, a client asking again for the same server list
+// can be told it hasn't changed. It then gets the whole list again
+#define DEFAULT_UNCHANGED_WINDOW 60
+
 
 // ---------- Public variables ---------- //
 
 // Enable/disabled the flood protection mechanism against abusive client requests
 extern qboolean flood_protection;
 
+// Enable/disable the cookies the clients must send back to get complete server lists
+extern qboolean client_cookies;
+
 
 // ---------- Public functions ---------- //
 
@@ -52,12 +67,34 @@ qboolean Cl_SetHashSize (unsigned int size);
 qboolean Cl_SetMaxNbClients (unsigned int nb);
 qboolean Cl_SetFPDecayTime (time_t decay);
 qboolean Cl_SetFPThrottle (unsigned int throttle);
+qboolean Cl_SetUnchangedWindow (unsigned int window);
 
 // Initialize the client list and hash tables
 qboolean Cl_Init( void );
 
-// Return "true" if a client should be temporary ignored because he has sent too many requests recently
-qboolean Cl_BlockedByThrottle( const struct sockaddr_storage* addr, socklen_t addrlen );
+// Return "true" if a client should be temporary ignored because he has sent too many requests recently.
+// In strict mode, a single recent request is already too many
+qboolean Cl_BlockedByThrottle( const struct sockaddr_storage* addr, socklen_t addrlen, qboolean strict );
+
+// Choose the secret key of the client cookies, if they're enabled.
+// Must be called before the security initializations
+qboolean Cl_InitCookies (void);
+
+// Compute the cookie of a client address for the current period
+unsigned int Cl_GetCookie (const struct sockaddr_storage* addr);
+
+// Check a cookie sent back by a client. "expiring" is set to true
+// if it's from the previous period, and should be replaced
+qboolean Cl_CheckCookie (const struct sockaddr_storage* addr, unsigned int cookie, qboolean* expiring);
+
+// Check if a client has got, within the unchanged window, a complete server list
+// for the same query ("query_class") with the same version as the current one
+qboolean Cl_IsListUnchanged (const struct sockaddr_storage* addr, socklen_t addrlen,
+                             unsigned int query_class, unsigned int version);
+
+// Remember that a client has got a complete server list
+void Cl_RememberList (const struct sockaddr_storage* addr, socklen_t addrlen,
+                      unsigned int query_class, unsigned int version);
 
 
 #endif  // #ifndef _CLIENTS_H_
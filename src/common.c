@@ -41,6 +41,11 @@ static volatile sig_atomic_t must_open_log = false;
 // Should we close the log file?
 static volatile sig_atomic_t must_close_log = false;
 
+// Secret key of the address hash function, chosen at random at startup,
+// so nobody can predict which addresses will end up in the same slots
+static unsigned int addr_hash_key = 0;
+static qboolean addr_hash_key_set = false;
+
 
 // ---------- Public variables ---------- //
 
@@ -59,6 +64,12 @@ qboolean print_date = false;
 // Are port numbers used when computing address hashes?
 qboolean hash_ports = false;
 
+// Has the process been asked to exit?
+volatile sig_atomic_t must_exit = false;
+
+// Set when the game configuration must be reloaded (SIGHUP)
+volatile sig_atomic_t must_reload_games = false;
+
 
 // ---------- Private functions ---------- //
 
@@ -228,13 +239,11 @@ qboolean Com_UserHashTable_Init (user_hash_table_t* table,
                                  size_t hash_size,
                                  const char* table_name)
 {
-    size_t array_size;
     user_t** result;
 
     assert (table_name[0] != '\0');
 
-    array_size = (1 << hash_size) * sizeof (user_t*);
-    result = malloc (array_size);
+    result = calloc ((size_t)1 << hash_size, sizeof (user_t*));
     if (result == NULL)
     {
         Com_Printf (MSG_ERROR,
@@ -243,8 +252,10 @@ qboolean Com_UserHashTable_Init (user_hash_table_t* table,
         return false;
     }
 
-    memset (result, 0, array_size);
+    memset (table, 0, sizeof (*table));
     table->entries = result;
+    table->hash_size = hash_size;
+    table->name = table_name;
 
     Com_Printf (MSG_DEBUG,
                 "> %c%s hash table allocated (%u entries)\n",
@@ -256,16 +267,13 @@ qboolean Com_UserHashTable_Init (user_hash_table_t* table,
 
 /*
 ====================
-Com_UserHashTable_Add
+Com_UserHashTable_Link
 
-Add a user to the hash table
+Put a user at the head of the list of an hash table entry
 ====================
 */
-void Com_UserHashTable_Add (user_hash_table_t* table, user_t* user, unsigned int hash)
+static void Com_UserHashTable_Link (user_t** hash_entry_ptr, user_t* user)
 {
-    user_t** hash_entry_ptr;
-
-    hash_entry_ptr = &table->entries[hash];
     user->next = *hash_entry_ptr;
     user->prev_ptr = hash_entry_ptr;
     *hash_entry_ptr = user;
@@ -274,6 +282,114 @@ void Com_UserHashTable_Add (user_hash_table_t* table, user_t* user, unsigned int
 }
 
 
+/*
+====================
+Com_UserHashTable_EmptyOldEntry
+
+Move all the users of an old entry to the new entries
+====================
+*/
+static void Com_UserHashTable_EmptyOldEntry (user_hash_table_t* table, unsigned int old_ind)
+{
+    user_t* user = table->old_entries[old_ind];
+
+    table->old_entries[old_ind] = NULL;
+    while (user != NULL)
+    {
+        user_t* next_user = user->next;
+        unsigned int hash = Com_AddressHash (&user->address, table->hash_size);
+
+        Com_UserHashTable_Link (&table->entries[hash], user);
+        user = next_user;
+    }
+}
+
+
+/*
+====================
+Com_UserHashTable_Rehash
+
+If the table is growing, empty the old entry where the users with this
+address are (if any), and the next few old entries in order
+====================
+*/
+static void Com_UserHashTable_Rehash (user_hash_table_t* table, const struct sockaddr_storage* address)
+{
+    unsigned int nb_old_entries, step;
+
+    if (table->old_entries == NULL)
+        return;
+
+    if (address != NULL)
+        Com_UserHashTable_EmptyOldEntry (table, Com_AddressHash (address, table->old_hash_size));
+
+    nb_old_entries = 1 << table->old_hash_size;
+    for (step = 0; step < USER_HASH_REHASH_STEP && table->rehash_ind < nb_old_entries; step++)
+        Com_UserHashTable_EmptyOldEntry (table, table->rehash_ind++);
+
+    if (table->rehash_ind >= nb_old_entries)
+    {
+        free (table->old_entries);
+        table->old_entries = NULL;
+
+        Com_Printf (MSG_DEBUG, "> %c%s hash table resized (%u entries)\n",
+                    toupper (table->name[0]), &table->name[1], 1 << table->hash_size);
+    }
+}
+
+
+/*
+====================
+Com_UserHashTable_Grow
+
+Double the size of the hash table. The users will be moved to the new entries
+progressively, by Com_UserHashTable_Rehash
+====================
+*/
+static void Com_UserHashTable_Grow (user_hash_table_t* table)
+{
+    user_t** new_entries;
+
+    new_entries = calloc ((size_t)1 << (table->hash_size + 1), sizeof (user_t*));
+    if (new_entries == NULL)
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: can't grow the %s hash table (%s)\n",
+                    table->name, strerror (errno));
+        return;
+    }
+
+    table->old_entries = table->entries;
+    table->old_hash_size = table->hash_size;
+    table->rehash_ind = 0;
+
+    table->entries = new_entries;
+    table->hash_size++;
+}
+
+
+/*
+====================
+Com_UserHashTable_Add
+
+Add a user to the hash table
+====================
+*/
+void Com_UserHashTable_Add (user_hash_table_t* table, user_t* user)
+{
+    unsigned int hash = Com_AddressHash (&user->address, table->hash_size);
+
+    Com_UserHashTable_Link (&table->entries[hash], user);
+    table->nb_users++;
+
+    if (table->old_entries == NULL && table->hash_size < MAX_HASH_SIZE &&
+        table->nb_users > ((unsigned int)USER_HASH_MAX_LOAD << table->hash_size))
+        Com_UserHashTable_Grow (table);
+    else
+        Com_UserHashTable_Rehash (table, NULL);
+}
+
+
 /*
 ====================
 Com_UserHashTable_Remove
@@ -281,11 +397,352 @@ Com_UserHashTable_Remove
 Remove a user from its hash table
 ====================
 */
-void Com_UserHashTable_Remove (user_t* user)
+void Com_UserHashTable_Remove (user_hash_table_t* table, user_t* user)
 {
     *user->prev_ptr = user->next;
     if (user->next != NULL)
         user->next->prev_ptr = user->prev_ptr;
+
+    assert (table->nb_users > 0);
+    table->nb_users--;
+}
+
+
+/*
+====================
+Com_UserHashTable_GetList
+
+Return the list where the users with this address are
+====================
+*/
+user_t** Com_UserHashTable_GetList (user_hash_table_t* table, const struct sockaddr_storage* address)
+{
+    // Make sure those users aren't in the old entries anymore
+    Com_UserHashTable_Rehash (table, address);
+
+    return &table->entries[Com_AddressHash (address, table->hash_size)];
+}
+
+
+/*
+====================
+Com_UserHashTable_MoveToHead
+
+Move a user to the head of its list
+====================
+*/
+void Com_UserHashTable_MoveToHead (user_t** list, user_t* user)
+{
+    if (*list == user)
+        return;
+
+    *user->prev_ptr = user->next;
+    if (user->next != NULL)
+        user->next->prev_ptr = user->prev_ptr;
+
+    Com_UserHashTable_Link (list, user);
+}
+
+
+// ---------- Public functions (address table) ---------- //
+
+/*
+====================
+Com_MakeAddrKey
+
+Build the key of an address. If "public_part_only" is set, only its
+public part is kept (no port, and only the first 64 bits of an IPv6 address)
+====================
+*/
+void Com_MakeAddrKey (const struct sockaddr_storage* address, qboolean public_part_only, addr_key_t* key)
+{
+    memset (key, 0, sizeof (*key));
+
+    if (address->ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6* addr6 = (const struct sockaddr_in6*)address;
+
+        key->words[0] = AF_INET6;
+        if (public_part_only)
+            memcpy (&key->words[2], &addr6->sin6_addr.s6_addr, 8);
+        else
+        {
+            key->words[0] |= (unsigned int)addr6->sin6_port << 16;
+            key->words[1] = (unsigned int)addr6->sin6_scope_id;
+            memcpy (&key->words[2], &addr6->sin6_addr.s6_addr, 16);
+        }
+    }
+    else
+    {
+        const struct sockaddr_in* addr4 = (const struct sockaddr_in*)address;
+
+        assert (address->ss_family == AF_INET);
+
+        key->words[0] = AF_INET;
+        if (! public_part_only)
+            key->words[0] |= (unsigned int)addr4->sin_port << 16;
+        memcpy (&key->words[2], &addr4->sin_addr.s_addr, 4);
+    }
+}
+
+
+/*
+====================
+Com_AddrKeyHash
+
+Compute the hash of an address key (MurmurHash3, keyed with "addr_hash_key")
+====================
+*/
+static unsigned int Com_AddrKeyHash (const addr_key_t* key)
+{
+    unsigned int hash = addr_hash_key;
+    unsigned int word_ind;
+
+    for (word_ind = 0; word_ind < sizeof (key->words) / sizeof (key->words[0]); word_ind++)
+    {
+        unsigned int k = key->words[word_ind] * 0xCC9E2D51U;
+
+        k = (k << 15) | (k >> 17);
+        hash ^= k * 0x1B873593U;
+        hash = (hash << 13) | (hash >> 19);
+        hash = hash * 5 + 0xE6546B64U;
+    }
+
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6BU;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35U;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+
+/*
+====================
+Com_AddrTable_SetCtrl
+
+Set the control byte of a slot. The first control bytes are duplicated after
+the last one, so a group of control bytes can be read without wrapping around
+====================
+*/
+static void Com_AddrTable_SetCtrl (addr_table_t* table, unsigned int slot_ind, qbyte ctrl)
+{
+    table->ctrl[slot_ind] = ctrl;
+    if (slot_ind < ADDR_TABLE_GROUP_SIZE - 1)
+        table->ctrl[table->mask + 1 + slot_ind] = ctrl;
+}
+
+
+/*
+====================
+Com_AddrTable_MatchGroup
+
+Return a mask of the bytes equal to "ctrl" in the group of control bytes
+starting at "slot_ind" (bit 7 of byte N is set if control byte N matches).
+A few bytes after a true match may be reported too, the keys must be checked anyway
+====================
+*/
+static unsigned int Com_AddrTable_MatchGroup (const addr_table_t* table, unsigned int slot_ind, qbyte ctrl)
+{
+    const qbyte* group = &table->ctrl[slot_ind];
+    unsigned int bytes;
+
+    // Assembled byte by byte so the result doesn't depend on the endianness
+    bytes = (unsigned int)group[0] | ((unsigned int)group[1] << 8) |
+            ((unsigned int)group[2] << 16) | ((unsigned int)group[3] << 24);
+
+    // Set the matching bytes to 0, then find the zero bytes
+    bytes ^= 0x01010101U * ctrl;
+    return (bytes - 0x01010101U) & ~bytes & 0x80808080U;
+}
+
+
+/*
+====================
+Com_AddrTable_FindSlot
+
+Return the index of the slot containing this key, or -1 if it isn't in the table
+====================
+*/
+static int Com_AddrTable_FindSlot (const addr_table_t* table, const addr_key_t* key)
+{
+    unsigned int hash = Com_AddrKeyHash (key);
+    qbyte ctrl = (qbyte)(0x80 | (hash >> 25));
+    unsigned int slot_ind = hash & table->mask;
+
+    for (;;)
+    {
+        unsigned int matches = Com_AddrTable_MatchGroup (table, slot_ind, ctrl);
+
+        while (matches != 0)
+        {
+            unsigned int byte_ind, candidate;
+
+            for (byte_ind = 0; (matches & (0x80U << (byte_ind * 8))) == 0; byte_ind++);
+            matches &= ~(0x80U << (byte_ind * 8));
+
+            candidate = (slot_ind + byte_ind) & table->mask;
+            if (table->slots[candidate].hash == hash &&
+                memcmp (&table->slots[candidate].key, key, sizeof (*key)) == 0)
+                return (int)candidate;
+        }
+
+        // A free slot ends the search
+        if (Com_AddrTable_MatchGroup (table, slot_ind, 0) != 0)
+            return -1;
+
+        slot_ind = (slot_ind + ADDR_TABLE_GROUP_SIZE) & table->mask;
+    }
+}
+
+
+/*
+====================
+Com_AddrTable_InitKey
+
+Choose the secret key of the address hash function
+====================
+*/
+qboolean Com_AddrTable_InitKey (void)
+{
+    if (! Sys_GetRandomBytes (&addr_hash_key, sizeof (addr_hash_key)))
+    {
+        Com_Printf (MSG_ERROR, "> ERROR: can't get a secret key for the address tables\n");
+        return false;
+    }
+
+    addr_hash_key_set = true;
+    return true;
+}
+
+
+/*
+====================
+Com_AddrTable_Init
+
+Initialize an address table, for up to "max_items" items
+====================
+*/
+qboolean Com_AddrTable_Init (addr_table_t* table, unsigned int max_items, const char* table_name)
+{
+    unsigned int nb_slots = ADDR_TABLE_MIN_SLOTS;
+
+    // The key is normally chosen before the chroot, but the
+    // benchmarks don't need to call Com_AddrTable_InitKey first
+    if (! addr_hash_key_set && ! Com_AddrTable_InitKey ())
+        return false;
+
+    // The table is never more than half full, so the searches stay short
+    while (nb_slots < max_items * 2)
+        nb_slots *= 2;
+
+    memset (table, 0, sizeof (*table));
+    table->ctrl = calloc (nb_slots + ADDR_TABLE_GROUP_SIZE - 1, sizeof (table->ctrl[0]));
+    table->slots = malloc (nb_slots * sizeof (table->slots[0]));
+    if (table->ctrl == NULL || table->slots == NULL)
+    {
+        Com_Printf (MSG_ERROR,
+                    "> ERROR: can't allocate the %s address table (%s)\n",
+                    table_name, strerror (errno));
+        free (table->ctrl);
+        free (table->slots);
+        return false;
+    }
+    table->mask = nb_slots - 1;
+
+    Com_Printf (MSG_DEBUG, "> %c%s address table allocated (%u slots)\n",
+                toupper (table_name[0]), &table_name[1], nb_slots);
+    return true;
+}
+
+
+/*
+====================
+Com_AddrTable_Find
+
+Return the value associated with this key, or NULL if there's none
+====================
+*/
+int* Com_AddrTable_Find (const addr_table_t* table, const addr_key_t* key)
+{
+    int slot_ind = Com_AddrTable_FindSlot (table, key);
+
+    if (slot_ind < 0)
+        return NULL;
+    return &table->slots[slot_ind].value;
+}
+
+
+/*
+====================
+Com_AddrTable_Insert
+
+Add a key to the table, with the value 0. The key must not be in the table already
+====================
+*/
+int* Com_AddrTable_Insert (addr_table_t* table, const addr_key_t* key)
+{
+    unsigned int hash = Com_AddrKeyHash (key);
+    unsigned int slot_ind = hash & table->mask;
+    addr_table_slot_t* slot;
+
+    assert (Com_AddrTable_FindSlot (table, key) < 0);
+    if (table->nb_items >= table->mask)
+        return NULL;
+
+    while (table->ctrl[slot_ind] != 0)
+        slot_ind = (slot_ind + 1) & table->mask;
+
+    slot = &table->slots[slot_ind];
+    slot->key = *key;
+    slot->hash = hash;
+    slot->value = 0;
+    Com_AddrTable_SetCtrl (table, slot_ind, (qbyte)(0x80 | (hash >> 25)));
+    table->nb_items++;
+
+    return &slot->value;
+}
+
+
+/*
+====================
+Com_AddrTable_Remove
+
+Remove a key from the table
+====================
+*/
+void Com_AddrTable_Remove (addr_table_t* table, const addr_key_t* key)
+{
+    int found_ind = Com_AddrTable_FindSlot (table, key);
+    unsigned int free_ind, slot_ind;
+
+    if (found_ind < 0)
+        return;
+
+    // Move back the following items that can be, so we don't need tombstones
+    free_ind = (unsigned int)found_ind;
+    slot_ind = free_ind;
+    for (;;)
+    {
+        unsigned int home_ind;
+
+        slot_ind = (slot_ind + 1) & table->mask;
+        if (table->ctrl[slot_ind] == 0)
+            break;
+
+        // An item can't move before its home slot
+        home_ind = table->slots[slot_ind].hash & table->mask;
+        if (((slot_ind - home_ind) & table->mask) >= ((slot_ind - free_ind) & table->mask))
+        {
+            table->slots[free_ind] = table->slots[slot_ind];
+            Com_AddrTable_SetCtrl (table, free_ind, table->ctrl[slot_ind]);
+            free_ind = slot_ind;
+        }
+    }
+
+    Com_AddrTable_SetCtrl (table, free_ind, 0);
+    table->nb_items--;
 }
 
 
@@ -358,6 +815,16 @@ void Com_SignalHandler (int Signal)
         case SIGUSR2:
             must_close_log = true;
             break;
+#endif
+#ifdef SIGTERM
+        case SIGTERM:
+            must_exit = true;
+            break;
+#endif
+#ifdef SIGHUP
+        case SIGHUP:
+            must_reload_games = true;
+            break;
 #endif
         default:
             // We aren't suppose to be here...
@@ -492,3 +959,32 @@ qboolean Com_SameIPv6Addr (const struct sockaddr_storage* addr1,
 
     return false;
 }
+
+
+/*
+====================
+Com_HalfSipRounds
+
+Apply some rounds of HalfSipHash to its state
+====================
+*/
+void Com_HalfSipRounds (unsigned int v [4], unsigned int nb_rounds)
+{
+    for (; nb_rounds > 0; nb_rounds--)
+    {
+        v[0] += v[1];
+        v[1] = (v[1] << 5) | (v[1] >> 27);
+        v[1] ^= v[0];
+        v[0] = (v[0] << 16) | (v[0] >> 16);
+        v[2] += v[3];
+        v[3] = (v[3] << 8) | (v[3] >> 24);
+        v[3] ^= v[2];
+        v[0] += v[3];
+        v[3] = (v[3] << 7) | (v[3] >> 25);
+        v[3] ^= v[0];
+        v[2] += v[1];
+        v[1] = (v[1] << 13) | (v[1] >> 19);
+        v[1] ^= v[2];
+        v[2] = (v[2] << 16) | (v[2] >> 16);
+    }
+}
@@ -61,6 +61,18 @@
 // Maximum address hash size in bits
 #define MAX_HASH_SIZE 16
 
+// A user hash table doubles its size when it has more
+// than this number of users per entry on average
+#define USER_HASH_MAX_LOAD 2
+
+// Address tables: minimum number of slots, and number of control bytes read at once
+#define ADDR_TABLE_MIN_SLOTS 16
+#define ADDR_TABLE_GROUP_SIZE 4
+
+// When a user hash table grows, the number of old entries emptied
+// each time a user is added to it, in addition to the ones emptied by lookups
+#define USER_HASH_REHASH_STEP 8
+
 
 // ---------- Types ---------- //
 
@@ -114,12 +126,46 @@ typedef struct user_s
     struct user_s** prev_ptr;
 } user_t;
 
-// Hash table for users
+// Hash table for users. When it grows, the users are moved progressively
+// from the old entries to the new ones, so no single call pays for all of them
 typedef struct user_hash_table_s
 {
     user_t** entries;
+    size_t hash_size;
+    unsigned int nb_users;
+    const char* name;
+
+    // Entries being emptied (NULL if the table isn't growing)
+    user_t** old_entries;
+    size_t old_hash_size;
+    unsigned int rehash_ind;    // next old entry to empty
 } user_hash_table_t;
 
+// Packed address, used as a key in the address tables: the family and the port
+// (word 0), the IPv6 scope ID (word 1), then the IPv4 or IPv6 address (words 2 to 5)
+typedef struct
+{
+    unsigned int words [6];
+} addr_key_t;
+
+typedef struct
+{
+    addr_key_t key;
+    unsigned int hash;
+    int value;
+} addr_table_slot_t;
+
+// Open-addressing hash table from addresses to integer values, with linear
+// probing. Each slot also has a control byte (0 if the slot is free, or 7 bits
+// of the hash), stored apart from the slots, so most probes only read those
+typedef struct
+{
+    qbyte* ctrl;
+    addr_table_slot_t* slots;
+    unsigned int mask;          // number of slots - 1
+    unsigned int nb_items;
+} addr_table_t;
+
 // All ports (one or more per game) to listen on
 typedef struct listen_ports_s
 {
@@ -145,19 +191,54 @@ extern qboolean print_date;
 // Are port numbers used when computing address hashes?
 extern qboolean hash_ports;
 
+// Has the process been asked to exit?
+extern volatile sig_atomic_t must_exit;
+
+// Set when the game configuration must be reloaded (SIGHUP)
+extern volatile sig_atomic_t must_reload_games;
+
 
 // ---------- Public functions (user hash table) ---------- //
 
-// Initialize a user hash table
+// Initialize a user hash table. "hash_size" is its initial size
 qboolean Com_UserHashTable_Init (user_hash_table_t* table,
                                  size_t hash_size,
                                  const char* table_name);
 
 // Add a user to the hash table
-void Com_UserHashTable_Add (user_hash_table_t* table, user_t* user, unsigned int hash);
+void Com_UserHashTable_Add (user_hash_table_t* table, user_t* user);
 
 // Remove a user from its hash table
-void Com_UserHashTable_Remove (user_t* user);
+void Com_UserHashTable_Remove (user_hash_table_t* table, user_t* user);
+
+// Return the list where the users with this address are
+user_t** Com_UserHashTable_GetList (user_hash_table_t* table, const struct sockaddr_storage* address);
+
+// Move a user to the head of its list
+void Com_UserHashTable_MoveToHead (user_t** list, user_t* user);
+
+
+// ---------- Public functions (address table) ---------- //
+
+// Build the key of an address. If "public_part_only" is set, only its
+// public part is kept (no port, and only the first 64 bits of an IPv6 address)
+void Com_MakeAddrKey (const struct sockaddr_storage* address, qboolean public_part_only, addr_key_t* key);
+
+// Choose the secret key of the address hash function. Must be called before
+// the security initializations, while the random device is reachable
+qboolean Com_AddrTable_InitKey (void);
+
+// Initialize an address table, for up to "max_items" items
+qboolean Com_AddrTable_Init (addr_table_t* table, unsigned int max_items, const char* table_name);
+
+// Return the value associated with this key, or NULL if there's none
+int* Com_AddrTable_Find (const addr_table_t* table, const addr_key_t* key);
+
+// Add a key to the table, with the value 0. The key must not be in the table already
+int* Com_AddrTable_Insert (addr_table_t* table, const addr_key_t* key);
+
+// Remove a key from the table
+void Com_AddrTable_Remove (addr_table_t* table, const addr_key_t* key);
 
 
 // ---------- Public functions (logging) ---------- //
@@ -195,5 +276,8 @@ qboolean Com_SameIPv4Addr (const struct sockaddr_storage* addr1, const struct so
 // Compare 2 IPv6 addresses and return "true" if they're equal
 qboolean Com_SameIPv6Addr (const struct sockaddr_storage* addr1, const struct sockaddr_storage* addr2, qboolean* same_public_address);
 
+// Apply some rounds of HalfSipHash to its state
+void Com_HalfSipRounds (unsigned int v [4], unsigned int nb_rounds);
+
 
 #endif  // #ifndef _COMMON_H_
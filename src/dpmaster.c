@@ -28,7 +28,10 @@
 #include "clients.h"
 #include "games.h"
 #include "messages.h"
+#include "pacing.h"
+#include "peers.h"
 #include "servers.h"
+#include "upstream.h"
 
 
 // ---------- Constants ---------- //
@@ -36,6 +39,37 @@
 // Version of dpmaster
 #define VERSION "2.2"
 
+// The load shedding stops after this number of seconds without any sign of overload
+#define LOAD_SHEDDING_DURATION 5
+
+// A listening socket has a backlog when this number of batches in
+// a row didn't get all the packets waiting on it
+#define BACKLOG_NB_BATCHES 8
+
+// The maximum number of server list requests waiting to be handled
+#define MAX_QUEUED_QUERIES 128
+
+// The maximum number of queued server list requests handled
+// before the listening sockets are checked again
+#define QUERY_BUDGET 8
+
+
+// ---------- Private types ---------- //
+
+// The load of a listening socket, as seen by the admission controller
+typedef struct
+{
+    unsigned int nb_dropped;        // packets the kernel has dropped on it so far
+    unsigned int nb_full_batches;   // batches in a row which were full
+} socket_load_t;
+
+// A server list request waiting to be handled
+typedef struct
+{
+    recv_packet_t packet;
+    socket_t recv_sock;
+} queued_query_t;
+
 
 // ---------- Private variables ---------- //
 
@@ -55,12 +89,32 @@ static const cmdlineopt_t cmdline_options [] =
     {
         "cl-hash-size",
         "<hash_size>",
-        "Hash size used for clients, in bits, up to %d (default: %d)",
+        "Initial hash size used for clients, in bits, up to %d (default: %d)",
         { MAX_HASH_SIZE, DEFAULT_CL_HASH_SIZE },
         '\0',
         1,
         1
     },
+    {
+        "client-cookies",
+        NULL,
+        "Only send the first packet of a server list to the clients that don't send\n"
+        "   back the cookie they got, so spoofed requests can't get big answers",
+        { 0, 0 },
+        '\0',
+        0,
+        0
+    },
+    {
+        "client-rate",
+        "<rate>",
+        "Maximum rate of the server lists sent to each client, in kilobytes per second.\n"
+        "   The packets exceeding it are spaced out (default: 0, meaning no limit)",
+        { 0, 0 },
+        '\0',
+        1,
+        1
+    },
     {
         "flood-protection",
         NULL,
@@ -88,6 +142,16 @@ static const cmdlineopt_t cmdline_options [] =
         1,
         1
     },
+    {
+        "game-config",
+        "<file_path>",
+        "Read game properties and policies from a file, reloaded on SIGHUP.\n"
+        "   Each line is a \"game-properties\" or \"game-policy\" option, without \"--\"",
+        { 0, 0 },
+        '\0',
+        1,
+        1
+    },
     {
         "game-properties",
         "[game_name <property> ...]",
@@ -121,8 +185,9 @@ static const cmdlineopt_t cmdline_options [] =
     {
         "hash-ports",
         NULL,
-        "Use both an host's address and port number when computing its hash value.\n"
-        "   The check for a maximum number of servers per address won't work correctly.\n"
+        "Use both a client's address and port number when computing its hash value.\n"
+        "   It only changes how the clients are spread in their hash table, the\n"
+        "   servers aren't hashed this way anymore.\n"
         "   FOR DEBUGGING PURPOSES ONLY!",
         { 0, 0 },
         '\0',
@@ -132,8 +197,9 @@ static const cmdlineopt_t cmdline_options [] =
     {
         "hash-size",
         "<hash_size>",
-        "Hash size used for servers in bits, up to %d (default: %d)",
-        { MAX_HASH_SIZE, DEFAULT_SV_HASH_SIZE },
+        "Obsolete and ignored: the server tables are sized according to the\n"
+        "   maximum number of servers (see \"--max-servers\")",
+        { 0, 0 },
         'H',
         1,
         1
@@ -204,6 +270,127 @@ static const cmdlineopt_t cmdline_options [] =
         1,
         1
     },
+    {
+        "peer",
+        "<address>",
+        "Exchange the server list with the peer master at <address>\n"
+        "   You can declare up to %d peers",
+        { MAX_PEERS, 0 },
+        '\0',
+        1,
+        1
+    },
+    {
+        "peer-secret",
+        "<secret>",
+        "Authenticate the messages exchanged with the peer masters with <secret>\n"
+        "   All the peers must use the same secret",
+        { 0, 0 },
+        '\0',
+        1,
+        1
+    },
+    {
+        "recv-buffer",
+        "<size>",
+        "Size of the receive buffer of the listening sockets, in bytes\n"
+        "   (default: system setting)",
+        { 0, 0 },
+        '\0',
+        1,
+        1
+    },
+    {
+        "send-buffer",
+        "<size>",
+        "Size of the send buffer of the listening sockets, in bytes\n"
+        "   (default: system setting)",
+        { 0, 0 },
+        '\0',
+        1,
+        1
+    },
+    {
+        "server-timeout",
+        "<timeout>",
+        "Time after which a server that hasn't sent a valid infoResponse again\n"
+        "   is removed from the list, in seconds (default: %d)",
+        { TIMEOUT_INFORESPONSE, 0 },
+        '\0',
+        1,
+        1
+    },
+    {
+        "snapshot-file",
+        "<file_path>",
+        "Save the server registry to <file_path> periodically and when exiting,\n"
+        "   and reload it at startup (default: no snapshot)",
+        { 0, 0 },
+        '\0',
+        1,
+        1
+    },
+    {
+        "snapshot-period",
+        "<period>",
+        "Period between 2 saves of the registry snapshot, in seconds (default: %d)\n"
+        "   0 means it's only saved when exiting",
+        { DEFAULT_SNAPSHOT_PERIOD, 0 },
+        '\0',
+        1,
+        1
+    },
+    {
+        "trust-window",
+        "<window>",
+        "Time during which the heartbeats of a server that has sent a valid infoResponse\n"
+        "   only trigger a single getinfo at its end, in seconds (default: 0, meaning\n"
+        "   they always trigger a getinfo right away)",
+        { 0, 0 },
+        '\0',
+        1,
+        1
+    },
+    {
+        "unchanged-window",
+        "<window>",
+        "Time during which a client asking again for the same server list with the\n"
+        "   \"ifchanged\" option is told it hasn't changed, in seconds (default: %d)\n"
+        "   0 means the clients always get the list",
+        { DEFAULT_UNCHANGED_WINDOW, 0 },
+        '\0',
+        1,
+        1
+    },
+    {
+        "upload-rate",
+        "<rate>",
+        "Maximum rate of the server lists sent to all clients, in kilobytes per second.\n"
+        "   The packets exceeding it are spaced out (default: 0, meaning no limit)",
+        { 0, 0 },
+        '\0',
+        1,
+        1
+    },
+    {
+        "upstream",
+        "<address> <game_name> <protocol>",
+        "Periodically get the <game_name> servers using <protocol> from the master\n"
+        "   at <address>, and add them to our list. Can be specified more than once",
+        { 0, 0 },
+        '\0',
+        3,
+        3
+    },
+    {
+        "upstream-period",
+        "<period>",
+        "Period between 2 queries of the upstream masters, in seconds (default: %d)",
+        { DEFAULT_UPSTREAM_PERIOD, 0 },
+        '\0',
+        1,
+        1
+    },
     {
         "verbose",
         "[verbose_lvl]",
@@ -224,6 +411,18 @@ static const cmdlineopt_t cmdline_options [] =
     }
 };
 
+// Packets received from the listening sockets
+static recv_packet_t recv_packets [MAX_RECV_BATCH];
+
+// The load of each listening socket, and when the load shedding will stop
+static socket_load_t socket_loads [MAX_LISTEN_SOCKETS];
+static time_t load_shedding_end = 0;
+
+// The server list requests waiting for the servers' messages to be handled first
+static queued_query_t query_queue [MAX_QUEUED_QUERIES];
+static unsigned int query_queue_start = 0;
+static unsigned int nb_queued_queries = 0;
+
 
 // ---------- Private functions ---------- //
 
@@ -279,6 +478,24 @@ static qboolean UnsecureInit (listen_ports_t* listen_ports)
     if (! Sys_ResolveListenAddresses (listen_ports))
         return false;
 
+    // Resolve the peer master addresses. By default, we assume
+    // they use the same port as our first listening port
+    if (! Peer_ResolveAddresses (listen_ports != NULL ? listen_ports->port : NULL))
+        return false;
+
+    // Resolve the upstream master addresses, with the same default port
+    if (! Upstream_ResolveAddresses (listen_ports != NULL ? listen_ports->port : NULL))
+        return false;
+
+    // Open the registry snapshot file while it's still reachable
+    if (! Sv_OpenSnapshot ())
+        return false;
+
+    // Choose the secret keys of the address tables and of the client
+    // cookies while the random device is reachable
+    if (! Com_AddrTable_InitKey () || ! Cl_InitCookies ())
+        return false;
+
     return true;
 }
 
@@ -375,6 +592,33 @@ static cmdline_status_t Cmdline_Option (const cmdlineopt_t* opt, const char** pa
             return CMDLINE_STATUS_INVALID_OPT_PARAMS;
     }
 
+    // Client cookies
+    else if (strcmp (opt_name, "client-cookies") == 0)
+        client_cookies = true;
+
+    // Maximum rate of the server lists sent to each client
+    else if (strcmp (opt_name, "client-rate") == 0)
+    {
+        const char* start_ptr;
+        char* end_ptr;
+        unsigned int rate;
+
+        start_ptr = params[0];
+        rate = (unsigned int)strtol (start_ptr, &end_ptr, 0);
+        if (end_ptr == start_ptr || *end_ptr != '\0')
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+
+        if (! Pace_SetClientRate (rate))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
+    // Game configuration file
+    else if (strcmp (opt_name, "game-config") == 0)
+    {
+        if (! Game_SetConfigFile (params[0]))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
     // Game properties
     else if (strcmp (opt_name, "game-properties") == 0)
     {
@@ -398,7 +642,7 @@ static cmdline_status_t Cmdline_Option (const cmdlineopt_t* opt, const char** pa
     else if (strcmp (opt_name, "hash-ports") == 0)
         hash_ports = true;
 
-    // Server hash size
+    // Server hash size (obsolete, still accepted so existing command lines keep working)
     else if (strcmp (opt_name, "hash-size") == 0)
     {
         const char* start_ptr;
@@ -407,11 +651,11 @@ static cmdline_status_t Cmdline_Option (const cmdlineopt_t* opt, const char** pa
 
         start_ptr = params[0];
         hash_size = (unsigned int)strtol (start_ptr, &end_ptr, 0);
-        if (end_ptr == start_ptr || *end_ptr != '\0')
+        if (end_ptr == start_ptr || *end_ptr != '\0' || hash_size > MAX_HASH_SIZE)
             return CMDLINE_STATUS_INVALID_OPT_PARAMS;
 
-        if (! Sv_SetHashSize (hash_size))
-            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: the option \"--hash-size\" is obsolete and ignored (see \"--max-servers\")\n");
     }
 
     // Listen address
@@ -493,6 +737,169 @@ static cmdline_status_t Cmdline_Option (const cmdlineopt_t* opt, const char** pa
             return CMDLINE_STATUS_INVALID_OPT_PARAMS;
     }
 
+    // Peer master
+    else if (strcmp (opt_name, "peer") == 0)
+    {
+        const char* param;
+
+        param = params[0];
+        if (param[0] == '\0')
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+
+        if (! Peer_Declare (param))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
+    // Secret shared by the peer masters
+    else if (strcmp (opt_name, "peer-secret") == 0)
+    {
+        if (! Peer_SetSecret (params[0]))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
+    // Size of the receive buffer of the sockets
+    else if (strcmp (opt_name, "recv-buffer") == 0)
+    {
+        const char* start_ptr;
+        char* end_ptr;
+        unsigned int buffer_size;
+
+        start_ptr = params[0];
+        buffer_size = (unsigned int)strtol (start_ptr, &end_ptr, 0);
+        if (end_ptr == start_ptr || *end_ptr != '\0')
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+
+        if (! Sys_SetRecvBufferSize (buffer_size))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
+    // Size of the send buffer of the sockets
+    else if (strcmp (opt_name, "send-buffer") == 0)
+    {
+        const char* start_ptr;
+        char* end_ptr;
+        unsigned int buffer_size;
+
+        start_ptr = params[0];
+        buffer_size = (unsigned int)strtol (start_ptr, &end_ptr, 0);
+        if (end_ptr == start_ptr || *end_ptr != '\0')
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+
+        if (! Sys_SetSendBufferSize (buffer_size))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
+    // Server timeout
+    else if (strcmp (opt_name, "server-timeout") == 0)
+    {
+        const char* start_ptr;
+        char* end_ptr;
+        unsigned int timeout;
+
+        start_ptr = params[0];
+        timeout = (unsigned int)strtol (start_ptr, &end_ptr, 0);
+        if (end_ptr == start_ptr || *end_ptr != '\0')
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+
+        if (! SetServerTimeout (timeout))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
+    // Registry snapshot file
+    else if (strcmp (opt_name, "snapshot-file") == 0)
+    {
+        if (! Sv_SetSnapshotFile (params[0]))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
+    // Registry snapshot period
+    else if (strcmp (opt_name, "snapshot-period") == 0)
+    {
+        const char* start_ptr;
+        char* end_ptr;
+        unsigned int period;
+
+        start_ptr = params[0];
+        period = (unsigned int)strtol (start_ptr, &end_ptr, 0);
+        if (end_ptr == start_ptr || *end_ptr != '\0')
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+
+        if (! Sv_SetSnapshotPeriod (period))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
+    // Time during which the heartbeats of a verified server are trusted
+    else if (strcmp (opt_name, "trust-window") == 0)
+    {
+        const char* start_ptr;
+        char* end_ptr;
+        unsigned int window;
+
+        start_ptr = params[0];
+        window = (unsigned int)strtol (start_ptr, &end_ptr, 0);
+        if (end_ptr == start_ptr || *end_ptr != '\0')
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+
+        if (! SetTrustWindow (window))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
+    // Time during which the clients can be told a list hasn't changed
+    else if (strcmp (opt_name, "unchanged-window") == 0)
+    {
+        const char* start_ptr;
+        char* end_ptr;
+        unsigned int window;
+
+        start_ptr = params[0];
+        window = (unsigned int)strtol (start_ptr, &end_ptr, 0);
+        if (end_ptr == start_ptr || *end_ptr != '\0')
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+
+        if (! Cl_SetUnchangedWindow (window))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
+    // Maximum rate of the server lists sent to all clients
+    else if (strcmp (opt_name, "upload-rate") == 0)
+    {
+        const char* start_ptr;
+        char* end_ptr;
+        unsigned int rate;
+
+        start_ptr = params[0];
+        rate = (unsigned int)strtol (start_ptr, &end_ptr, 0);
+        if (end_ptr == start_ptr || *end_ptr != '\0')
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+
+        if (! Pace_SetUploadRate (rate))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
+    // Upstream master
+    else if (strcmp (opt_name, "upstream") == 0)
+    {
+        if (params[0][0] == '\0' ||
+            ! Upstream_Declare (params[0], params[1], params[2]))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
+    // Upstream master query period
+    else if (strcmp (opt_name, "upstream-period") == 0)
+    {
+        const char* start_ptr;
+        char* end_ptr;
+        unsigned int period;
+
+        start_ptr = params[0];
+        period = (unsigned int)strtol (start_ptr, &end_ptr, 0);
+        if (end_ptr == start_ptr || *end_ptr != '\0')
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+
+        if (! Upstream_SetPeriod (period))
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
     // Verbose level
     else if (strcmp (opt_name, "verbose") == 0)
     {
@@ -887,8 +1294,22 @@ static qboolean SecureInit (void)
         return false;
     }
 #endif
+#ifdef SIGTERM
+    if (signal (SIGTERM, Com_SignalHandler) == SIG_ERR)
+    {
+        Com_Printf (MSG_ERROR, "> ERROR: can't capture the SIGTERM signal\n");
+        return false;
+    }
+#endif
+#ifdef SIGHUP
+    if (signal (SIGHUP, Com_SignalHandler) == SIG_ERR)
+    {
+        Com_Printf (MSG_ERROR, "> ERROR: can't capture the SIGHUP signal\n");
+        return false;
+    }
+#endif
 
-    if (! Sys_CreateListenSockets ())
+    if (! Sys_CreateListenSockets (message_prefixes))
         return false;
 
     // If there no socket to listen to for whatever reason, there's simply nothing to do
@@ -906,10 +1327,296 @@ static qboolean SecureInit (void)
     if (! Cl_Init ())
         return false;
 
+    // Start pacing the outbound server lists, if asked to
+    if (! Pace_Init ())
+        return false;
+
+    // Ask the servers loaded from the registry snapshot to prove they're still there
+    ChallengeAllServers ();
+
+    // Start querying the upstream masters
+    if (! Upstream_Init ())
+        return false;
+
     return true;
 }
 
 
+/*
+====================
+GetSelectTimeout
+
+Compute the maximum time we can wait for new packets, or return NULL if we can wait forever
+====================
+*/
+static struct timeval* GetSelectTimeout (struct timeval* timeout)
+{
+    const time_t task_times [] =
+    {
+        Sv_GetNextSnapshotTime (),
+        Peer_GetNextSyncTime (),
+        Upstream_GetNextTime (),
+        Sv_GetNextRevalidationTime (),
+        GetNextDeferredGetInfoTime (),
+        Sys_GetNextDropReportTime (),
+        Pace_GetNextReportTime (),
+        load_shedding ? load_shedding_end : 0,
+    };
+    time_t next_time = 0;
+    double next_send_time;
+    size_t task_ind;
+
+    for (task_ind = 0; task_ind < sizeof (task_times) / sizeof (task_times[0]); task_ind++)
+        if (task_times[task_ind] != 0 &&
+            (next_time == 0 || task_times[task_ind] < next_time))
+            next_time = task_times[task_ind];
+
+    // The paced packets need a sub-second precision
+    next_send_time = Pace_GetNextSendTime ();
+    if (next_send_time != 0.0)
+    {
+        double delay = next_send_time - Sys_GetPreciseTime ();
+
+        if (delay < 0.0)
+            delay = 0.0;
+        if (next_time == 0 || delay < (double)(next_time - crt_time))
+        {
+            timeout->tv_sec = (long)delay;
+            timeout->tv_usec = (long)((delay - timeout->tv_sec) * 1000000.0);
+            return timeout;
+        }
+    }
+
+    if (next_time == 0)
+        return NULL;
+
+    timeout->tv_sec = (next_time > crt_time ? (long)(next_time - crt_time) : 0);
+    timeout->tv_usec = 0;
+    return timeout;
+}
+
+
+/*
+====================
+RunPeriodicTasks
+
+Run the tasks that depend on the time rather than on the network traffic
+====================
+*/
+static void RunPeriodicTasks (void)
+{
+    Sv_UpdateSnapshot ();
+    Peer_Update ();
+    Upstream_Update ();
+
+    // Reload the game configuration if asked to, unless
+    // the servers are still being checked against the previous one
+    if (must_reload_games && Sv_GetNextRevalidationTime () == 0)
+    {
+        must_reload_games = false;
+        if (Game_ReloadConfig ())
+            Sv_StartRevalidation ();
+    }
+    Sv_UpdateRevalidation ();
+    SendDeferredGetInfos ();
+    Sys_ReportDroppedPackets ();
+    Pace_Update ();
+
+    if (load_shedding && crt_time >= load_shedding_end)
+    {
+        load_shedding = false;
+        Com_Printf (MSG_NORMAL, "> End of the load shedding\n");
+    }
+}
+
+
+/*
+====================
+ShedClientLoad
+
+Start shedding the client load, or keep on doing it for a while
+====================
+*/
+static void ShedClientLoad (void)
+{
+    load_shedding = true;
+    load_shedding_end = crt_time + LOAD_SHEDDING_DURATION;
+}
+
+
+/*
+====================
+UpdateLoadShedding
+
+Look for signs of overload after receiving a batch of packets on a listening
+socket: packets dropped by the kernel, or a backlog of packets. If there's
+one, shed the client load for a while, to keep up with the servers' messages
+====================
+*/
+static void UpdateLoadShedding (unsigned int sock_ind, unsigned int nb_packets, unsigned int nb_dropped)
+{
+    socket_load_t* load = &socket_loads[sock_ind];
+    unsigned int nb_new_drops;
+
+    // The kernel counts the packets dropped by the socket filter
+    // along with the others, but those aren't a sign of overload
+    nb_new_drops = (listen_sockets[sock_ind].filtered ? 0 : nb_dropped - load->nb_dropped);
+    load->nb_dropped = nb_dropped;
+
+    if (nb_packets < MAX_RECV_BATCH)
+        load->nb_full_batches = 0;
+    else
+        load->nb_full_batches++;
+
+    if (nb_new_drops == 0 && load->nb_full_batches < BACKLOG_NB_BATCHES)
+        return;
+
+    if (! load_shedding)
+    {
+        const listen_socket_t* listen_sock = &listen_sockets[sock_ind];
+        const char* addr_str = Sys_SockaddrToString (&listen_sock->local_addr,
+                                                     listen_sock->local_addr_len);
+
+        if (nb_new_drops > 0)
+            Com_Printf (MSG_WARNING,
+                        "> WARNING: the kernel dropped %u packets on %s, shedding the client load\n",
+                        nb_new_drops, addr_str);
+        else
+            Com_Printf (MSG_WARNING,
+                        "> WARNING: packets are piling up on %s, shedding the client load\n",
+                        addr_str);
+    }
+    ShedClientLoad ();
+}
+
+
+/*
+====================
+HandlePacket
+
+Check a received packet and handle the message it contains
+====================
+*/
+static void HandlePacket (recv_packet_t* recv_packet, socket_t recv_sock)
+{
+    const struct sockaddr_storage* address = &recv_packet->address;
+    socklen_t addrlen = recv_packet->addrlen;
+    int nb_bytes = recv_packet->length;
+    char* packet = recv_packet->data;
+
+    // If we may print something, rebuild the peer address string
+    if (max_msg_level > MSG_NOPRINT &&
+        (Com_IsLogEnabled() || daemon_state < DAEMON_STATE_EFFECTIVE))
+    {
+        strncpy (peer_address, Sys_SockaddrToString(address, addrlen),
+                 sizeof (peer_address));
+        peer_address[sizeof (peer_address) - 1] = '\0';
+    }
+
+    // We print the packet contents if necessary
+    if (max_msg_level >= MSG_DEBUG)
+    {
+        Com_Printf (MSG_DEBUG, "> New packet received from %s: ",
+                    peer_address);
+        PrintPacket ((qbyte*)packet, nb_bytes);
+    }
+
+    // A few sanity checks
+    if (address->ss_family != AF_INET && address->ss_family != AF_INET6)
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: rejected packet from %s (invalid address family: %hd)\n",
+                    peer_address, address->ss_family);
+        return;
+    }
+    if (Sys_GetSockaddrPort(address) == 0)
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: rejected packet from %s (source port = 0)\n",
+                    peer_address);
+        return;
+    }
+    if (nb_bytes < MIN_PACKET_SIZE_IN)
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: rejected packet from %s (size = %d bytes)\n",
+                    peer_address, nb_bytes);
+        return;
+    }
+    if (packet[0] != '\xFF' || packet[1] != '\xFF' || packet[2] != '\xFF' || packet[3] != '\xFF')
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: rejected packet from %s (invalid header)\n",
+                    peer_address);
+        return;
+    }
+
+    // Append a '\0' to make the parsing easier
+    packet[nb_bytes] = '\0';
+
+    // Call HandleMessage with the remaining contents
+    HandleMessage (packet + 4, nb_bytes - 4, address, addrlen, recv_sock);
+}
+
+
+/*
+====================
+QueueQuery
+
+Put a server list request in the queue, so that the servers'
+messages received at the same time can be handled before it
+====================
+*/
+static void QueueQuery (const recv_packet_t* recv_packet, socket_t recv_sock)
+{
+    queued_query_t* query;
+
+    if (nb_queued_queries == MAX_QUEUED_QUERIES)
+    {
+        if (! load_shedding)
+            Com_Printf (MSG_WARNING,
+                        "> WARNING: too many server list requests are waiting, shedding the client load\n");
+        ShedClientLoad ();
+
+        Com_Printf (MSG_DEBUG, "> Dropping a server list request (the queue is full)\n");
+        return;
+    }
+
+    query = &query_queue[(query_queue_start + nb_queued_queries) % MAX_QUEUED_QUERIES];
+    nb_queued_queries++;
+
+    // The packets are much smaller than their buffer, so only their contents are copied
+    query->packet.address = recv_packet->address;
+    query->packet.addrlen = recv_packet->addrlen;
+    query->packet.length = recv_packet->length;
+    memcpy (query->packet.data, recv_packet->data, recv_packet->length);
+    query->recv_sock = recv_sock;
+}
+
+
+/*
+====================
+HandleQueuedQueries
+
+Handle the oldest server list requests in the queue, up to QUERY_BUDGET
+====================
+*/
+static void HandleQueuedQueries (void)
+{
+    unsigned int nb_handled;
+
+    for (nb_handled = 0; nb_handled < QUERY_BUDGET && nb_queued_queries > 0; nb_handled++)
+    {
+        queued_query_t* query = &query_queue[query_queue_start];
+
+        query_queue_start = (query_queue_start + 1) % MAX_QUEUED_QUERIES;
+        nb_queued_queries--;
+
+        HandlePacket (&query->packet, query->recv_sock);
+    }
+}
+
+
 /*
 ====================
 main
@@ -953,6 +1660,11 @@ int main (int argc, const char* argv [])
         return EXIT_FAILURE;
     }
 
+    // Apply the game configuration file, if any. It stays open, so
+    // it can be read again from the chroot jail when reloading it
+    if (! Game_LoadConfig ())
+        return EXIT_FAILURE;
+
     // Get any ports to listen on
     port_ind = listen_ports = Game_GetPorts();
 
@@ -984,6 +1696,9 @@ int main (int argc, const char* argv [])
         socket_t max_sock;
         size_t sock_ind;
         int nb_sock_ready;
+        int select_error;
+        struct timeval timeout;
+        struct timeval* select_timeout;
 
         FD_ZERO(&sock_set);
         max_sock = INVALID_SOCKET;
@@ -1002,7 +1717,21 @@ int main (int argc, const char* argv [])
         if (daemon_state < DAEMON_STATE_EFFECTIVE)
             fflush (stdout);
 
-        nb_sock_ready = select ((int)(max_sock + 1), &sock_set, NULL, NULL, NULL);
+        // Don't wait for new packets if some requests are still queued
+        if (nb_queued_queries > 0)
+        {
+            timeout.tv_sec = 0;
+            timeout.tv_usec = 0;
+            select_timeout = &timeout;
+        }
+        else
+            select_timeout = GetSelectTimeout (&timeout);
+
+        nb_sock_ready = select ((int)(max_sock + 1), &sock_set, NULL, NULL,
+                                select_timeout);
+
+        // Keep the error code, the periodic tasks may overwrite it
+        select_error = (nb_sock_ready < 0 ? Sys_GetLastNetError () : 0);
 
         // Update the current time
         crt_time = time (NULL);
@@ -1013,93 +1742,60 @@ int main (int argc, const char* argv [])
         // Print the date once per select()
         print_date = true;
 
-        if (nb_sock_ready <= 0)
+        if (must_exit)
         {
-            if (Sys_GetLastNetError() != NETERR_INTR)
-                Com_Printf (MSG_WARNING,
-                            "> WARNING: \"select\" returned %d\n",
-                            nb_sock_ready);
-            continue;
+            Com_Printf (MSG_NORMAL, "> Exiting\n");
+            Sv_SaveSnapshot ();
+            if (Com_IsLogEnabled ())
+                Com_FlushLog ();
+            return EXIT_SUCCESS;
         }
 
+        RunPeriodicTasks ();
+
+        if (nb_sock_ready < 0 && select_error != NETERR_INTR)
+            Com_Printf (MSG_WARNING,
+                        "> WARNING: \"select\" returned %d\n",
+                        nb_sock_ready);
+
         for (sock_ind = 0;
              sock_ind < nb_sockets && nb_sock_ready > 0;
              sock_ind++)
         {
-            struct sockaddr_storage address;
-            socklen_t addrlen;
-            int nb_bytes;
-            char packet [MAX_PACKET_SIZE_IN + 1];  // "+ 1" because we append a '\0'
             socket_t crt_sock = listen_sockets[sock_ind].socket;
+            int nb_packets, packet_ind;
+            unsigned int nb_dropped;
 
             if (! FD_ISSET (crt_sock, &sock_set))
                 continue;
             nb_sock_ready--;
 
-            // Get the next valid message
-            addrlen = sizeof (address);
-            nb_bytes = recvfrom (crt_sock, packet, sizeof (packet) - 1, 0,
-                                 (struct sockaddr*)&address, &addrlen);
-
-            if (nb_bytes <= 0)
+            // Get all the waiting messages at once, if possible
+            nb_dropped = socket_loads[sock_ind].nb_dropped;
+            nb_packets = Sys_RecvPackets (crt_sock, recv_packets, MAX_RECV_BATCH, &nb_dropped);
+            if (nb_packets < 0)
             {
                 Com_Printf (MSG_WARNING,
-                            "> WARNING: \"recvfrom\" returned %d\n", nb_bytes);
+                            "> WARNING: can't receive packets (%s)\n",
+                            Sys_GetLastNetErrorString ());
                 continue;
             }
+            UpdateLoadShedding (sock_ind, (unsigned int)nb_packets, nb_dropped);
 
-            // If we may print something, rebuild the peer address string
-            if (max_msg_level > MSG_NOPRINT &&
-                (Com_IsLogEnabled() || daemon_state < DAEMON_STATE_EFFECTIVE))
-            {
-                strncpy (peer_address, Sys_SockaddrToString(&address, addrlen),
-                         sizeof (peer_address));
-                peer_address[sizeof (peer_address) - 1] = '\0';
-            }
-
-            // We print the packet contents if necessary
-            if (max_msg_level >= MSG_DEBUG)
+            // The server list requests are the most costly messages to handle,
+            // so they wait until the servers' messages have been handled
+            for (packet_ind = 0; packet_ind < nb_packets; packet_ind++)
             {
-                Com_Printf (MSG_DEBUG, "> New packet received from %s: ",
-                            peer_address);
-                PrintPacket ((qbyte*)packet, nb_bytes);
-            }
+                recv_packet_t* recv_packet = &recv_packets[packet_ind];
 
-            // A few sanity checks
-            if (address.ss_family != AF_INET && address.ss_family != AF_INET6)
-            {
-                Com_Printf (MSG_WARNING,
-                            "> WARNING: rejected packet from %s (invalid address family: %hd)\n",
-                            peer_address, address.ss_family);
-                continue;
-            }
-            if (Sys_GetSockaddrPort(&address) == 0)
-            {
-                Com_Printf (MSG_WARNING,
-                            "> WARNING: rejected packet from %s (source port = 0)\n",
-                            peer_address);
-                continue;
-            }
-            if (nb_bytes < MIN_PACKET_SIZE_IN)
-            {
-                Com_Printf (MSG_WARNING,
-                            "> WARNING: rejected packet from %s (size = %d bytes)\n",
-                            peer_address, nb_bytes);
-                continue;
-            }
-            if (packet[0] != '\xFF' || packet[1] != '\xFF' || packet[2] != '\xFF' || packet[3] != '\xFF')
-            {
-                Com_Printf (MSG_WARNING,
-                            "> WARNING: rejected packet from %s (invalid header)\n",
-                            peer_address);
-                continue;
+                recv_packet->data[recv_packet->length] = '\0';
+                if (recv_packet->length > 4 && IsServerListRequest (recv_packet->data + 4))
+                    QueueQuery (recv_packet, crt_sock);
+                else
+                    HandlePacket (recv_packet, crt_sock);
             }
-
-            // Append a '\0' to make the parsing easier
-            packet[nb_bytes] = '\0';
-
-            // Call HandleMessage with the remaining contents
-            HandleMessage (packet + 4, nb_bytes - 4, &address, addrlen, crt_sock);
         }
+
+        HandleQueuedQueries ();
     }
 }
@@ -26,37 +26,168 @@
 #include "games.h"
 
 
+// ---------- Constants ---------- //
+
+// Bounds of the heartbeat tag table size. The table has at least
+// twice as many slots as there are tags, to find a seed quickly
+#define HB_TABLE_MIN_SLOTS 8
+#define HB_TABLE_MAX_SLOTS 65536
+
+// Number of seeds tried for each size of the heartbeat tag table
+#define HB_TABLE_NB_SEEDS 32
+
+// Minimum number of slots in the hash set of the game policy
+#define POLICY_SET_MIN_SLOTS 16
+
+// Size of the Bloom filter in front of the game policy hash set, in bits
+#define POLICY_BLOOM_BITS 2048
+
+// Protocol numbers below this limit are also indexed directly. All the
+// protocols used by the built-in games are small, so they fit in it
+#define NB_INDEXED_PROTOCOLS 256
+
+
+// ---------- Private types ---------- //
+
+typedef struct
+{
+    int                 protocol;
+    game_properties_t*  game;
+} game_protocol_assoc_t;
+
+typedef struct
+{
+    const char*         name;       // NULL if the slot is free
+    unsigned int        hash;
+} game_policy_slot_t;
+
+typedef struct
+{
+    const char*         tag;        // NULL if the slot is free
+    size_t              tag_len;
+    game_properties_t*  game;
+    qboolean            flatline;
+} game_heartbeat_slot_t;
+
+// All the game policy and properties tables. When the game configuration
+// file is reloaded, a new set of tables is built from scratch and replaces
+// the current one in a single step
+typedef struct
+{
+    // Game policy
+    const char**            names;              // sorted
+    unsigned int            nb_names;
+    qboolean                reject_when_known;
+
+    // Game policy names, in a hash set with a Bloom filter in front of it.
+    // They're rebuilt as soon as the policy is complete, never during a lookup
+    game_policy_slot_t*     policy_slots;
+    unsigned int            policy_mask;        // number of slots - 1
+    qbyte                   policy_bloom [POLICY_BLOOM_BITS / 8];
+    qboolean                policy_outdated;
+
+    // Game properties
+    game_properties_t*      properties_list;
+    game_protocol_assoc_t*  protocols;          // sorted by protocol number
+    unsigned int            nb_protocols;
+    game_properties_t*      indexed_protocols [NB_INDEXED_PROTOCOLS];
+
+    // Heartbeat tags, in a hash table without any collision. It
+    // is rebuilt the first time it's used after a tag has changed
+    game_heartbeat_slot_t*  hb_slots;
+    unsigned int            hb_mask;            // number of slots - 1
+    unsigned int            hb_seed;
+    qboolean                hb_outdated;
+
+    // Contents of the game configuration file, if any. Some
+    // game names in the tables above point into this buffer
+    char*                   config_text;
+} game_tables_t;
+
+// A game option given on the command line
+typedef struct game_cmdline_option_s
+{
+    qboolean                        is_policy;
+    const char*                     name;       // policy or game name
+    const char**                    params;
+    size_t                          nb_params;
+    struct game_cmdline_option_s*   next;
+} game_cmdline_option_t;
+
+
 // ---------- Private variables ---------- //
 
-static const char** game_names = NULL;
-static unsigned int nb_game_names = 0;
-static qboolean reject_when_known = true;
+static game_tables_t tables =
+{
+    NULL, 0, true,
+    NULL, 0, { 0 }, false,
+    NULL, NULL, 0, { NULL },
+    NULL, 0, 0, false,
+    NULL
+};
+
+// The tables in use before the last reload, until no server refers to them anymore
+static game_tables_t previous_tables;
+static qboolean has_previous_tables = false;
+
+// The game options given on the command line, in order. They're
+// applied again each time the game configuration is reloaded
+static game_cmdline_option_t* cmdline_options = NULL;
+static game_cmdline_option_t* last_cmdline_option = NULL;
+
+// Game configuration file
+static const char* config_filepath = NULL;
+static FILE* config_file = NULL;
 
 
 // ---------- Private functions ---------- //
 
+/*
+====================
+Game_HashString
+
+Compute the hash of a string for a given seed (FNV-1a), and its length
+====================
+*/
+static unsigned int Game_HashString (const char* string, unsigned int seed, size_t* length)
+{
+    unsigned int hash = 2166136261U ^ (seed * 2654435761U);
+    const char* crt_char;
+
+    for (crt_char = string; *crt_char != '\0'; crt_char++)
+    {
+        hash ^= (qbyte)*crt_char;
+        hash *= 16777619U;
+    }
+    *length = (size_t)(crt_char - string);
+
+    // FNV-1a mixes the low bits poorly, and those are the ones we use
+    return hash ^ (hash >> 16);
+}
+
+
 /*
 ====================
 Game_Find
 
 Find a game name in the list of game names
-After the call, *index_ptr will contain the index where the game is stored in game_names (or should be stored, if it is not present)
+After the call, *index_ptr will contain the index where the game is stored in tables.names (or should be stored, if it is not present)
 ====================
 */
 static qboolean Game_Find (const char* game_name, unsigned int* index_ptr)
 {
     int left = 0;
 
-    if (game_names != NULL)
+    if (tables.names != NULL)
     {
-        int right = nb_game_names - 1;
+        int right = tables.nb_names - 1;
 
         while (left <= right)
         {
             int middle, diff;
 
             middle = (left + right) / 2;
-            diff = strcmp(game_names[middle], game_name);
+            diff = strcmp(tables.names[middle], game_name);
 
             if (diff == 0)
             {
@@ -78,16 +209,131 @@ static qboolean Game_Find (const char* game_name, unsigned int* index_ptr)
 }
 
 
-// ---------- Public functions (game policy) ---------- //
+/*
+====================
+Game_GetBloomBits
+
+Compute the 2 bits of the game policy Bloom filter corresponding to a name hash.
+The second one comes from a second mix of the hash (the finalizer of MurmurHash3),
+so it doesn't depend on the same hash bits as the first one
+====================
+*/
+static void Game_GetBloomBits (unsigned int hash, unsigned int* bit1, unsigned int* bit2)
+{
+    unsigned int mixed = hash;
+
+    mixed ^= mixed >> 16;
+    mixed *= 0x85EBCA6BU;
+    mixed ^= mixed >> 13;
+    mixed *= 0xC2B2AE35U;
+    mixed ^= mixed >> 16;
+
+    *bit1 = hash % POLICY_BLOOM_BITS;
+    *bit2 = mixed % POLICY_BLOOM_BITS;
+}
+
 
 /*
 ====================
-Game_DeclarePolicy
+Game_UpdatePolicySet
 
-Declare the server policy regarding which games are allowed on this master
+Rebuild the game policy hash set and its Bloom filter if a name was added
+since they were built. Returns "false" if they're still outdated (not enough memory)
 ====================
 */
-cmdline_status_t Game_DeclarePolicy (const char* policy, const char** games, unsigned int nb_games)
+static qboolean Game_UpdatePolicySet (void)
+{
+    game_policy_slot_t* slots;
+    unsigned int nb_slots = POLICY_SET_MIN_SLOTS;
+    unsigned int name_ind;
+
+    if (! tables.policy_outdated)
+        return true;
+
+    while (nb_slots < tables.nb_names * 2)
+        nb_slots *= 2;
+    slots = calloc (nb_slots, sizeof (slots[0]));
+    if (slots == NULL)
+        return false;
+
+    memset (tables.policy_bloom, 0, sizeof (tables.policy_bloom));
+    for (name_ind = 0; name_ind < tables.nb_names; name_ind++)
+    {
+        const char* name = tables.names[name_ind];
+        unsigned int hash, slot_ind, bit1, bit2;
+        size_t name_len;
+
+        hash = Game_HashString (name, 0, &name_len);
+
+        // The names are unique, so we just have to find a free slot
+        slot_ind = hash & (nb_slots - 1);
+        while (slots[slot_ind].name != NULL)
+            slot_ind = (slot_ind + 1) & (nb_slots - 1);
+        slots[slot_ind].name = name;
+        slots[slot_ind].hash = hash;
+
+        Game_GetBloomBits (hash, &bit1, &bit2);
+        tables.policy_bloom[bit1 / 8] |= (qbyte)(1 << (bit1 % 8));
+        tables.policy_bloom[bit2 / 8] |= (qbyte)(1 << (bit2 % 8));
+    }
+
+    free (tables.policy_slots);
+    tables.policy_slots = slots;
+    tables.policy_mask = nb_slots - 1;
+    tables.policy_outdated = false;
+    return true;
+}
+
+
+/*
+====================
+Game_IsInPolicy
+
+Return "true" if a game is listed in the game policy
+====================
+*/
+static qboolean Game_IsInPolicy (const char* game_name)
+{
+    unsigned int hash, slot_ind, bit1, bit2;
+    size_t name_len;
+
+    if (tables.nb_names == 0)
+        return false;
+
+    // If we couldn't build the hash set, we have to use the sorted list
+    if (tables.policy_outdated)
+        return Game_Find (game_name, NULL);
+
+    hash = Game_HashString (game_name, 0, &name_len);
+
+    // Most unknown names are rejected by the Bloom filter already
+    Game_GetBloomBits (hash, &bit1, &bit2);
+    if ((tables.policy_bloom[bit1 / 8] & (1 << (bit1 % 8))) == 0 ||
+        (tables.policy_bloom[bit2 / 8] & (1 << (bit2 % 8))) == 0)
+        return false;
+
+    for (slot_ind = hash & tables.policy_mask;
+         tables.policy_slots[slot_ind].name != NULL;
+         slot_ind = (slot_ind + 1) & tables.policy_mask)
+    {
+        const game_policy_slot_t* slot = &tables.policy_slots[slot_ind];
+
+        if (slot->hash == hash && strcmp (slot->name, game_name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+====================
+Game_ApplyPolicy
+
+Add a list of games to the policy in the current tables
+====================
+*/
+static cmdline_status_t Game_ApplyPolicy (const char* policy, const char** games, unsigned int nb_games)
 {
     qboolean new_reject_when_known;
     unsigned int i;
@@ -100,11 +346,11 @@ cmdline_status_t Game_DeclarePolicy (const char* policy, const char** games, uns
         return CMDLINE_STATUS_INVALID_OPT_PARAMS;
 
     // If this is the first game policy option we parse, assign the default game policy
-    if (game_names == NULL)
-        reject_when_known = new_reject_when_known;
+    if (tables.names == NULL)
+        tables.reject_when_known = new_reject_when_known;
 
     // Else, this list must be compatible with the previous one(s)
-    else if (new_reject_when_known != reject_when_known)
+    else if (new_reject_when_known != tables.reject_when_known)
         return CMDLINE_STATUS_INVALID_OPT_PARAMS;
 
     for (i = 0; i < nb_games; i++)
@@ -117,15 +363,16 @@ cmdline_status_t Game_DeclarePolicy (const char* policy, const char** games, uns
         {
             const char** new_game_names;
 
-            new_game_names = realloc ((void*)game_names, (nb_game_names + 1) * sizeof (game_names[0]));
+            new_game_names = realloc ((void*)tables.names, (tables.nb_names + 1) * sizeof (tables.names[0]));
             if (new_game_names == NULL)
                 return CMDLINE_STATUS_NOT_ENOUGH_MEMORY;
 
-            memmove((void*)&new_game_names[index + 1], &new_game_names[index], (nb_game_names - index) * sizeof (new_game_names[0]));
+            memmove((void*)&new_game_names[index + 1], &new_game_names[index], (tables.nb_names - index) * sizeof (new_game_names[0]));
             new_game_names[index] = game;
 
-            game_names = new_game_names;
-            nb_game_names++;
+            tables.names = new_game_names;
+            tables.nb_names++;
+            tables.policy_outdated = true;
         }
     }
 
@@ -133,6 +380,57 @@ cmdline_status_t Game_DeclarePolicy (const char* policy, const char** games, uns
 }
 
 
+/*
+====================
+Game_RecordCmdlineOption
+
+Remember a game option given on the command line, so it can be applied again
+====================
+*/
+static cmdline_status_t Game_RecordCmdlineOption (qboolean is_policy, const char* name, const char** params, size_t nb_params)
+{
+    game_cmdline_option_t* option = malloc (sizeof (*option));
+
+    if (option == NULL)
+        return CMDLINE_STATUS_NOT_ENOUGH_MEMORY;
+
+    option->is_policy = is_policy;
+    option->name = name;
+    option->params = params;
+    option->nb_params = nb_params;
+    option->next = NULL;
+
+    if (last_cmdline_option != NULL)
+        last_cmdline_option->next = option;
+    else
+        cmdline_options = option;
+    last_cmdline_option = option;
+
+    return CMDLINE_STATUS_OK;
+}
+
+
+// ---------- Public functions (game policy) ---------- //
+
+/*
+====================
+Game_DeclarePolicy
+
+Declare the server policy regarding which games are allowed on this master
+====================
+*/
+cmdline_status_t Game_DeclarePolicy (const char* policy, const char** games, unsigned int nb_games)
+{
+    cmdline_status_t result = Game_ApplyPolicy (policy, games, nb_games);
+
+    if (result != CMDLINE_STATUS_OK)
+        return result;
+    if (! Game_UpdatePolicySet ())
+        return CMDLINE_STATUS_NOT_ENOUGH_MEMORY;
+    return Game_RecordCmdlineOption (true, policy, games, nb_games);
+}
+
+
 /*
 ====================
 Game_IsAccepted
@@ -142,7 +440,7 @@ Return true if the game is allowed on this master
 */
 qboolean Game_IsAccepted (const char* game_name)
 {
-    return (Game_Find (game_name, NULL) ^ reject_when_known);
+    return (Game_IsInPolicy (game_name) ^ tables.reject_when_known);
 }
 
 
@@ -162,12 +460,6 @@ typedef struct
     const char*     string;
 } game_option_string_t;
 
-typedef struct
-{
-    int                 protocol;
-    game_properties_t*  game;
-} game_protocol_assoc_t;
-
 
 // ---------- Private variables (game properties) ---------- //
 
@@ -179,10 +471,6 @@ static const game_option_string_t option_strings [] =
     { GAME_OPTION_NONE, NULL },     // Marks the end of the list
 };
 
-static game_properties_t* game_properties_list = NULL;
-
-static game_protocol_assoc_t* game_protocols = NULL;    // TODO: sort it to allow binary searches
-static unsigned int nb_game_protocols = 0;
 
 
 // ---------- Private functions (game properties) ---------- //
@@ -196,7 +484,7 @@ Returns the properties of an anonymous game
 */
 static game_properties_t* Game_GetAnonymous (const char* game, qboolean creation_allowed)
 {
-    game_properties_t* props = game_properties_list;
+    game_properties_t* props = tables.properties_list;
 
     while (props != NULL)
     {
@@ -217,8 +505,8 @@ static game_properties_t* Game_GetAnonymous (const char* game, qboolean creation
                 memset (props, 0, sizeof (*props));
                 props->name = game;
 
-                props->next = game_properties_list;
-                game_properties_list = props;
+                props->next = tables.properties_list;
+                tables.properties_list = props;
 
                 return props;
             }
@@ -234,16 +522,16 @@ static game_properties_t* Game_GetAnonymous (const char* game, qboolean creation
 Game_FindAnonymous
 
 Find game properties in the list of game protocols
-After the call, *index_ptr will contain the index where the game is stored in game_names (or should be stored, if it is not present)
+After the call, *index_ptr will contain the index where the game is stored in tables.names (or should be stored, if it is not present)
 ====================
 */
 static qboolean Game_FindAnonymous (int protocol, unsigned int* index_ptr)
 {
     int left = 0;
 
-    if (game_protocols != NULL)
+    if (tables.protocols != NULL)
     {
-        int right = nb_game_protocols - 1;
+        int right = tables.nb_protocols - 1;
 
         while (left <= right)
         {
@@ -251,14 +539,14 @@ static qboolean Game_FindAnonymous (int protocol, unsigned int* index_ptr)
 
             middle = (left + right) / 2;
 
-            if (game_protocols[middle].protocol == protocol)
+            if (tables.protocols[middle].protocol == protocol)
             {
                 if (index_ptr != NULL)
                     *index_ptr = middle;
                 return true;
             }
 
-            if (game_protocols[middle].protocol > protocol)
+            if (tables.protocols[middle].protocol > protocol)
                 right = middle - 1;
             else
                 left = middle + 1;
@@ -283,17 +571,24 @@ static void Game_RemoveAllProtocols (game_properties_t* game_props)
     unsigned int proto_ind, proto_copy_ind;
 
     proto_copy_ind = 0;
-    for (proto_ind = 0; proto_ind < nb_game_protocols; proto_ind++)
+    for (proto_ind = 0; proto_ind < tables.nb_protocols; proto_ind++)
     {
-        if (game_protocols[proto_ind].game != game_props)
+        int protocol = tables.protocols[proto_ind].protocol;
+
+        if (tables.protocols[proto_ind].game == game_props)
+        {
+            if (protocol >= 0 && protocol < NB_INDEXED_PROTOCOLS)
+                tables.indexed_protocols[protocol] = NULL;
+        }
+        else
         {
             if (proto_ind != proto_copy_ind)
-                memcpy (&game_protocols[proto_copy_ind], &game_protocols[proto_ind], sizeof (game_protocols[proto_copy_ind]));
+                memcpy (&tables.protocols[proto_copy_ind], &tables.protocols[proto_ind], sizeof (tables.protocols[proto_copy_ind]));
             proto_copy_ind++;
         }
     }
 
-    nb_game_protocols = proto_copy_ind;
+    tables.nb_protocols = proto_copy_ind;
 }
 
 
@@ -312,17 +607,20 @@ static cmdline_status_t Game_AddProtocol (game_properties_t* game_props, int pro
     {
         game_protocol_assoc_t* new_array;
 
-        new_array = realloc (game_protocols, (nb_game_protocols + 1) * sizeof (game_protocols[0]));
+        new_array = realloc (tables.protocols, (tables.nb_protocols + 1) * sizeof (tables.protocols[0]));
         if (new_array == NULL)
             return CMDLINE_STATUS_NOT_ENOUGH_MEMORY;
-        game_protocols = new_array;
+        tables.protocols = new_array;
 
-        memmove(&game_protocols[index + 1], &game_protocols[index], (nb_game_protocols - index) * sizeof (game_protocols[0]));
-        game_protocols[index].protocol = protocol;
-        nb_game_protocols++;
+        memmove(&tables.protocols[index + 1], &tables.protocols[index], (tables.nb_protocols - index) * sizeof (tables.protocols[0]));
+        tables.protocols[index].protocol = protocol;
+        tables.nb_protocols++;
     }
 
-    game_protocols[index].game = game_props;
+    tables.protocols[index].game = game_props;
+    if (protocol >= 0 && protocol < NB_INDEXED_PROTOCOLS)
+        tables.indexed_protocols[protocol] = game_props;
+
     return CMDLINE_STATUS_OK;
 }
 
@@ -341,17 +639,124 @@ static cmdline_status_t Game_RemoveProtocol (game_properties_t* game_props, int
     // FIXME? shouldn't we abort if the protocol number isn't used?
     if (Game_FindAnonymous (protocol, &index))
     {
-        if (game_protocols[index].game != game_props)
+        if (tables.protocols[index].game != game_props)
             return CMDLINE_STATUS_INVALID_OPT_PARAMS;
 
-        memmove(&game_protocols[index], &game_protocols[index + 1], (nb_game_protocols - index - 1) * sizeof (game_protocols[0]));
-        nb_game_protocols--;
+        memmove(&tables.protocols[index], &tables.protocols[index + 1], (tables.nb_protocols - index - 1) * sizeof (tables.protocols[0]));
+        tables.nb_protocols--;
+
+        if (protocol >= 0 && protocol < NB_INDEXED_PROTOCOLS)
+            tables.indexed_protocols[protocol] = NULL;
     }
 
     return CMDLINE_STATUS_OK;
 }
 
 
+/*
+====================
+Game_FillHeartbeatSlots
+
+Put all the heartbeat tags into the slots using this seed.
+Returns "false" if 2 different tags end up in the same slot
+====================
+*/
+static qboolean Game_FillHeartbeatSlots (game_heartbeat_slot_t* slots, unsigned int mask, unsigned int seed)
+{
+    game_properties_t* props;
+
+    for (props = tables.properties_list; props != NULL; props = props->next)
+    {
+        unsigned int hb_ind;
+
+        for (hb_ind = 0; hb_ind < NB_HEARTBEAT_TYPES; hb_ind++)
+        {
+            const char* tag = props->heartbeats[hb_ind];
+            game_heartbeat_slot_t* slot;
+            size_t tag_len;
+
+            if (tag == NULL)
+                continue;
+
+            slot = &slots[Game_HashString (tag, seed, &tag_len) & mask];
+            if (slot->tag != NULL)
+            {
+                // If several games use the same tag, the first one wins
+                if (slot->tag_len == tag_len && memcmp (slot->tag, tag, tag_len) == 0)
+                    continue;
+                return false;
+            }
+
+            slot->tag = tag;
+            slot->tag_len = tag_len;
+            slot->game = props;
+            slot->flatline = (hb_ind == HEARTBEAT_TYPE_DEAD);
+        }
+    }
+
+    return true;
+}
+
+
+/*
+====================
+Game_UpdateHeartbeatTable
+
+Rebuild the heartbeat tag table if a tag has changed since it was built.
+We look for the smallest table and the seed that put each tag in its own slot.
+Returns "false" if the table is still outdated (not enough memory)
+====================
+*/
+static qboolean Game_UpdateHeartbeatTable (void)
+{
+    const game_properties_t* props;
+    unsigned int nb_tags = 0;
+    unsigned int nb_slots = HB_TABLE_MIN_SLOTS;
+
+    if (! tables.hb_outdated)
+        return true;
+
+    for (props = tables.properties_list; props != NULL; props = props->next)
+    {
+        unsigned int hb_ind;
+
+        for (hb_ind = 0; hb_ind < NB_HEARTBEAT_TYPES; hb_ind++)
+            if (props->heartbeats[hb_ind] != NULL)
+                nb_tags++;
+    }
+    while (nb_slots < nb_tags * 2)
+        nb_slots *= 2;
+
+    for (; nb_slots <= HB_TABLE_MAX_SLOTS; nb_slots *= 2)
+    {
+        game_heartbeat_slot_t* slots = calloc (nb_slots, sizeof (slots[0]));
+        unsigned int seed;
+
+        if (slots == NULL)
+            return false;
+
+        for (seed = 0; seed < HB_TABLE_NB_SEEDS; seed++)
+        {
+            if (Game_FillHeartbeatSlots (slots, nb_slots - 1, seed))
+            {
+                free (tables.hb_slots);
+                tables.hb_slots = slots;
+                tables.hb_mask = nb_slots - 1;
+                tables.hb_seed = seed;
+                tables.hb_outdated = false;
+                return true;
+            }
+
+            memset (slots, 0, nb_slots * sizeof (slots[0]));
+        }
+
+        free (slots);
+    }
+
+    return false;
+}
+
+
 /*
 ====================
 Game_RemoveHeartbeat
@@ -367,6 +772,7 @@ static void Game_RemoveHeartbeat (game_properties_t* game_props, heartbeat_type_
     {
         free (tag);
         game_props->heartbeats[hb_type] = NULL;
+        tables.hb_outdated = true;
     }
 }
 
@@ -417,6 +823,7 @@ static cmdline_status_t Game_UpdateHeartbeat (game_properties_t* game_props, hea
         game_props->heartbeats[hb_type] = strdup (value);
         if (game_props->heartbeats[hb_type] == NULL)
             return CMDLINE_STATUS_NOT_ENOUGH_MEMORY;
+        tables.hb_outdated = true;
     }
 
     return CMDLINE_STATUS_OK;
@@ -567,6 +974,72 @@ static cmdline_status_t Game_UpdateProperty (game_properties_t* game_props, cons
 }
 
 
+/*
+====================
+Game_ApplyProperties
+
+Update the properties of a game in the current tables
+====================
+*/
+static cmdline_status_t Game_ApplyProperties (const char* game, const char** props, size_t nb_props)
+{
+    unsigned int prop_ind;
+    game_properties_t* game_props = Game_GetAnonymous (game, true);
+
+    if (game_props == NULL)
+        return CMDLINE_STATUS_NOT_ENOUGH_MEMORY;
+
+    // Parse the properties and apply them
+    for (prop_ind = 0; prop_ind < nb_props; prop_ind++)
+    {
+        char* work_buff = strdup (props[prop_ind]);
+        char* equal_sign;
+
+        if (work_buff == NULL)
+            return CMDLINE_STATUS_NOT_ENOUGH_MEMORY;
+
+        equal_sign = strchr (work_buff, '=');
+        if (equal_sign != NULL && equal_sign != work_buff)
+        {
+            cmdline_status_t result;
+            qboolean reset_property, remove_values;
+
+            if (equal_sign[-1] == '+')
+            {
+                equal_sign[-1] = '\0';
+                reset_property = false;
+                remove_values = false;
+            }
+            else if (equal_sign[-1] == '-')
+            {
+                equal_sign[-1] = '\0';
+                reset_property = false;
+                remove_values = true;
+            }
+            else
+            {
+                equal_sign[0] = '\0';
+                reset_property = true;
+                remove_values = false;
+            }
+
+            result = Game_UpdateProperty (game_props, work_buff, equal_sign + 1, reset_property, remove_values);
+            free(work_buff);
+
+            if (result != CMDLINE_STATUS_OK)
+                return result;
+            else
+                continue;
+        }
+
+        free (work_buff);
+        return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+    }
+
+    return CMDLINE_STATUS_OK;
+}
+
+
 // ---------- Public functions (game properties) ---------- //
 
 /*
@@ -629,7 +1102,7 @@ void Game_InitProperties (void)
     for (game_ind = 0; game_ind < game_count; game_ind++)
     {
         builtin_props_t* builtin_props = &builtin_props_array[game_ind];
-        Game_UpdateProperties (builtin_props->gamename, builtin_props->props, builtin_props->nb_props);
+        Game_ApplyProperties (builtin_props->gamename, builtin_props->props, builtin_props->nb_props);
     }
 }
 
@@ -648,7 +1121,7 @@ void Game_PrintProperties (void)
 
     Com_Printf (MSG_ERROR, "\nGame properties:\n");
 
-    props = game_properties_list;
+    props = tables.properties_list;
     while (props != NULL)
     {
         unsigned int count, ind;
@@ -659,9 +1132,9 @@ void Game_PrintProperties (void)
         // Protocols
         Com_Printf (MSG_ERROR, "   - protocols:");
         count = 0;
-        for (ind = 0; ind < nb_game_protocols; ind++)
+        for (ind = 0; ind < tables.nb_protocols; ind++)
         {
-            const game_protocol_assoc_t* assoc = &game_protocols[ind];
+            const game_protocol_assoc_t* assoc = &tables.protocols[ind];
 
             if (assoc->game == props)
             {
@@ -728,60 +1201,11 @@ Update the properties of a game according to the given list of properties
 */
 cmdline_status_t Game_UpdateProperties (const char* game, const char** props, size_t nb_props)
 {
-    unsigned int prop_ind;
-    game_properties_t* game_props = Game_GetAnonymous (game, true);
-
-    if (game_props == NULL)
-        return CMDLINE_STATUS_NOT_ENOUGH_MEMORY;
-
-    // Parse the properties and apply them
-    for (prop_ind = 0; prop_ind < nb_props; prop_ind++)
-    {
-        char* work_buff = strdup (props[prop_ind]);
-        char* equal_sign;
-
-        if (work_buff == NULL)
-            return CMDLINE_STATUS_NOT_ENOUGH_MEMORY;
-
-        equal_sign = strchr (work_buff, '=');
-        if (equal_sign != NULL && equal_sign != work_buff)
-        {
-            cmdline_status_t result;
-            qboolean reset_property, remove_values;
-
-            if (equal_sign[-1] == '+')
-            {
-                equal_sign[-1] = '\0';
-                reset_property = false;
-                remove_values = false;
-            }
-            else if (equal_sign[-1] == '-')
-            {
-                equal_sign[-1] = '\0';
-                reset_property = false;
-                remove_values = true;
-            }
-            else
-            {
-                equal_sign[0] = '\0';
-                reset_property = true;
-                remove_values = false;
-            }
-
-            result = Game_UpdateProperty (game_props, work_buff, equal_sign + 1, reset_property, remove_values);
-            free(work_buff);
+    cmdline_status_t result = Game_ApplyProperties (game, props, nb_props);
 
-            if (result != CMDLINE_STATUS_OK)
-                return result;
-            else
-                continue;
-        }
-
-        free (work_buff);
-        return CMDLINE_STATUS_INVALID_OPT_PARAMS;
-    }
-
-    return CMDLINE_STATUS_OK;
+    if (result != CMDLINE_STATUS_OK)
+        return result;
+    return Game_RecordCmdlineOption (false, game, props, nb_props);
 }
 
 
@@ -797,10 +1221,16 @@ const char* Game_GetNameByProtocol (int protocol, game_options_t* options)
     const game_properties_t* props;
     unsigned int index;
 
-    if (Game_FindAnonymous (protocol, &index))
-    {
-        props = game_protocols[index].game;
+    // Small protocol numbers don't need a search
+    if (protocol >= 0 && protocol < NB_INDEXED_PROTOCOLS)
+        props = tables.indexed_protocols[protocol];
+    else if (Game_FindAnonymous (protocol, &index))
+        props = tables.protocols[index].game;
+    else
+        props = NULL;
 
+    if (props != NULL)
+    {
         if (options != NULL)
             *options = props->options;
         return props->name;
@@ -820,8 +1250,27 @@ Returns the properties of the game which uses this heartbeat tag.
 */
 const game_properties_t* Game_GetPropertiesByHeartbeat (const char* heartbeat_tag, qboolean* flatline_heartbeat)
 {
-    game_properties_t* props = game_properties_list;
+    game_properties_t* props;
+
+    if (Game_UpdateHeartbeatTable ())
+    {
+        const game_heartbeat_slot_t* slot;
+        size_t tag_len;
+
+        slot = &tables.hb_slots[Game_HashString (heartbeat_tag, tables.hb_seed, &tag_len) & tables.hb_mask];
+        if (slot->tag != NULL && slot->tag_len == tag_len &&
+            memcmp (slot->tag, heartbeat_tag, tag_len) == 0)
+        {
+            *flatline_heartbeat = slot->flatline;
+            return slot->game;
+        }
+
+        *flatline_heartbeat = false;
+        return NULL;
+    }
 
+    // We couldn't build the table, so we have to check all the tags
+    props = tables.properties_list;
     while (props != NULL)
     {
         size_t hb_ind;
@@ -862,6 +1311,20 @@ game_options_t Game_GetOptions (const char* game)
         return GAME_OPTION_NONE;
 }
 
+
+/*
+====================
+Game_GetPropertiesByName
+
+Returns the properties of a game, or NULL if it has no properties
+====================
+*/
+const game_properties_t* Game_GetPropertiesByName (const char* game)
+{
+    return Game_GetAnonymous (game, false);
+}
+
+
 /*
 ====================
 Game_GetPorts
@@ -878,7 +1341,7 @@ listen_ports_t* Game_GetPorts (void)
 
     port_ind    = malloc (sizeof(*port_ind));
     result      = port_ind;
-    props       = game_properties_list;
+    props       = tables.properties_list;
 
     memset (port_ind, 0, sizeof(*port_ind));
 
@@ -904,3 +1367,321 @@ listen_ports_t* Game_GetPorts (void)
 
     return result;
 }
+
+
+// ---------- Private functions (game configuration) ---------- //
+
+/*
+====================
+Game_FreeTables
+
+Free a set of game tables
+====================
+*/
+static void Game_FreeTables (game_tables_t* game_tables)
+{
+    game_properties_t* props = game_tables->properties_list;
+
+    while (props != NULL)
+    {
+        game_properties_t* next_props = props->next;
+        unsigned int ind;
+
+        for (ind = 0; ind < NB_HEARTBEAT_TYPES; ind++)
+            free (props->heartbeats[ind]);
+        for (ind = 0; ind < NB_PORT_TYPES; ind++)
+            free (props->ports[ind]);
+        free (props);
+
+        props = next_props;
+    }
+
+    free ((void*)game_tables->names);
+    free (game_tables->policy_slots);
+    free (game_tables->protocols);
+    free (game_tables->hb_slots);
+    free (game_tables->config_text);
+
+    memset (game_tables, 0, sizeof (*game_tables));
+}
+
+
+/*
+====================
+Game_ReadConfigText
+
+Read the whole game configuration file. The result must be freed by the caller
+====================
+*/
+static char* Game_ReadConfigText (void)
+{
+    char* text = NULL;
+    size_t text_size = 0;
+    size_t buffer_size = 0;
+
+    rewind (config_file);
+    clearerr (config_file);
+
+    for (;;)
+    {
+        size_t nb_read;
+
+        // Always keep some room for the final '\0'
+        if (text_size + 1 >= buffer_size)
+        {
+            char* new_text;
+
+            buffer_size += 4096;
+            new_text = realloc (text, buffer_size);
+            if (new_text == NULL)
+            {
+                free (text);
+                Com_Printf (MSG_ERROR,
+                            "> ERROR: can't allocate memory for the game configuration file\n");
+                return NULL;
+            }
+            text = new_text;
+        }
+
+        nb_read = fread (text + text_size, 1, buffer_size - text_size - 1, config_file);
+        text_size += nb_read;
+        if (nb_read == 0)
+            break;
+    }
+
+    if (ferror (config_file))
+    {
+        free (text);
+        Com_Printf (MSG_ERROR,
+                    "> ERROR: can't read the game configuration file \"%s\"\n",
+                    config_filepath);
+        return NULL;
+    }
+
+    text[text_size] = '\0';
+    return text;
+}
+
+
+/*
+====================
+Game_ApplyConfigText
+
+Apply the contents of the game configuration file to the current tables.
+Each line is an option, like on the command line, without its leading "--"
+====================
+*/
+static qboolean Game_ApplyConfigText (char* text)
+{
+    char* line = text;
+    unsigned int line_num = 0;
+
+    tables.config_text = text;
+
+    while (line != NULL)
+    {
+        const char* tokens [64];
+        unsigned int nb_tokens = 0;
+        cmdline_status_t result;
+        char* line_end;
+        char* comment;
+        char* token;
+
+        line_num++;
+        line_end = strchr (line, '\n');
+        if (line_end != NULL)
+            *line_end++ = '\0';
+
+        comment = strchr (line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+
+        for (token = strtok (line, " \t\r"); token != NULL; token = strtok (NULL, " \t\r"))
+        {
+            if (nb_tokens == sizeof (tokens) / sizeof (tokens[0]))
+                break;
+            tokens[nb_tokens++] = token;
+        }
+
+        line = line_end;
+        if (nb_tokens == 0)
+            continue;
+
+        if (nb_tokens < 3)
+            result = CMDLINE_STATUS_NOT_ENOUGH_OPT_PARAMS;
+        else if (token != NULL)
+            result = CMDLINE_STATUS_TOO_MUCH_OPT_PARAMS;
+        else if (strcmp (tokens[0], "game-properties") == 0)
+            result = Game_ApplyProperties (tokens[1], &tokens[2], nb_tokens - 2);
+        else if (strcmp (tokens[0], "game-policy") == 0)
+            result = Game_ApplyPolicy (tokens[1], &tokens[2], nb_tokens - 2);
+        else
+            result = CMDLINE_STATUS_INVALID_OPT;
+
+        if (result != CMDLINE_STATUS_OK)
+        {
+            Com_Printf (MSG_ERROR,
+                        "> ERROR: invalid option at line %u of the game configuration file \"%s\"\n",
+                        line_num, config_filepath);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// ---------- Public functions (game configuration) ---------- //
+
+/*
+====================
+Game_SetConfigFile
+
+Set the path of the game configuration file
+====================
+*/
+qboolean Game_SetConfigFile (const char* filepath)
+{
+    // Too late? Or empty path?
+    if (config_file != NULL || filepath[0] == '\0')
+        return false;
+
+    config_filepath = filepath;
+    return true;
+}
+
+
+/*
+====================
+Game_LoadConfig
+
+Open the game configuration file if there's one, and apply it on top
+of the command line options. Then build the game policy hash set and the heartbeat tag table
+====================
+*/
+qboolean Game_LoadConfig (void)
+{
+    char* text;
+
+    if (config_filepath == NULL)
+    {
+        Game_UpdatePolicySet ();
+        Game_UpdateHeartbeatTable ();
+        return true;
+    }
+
+    config_file = fopen (config_filepath, "rb");
+    if (config_file == NULL)
+    {
+        Com_Printf (MSG_ERROR,
+                    "> ERROR: can't open the game configuration file \"%s\" (%s)\n",
+                    config_filepath, strerror (errno));
+        return false;
+    }
+
+    text = Game_ReadConfigText ();
+    if (text == NULL || ! Game_ApplyConfigText (text))
+        return false;
+
+    Game_UpdatePolicySet ();
+    Game_UpdateHeartbeatTable ();
+    return true;
+}
+
+
+/*
+====================
+Game_ReloadConfig
+
+Build new game tables from the game configuration file, and use them if they're valid.
+The previous tables are kept until Game_ReleasePreviousTables is called
+====================
+*/
+qboolean Game_ReloadConfig (void)
+{
+    game_cmdline_option_t* option;
+    char* text;
+
+    if (config_file == NULL)
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: can't reload the game configuration (no configuration file)\n");
+        return false;
+    }
+
+    // We can only have 2 sets of tables at a time
+    if (has_previous_tables)
+        return false;
+
+    // Open the file again by its path, in case it has been replaced by a new file (editors
+    // often save files this way). From the chroot jail, we can only read the file kept open
+    if (! Sys_IsChrooted ())
+    {
+        FILE* new_file = fopen (config_filepath, "rb");
+
+        if (new_file != NULL)
+        {
+            fclose (config_file);
+            config_file = new_file;
+        }
+        else
+            Com_Printf (MSG_WARNING,
+                        "> WARNING: can't open the game configuration file \"%s\" again (%s), reading the file opened at startup\n",
+                        config_filepath, strerror (errno));
+    }
+    else if (Sys_IsFileReplaced (config_file))
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: the game configuration file \"%s\" has been replaced, but dpmaster can only read the file opened at startup from its chroot jail\n",
+                    config_filepath);
+
+    text = Game_ReadConfigText ();
+    if (text == NULL)
+        return false;
+
+    // Build the new tables off to the side
+    previous_tables = tables;
+    memset (&tables, 0, sizeof (tables));
+    tables.reject_when_known = true;
+
+    Game_InitProperties ();
+    for (option = cmdline_options; option != NULL; option = option->next)
+    {
+        if (option->is_policy)
+            Game_ApplyPolicy (option->name, option->params, (unsigned int)option->nb_params);
+        else
+            Game_ApplyProperties (option->name, option->params, option->nb_params);
+    }
+
+    if (! Game_ApplyConfigText (text))
+    {
+        Game_FreeTables (&tables);
+        tables = previous_tables;
+
+        Com_Printf (MSG_ERROR, "> ERROR: the game configuration hasn't been reloaded\n");
+        return false;
+    }
+
+    Game_UpdatePolicySet ();
+    Game_UpdateHeartbeatTable ();
+
+    has_previous_tables = true;
+    Com_Printf (MSG_NORMAL, "> Game configuration reloaded from \"%s\"\n", config_filepath);
+    return true;
+}
+
+
+/*
+====================
+Game_ReleasePreviousTables
+
+Free the game tables used before the last reload. No server must refer to them anymore
+====================
+*/
+void Game_ReleasePreviousTables (void)
+{
+    if (has_previous_tables)
+    {
+        Game_FreeTables (&previous_tables);
+        has_previous_tables = false;
+    }
+}
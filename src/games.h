@@ -102,8 +102,33 @@ const game_properties_t* Game_GetPropertiesByHeartbeat (const char* heartbeat_ta
 // Returns the options of a game
 game_options_t Game_GetOptions (const char* game);
 
+// Returns the properties of a game, or NULL if it has no properties
+const game_properties_t* Game_GetPropertiesByName (const char* game);
+
 // Returns all ports used by the defined games
 listen_ports_t* Game_GetPorts (void);
 
 
+// ---------- Public functions (game configuration) ---------- //
+
+// Will simply return "false" if called after Game_LoadConfig
+qboolean Game_SetConfigFile (const char* filepath);
+
+// Open the game configuration file and apply it on top of the command line
+// options. Must be called before the security initializations, since the
+// file may not be reachable from the chroot jail. It's kept open for reloads,
+// which read it from its path instead when dpmaster isn't chrooted
+// Also builds the heartbeat tag table, so it must be called even without file
+qboolean Game_LoadConfig (void);
+
+// Build new game tables from the built-in properties, the command line options
+// and the game configuration file, and replace the current tables with them.
+// Returns "false" if the tables haven't changed. The previous game properties
+// stay valid until Game_ReleasePreviousTables is called
+qboolean Game_ReloadConfig (void);
+
+// Free the game tables used before the last reload
+void Game_ReleasePreviousTables (void);
+
+
 #endif  // #ifndef _GAMES_H_
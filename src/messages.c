@@ -27,20 +27,26 @@
 #include "clients.h"
 #include "games.h"
 #include "messages.h"
+#include "pacing.h"
+#include "peers.h"
 #include "servers.h"
+#include "upstream.h"
 
 
 // ---------- Constants ---------- //
 
-// Timeout after a valid infoResponse (in secondes)
-#define TIMEOUT_INFORESPONSE (15 * 60)
-
 // Period of validity for a challenge string (in secondes)
 #define TIMEOUT_CHALLENGE 2
 
 // Maximum size of a reponse packet
 #define MAX_PACKET_SIZE_OUT 1400
 
+// Maximum size of the header of a server list packet
+#define MAX_LIST_HEADER_SIZE 64
+
+// Maximum number of server list packets sent at once
+#define MAX_LIST_SEGMENTS 32
+
 
 // Types of messages (with samples):
 
@@ -72,6 +78,108 @@
 // "getserversExtResponse\\...(6 bytes)...//...(18 bytes)...\\EOT\0\0\0"
 #define M2C_GETSERVERSEXTREPONSE "getserversExtResponse"
 
+// DP: "getserversDelta DarkPlaces-Quake 3 1234567.89 empty full ipv4 ipv6"
+#define C2M_GETSERVERSDELTA "getserversDelta "
+
+// DP:
+// "getserversDeltaResponse delta 1234567.95\x0A\\...(6 bytes)...-//...(18 bytes)...\\EOT\0\0\0"
+#define M2C_GETSERVERSDELTAREPONSE "getserversDeltaResponse"
+
+// Sent before the server list when the client cookies are enabled, if
+// the client didn't send back a valid cookie or if it's about to expire.
+// The cookie is sent back in the next requests as "cookie=1a2b3c4d"
+// DP: "getserversCookie 1a2b3c4d"
+#define M2C_GETSERVERSCOOKIE "getserversCookie"
+
+// Sent instead of the server list to a client which has asked for it with
+// the "ifchanged" option, if it got the same list recently (see "--unchanged-window")
+// DP: "getserversUnchanged"
+#define M2C_GETSERVERSUNCHANGED "getserversUnchanged"
+
+
+// ---------- Private types ---------- //
+
+// Filtering options of a server list request
+typedef struct
+{
+    int protocol;
+    qboolean empty;
+    qboolean full;
+    qboolean ipv4;
+    qboolean ipv6;
+    const char* gametype;       // NULL if any game type is accepted
+} list_filter_t;
+
+// A server list being sent to a client. Its packets are built one after the
+// other in "list_segments", and sent together as long as they have the same size
+typedef struct
+{
+    const struct sockaddr_storage* addr;
+    socklen_t addrlen;
+    socket_t sock;
+    const char* request_name;
+    char header [MAX_LIST_HEADER_SIZE];
+    size_t headersize;
+    qbyte* packet;              // the packet being built
+    size_t packetind;
+    unsigned int nb_servers;    // in the packet being built
+    size_t packet_limit;        // maximum size of the servers part of a packet
+    qboolean single_packet;     // should the list be cut after its first packet?
+    qboolean truncated;         // has it been cut?
+    qboolean dropped;           // has the pacing dropped a part of it?
+    size_t segment_size;        // size of the packets built before it
+    size_t segments_length;
+    unsigned int nb_segments;
+    unsigned int segment_servers [MAX_LIST_SEGMENTS];
+} server_list_t;
+
+// A "getinfo" deferred by the trust window
+typedef struct
+{
+    time_t time;
+    server_t* server;
+} deferred_getinfo_t;
+
+
+// ---------- Private variables ---------- //
+
+// The packets of the server list being sent
+static qbyte list_segments [MAX_LIST_SEGMENTS * MAX_PACKET_SIZE_OUT];
+
+// Time a server stays registered after a valid infoResponse
+static time_t server_timeout = TIMEOUT_INFORESPONSE;
+
+// The heartbeats of a server that has sent a valid infoResponse during the
+// last "trust_window" seconds don't trigger a "getinfo" right away
+static time_t trust_window = 0;
+
+// The deferred "getinfo" messages, in a min-heap ordered by time. A server has at
+// most one entry, which may be due before its getinfo if it has been verified
+// again since then. An entry whose server is gone is simply ignored
+static deferred_getinfo_t* deferred_getinfos = NULL;
+static unsigned int nb_deferred_getinfos = 0;
+static unsigned int max_deferred_getinfos = 0;
+
+
+// ---------- Public variables ---------- //
+
+// Is the master shedding the client load, to keep up with the servers' messages?
+qboolean load_shedding = false;
+
+// The prefixes of all the messages HandleMessage accepts (NULL-terminated)
+const char* const message_prefixes [] =
+{
+    S2M_HEARTBEAT,
+    S2M_INFORESPONSE,
+    M2M_PEERSYNC,
+    M2C_GETSERVERSREPONSE,
+    M2C_GETSERVERSEXTREPONSE,
+    C2M_GETSERVERS,
+    C2M_GETSERVERSEXT,
+    C2M_GETSERVERSDELTA,
+    NULL
+};
+
 
 // ---------- Private functions ---------- //
 
@@ -235,6 +343,78 @@ static void SendGetInfo (server_t* server, socket_t recv_socket, qboolean force_
 }
 
 
+/*
+====================
+PushDeferredGetInfo
+
+Add a deferred "getinfo" to the heap. Return false if there's no memory for it
+====================
+*/
+static qboolean PushDeferredGetInfo (server_t* server)
+{
+    unsigned int pos;
+
+    if (nb_deferred_getinfos == max_deferred_getinfos)
+    {
+        unsigned int new_max = (max_deferred_getinfos == 0 ? 64 : max_deferred_getinfos * 2);
+        deferred_getinfo_t* new_getinfos = realloc (deferred_getinfos, new_max * sizeof (new_getinfos[0]));
+
+        if (new_getinfos == NULL)
+            return false;
+
+        deferred_getinfos = new_getinfos;
+        max_deferred_getinfos = new_max;
+    }
+
+    // Move the entry up while it's due before its parent
+    pos = nb_deferred_getinfos++;
+    while (pos > 0 && deferred_getinfos[(pos - 1) / 2].time > server->getinfo_time)
+    {
+        deferred_getinfos[pos] = deferred_getinfos[(pos - 1) / 2];
+        pos = (pos - 1) / 2;
+    }
+    deferred_getinfos[pos].time = server->getinfo_time;
+    deferred_getinfos[pos].server = server;
+
+    return true;
+}
+
+
+/*
+====================
+PopDeferredGetInfo
+
+Remove the first deferred "getinfo" from the heap
+====================
+*/
+static void PopDeferredGetInfo (void)
+{
+    deferred_getinfo_t last;
+    unsigned int pos = 0;
+
+    assert (nb_deferred_getinfos > 0);
+    last = deferred_getinfos[--nb_deferred_getinfos];
+
+    // Move the last entry down from the top, while one of its children is due before it
+    for (;;)
+    {
+        unsigned int child = pos * 2 + 1;
+
+        if (child >= nb_deferred_getinfos)
+            break;
+        if (child + 1 < nb_deferred_getinfos &&
+            deferred_getinfos[child + 1].time < deferred_getinfos[child].time)
+            child++;
+        if (deferred_getinfos[child].time >= last.time)
+            break;
+
+        deferred_getinfos[pos] = deferred_getinfos[child];
+        pos = child;
+    }
+    deferred_getinfos[pos] = last;
+}
+
+
 /*
 ====================
 HandleHeartbeat
@@ -248,6 +428,7 @@ static void HandleHeartbeat (const char* msg, const struct sockaddr_storage* add
     const game_properties_t* game_props;
     server_t* server;
     qboolean flatlineHeartbeat;
+    qboolean defer_getinfo;
 
     // Extract the tag
     sscanf (msg, "%63s", tag);
@@ -295,12 +476,386 @@ static void HandleHeartbeat (const char* msg, const struct sockaddr_storage* add
 
     assert (server->state != sv_state_unused_slot);
 
+    // A server which has just proved it's there doesn't have to do it again right now,
+    // whatever the number of heartbeats it sends: it will get a single "getinfo" at the
+    // end of the trust window. Its timeout is still only refreshed by its infoResponses
+    defer_getinfo = (trust_window > 0 && server->verified_time != 0 &&
+                     crt_time < server->verified_time + trust_window &&
+                     server->hb_properties == game_props);
+    if (defer_getinfo && server->getinfo_time == 0)
+    {
+        server->getinfo_time = server->verified_time + trust_window;
+
+        // Without memory for it, the getinfo is simply not deferred
+        if (! server->getinfo_queued)
+        {
+            if (PushDeferredGetInfo (server))
+                server->getinfo_queued = true;
+            else
+            {
+                server->getinfo_time = 0;
+                defer_getinfo = false;
+            }
+        }
+    }
+
+    if (defer_getinfo)
+    {
+        Com_Printf (MSG_DEBUG, "  - verified %u seconds ago, getinfo deferred by %u seconds\n",
+                    (unsigned int)(crt_time - server->verified_time),
+                    (unsigned int)(server->getinfo_time - crt_time));
+    }
+
     // Ask for some infos.
     // Force a new challenge if the heartbeat tag has changed
-    SendGetInfo (server, recv_socket, server->hb_properties != game_props);
+    else
+    {
+        SendGetInfo (server, recv_socket, server->hb_properties != game_props);
+        server->getinfo_time = 0;
+    }
 
     // Save the game properties for a future use
     server->hb_properties = game_props;
+
+    // It's now one of our own servers, even if a peer told us about it first
+    server->origin = sv_origin_heartbeat;
+}
+
+
+/*
+====================
+ViewEntryToString
+
+Build a string describing the address of a server from a view
+====================
+*/
+static const char* ViewEntryToString (const sv_view_entry_t* entry)
+{
+    struct sockaddr_storage address;
+    socklen_t addrlen;
+
+    memset (&address, 0, sizeof (address));
+    if (entry->family == AF_INET)
+    {
+        struct sockaddr_in* addr4 = (struct sockaddr_in*)&address;
+
+        addr4->sin_family = AF_INET;
+        memcpy (&addr4->sin_addr.s_addr, entry->address, 4);
+        addr4->sin_port = htons (entry->port);
+        addrlen = sizeof (*addr4);
+    }
+    else
+    {
+        struct sockaddr_in6* addr6 = (struct sockaddr_in6*)&address;
+
+        addr6->sin6_family = AF_INET6;
+        memcpy (&addr6->sin6_addr.s6_addr, entry->address, 16);
+        addr6->sin6_port = htons (entry->port);
+        addrlen = sizeof (*addr6);
+    }
+
+    return Sys_SockaddrToString (&address, addrlen);
+}
+
+
+/*
+====================
+PrintFilterResult
+
+Print why a server from a view doesn't match the filtering options of a request, if it doesn't
+====================
+*/
+static void PrintFilterResult (const list_filter_t* filter, const sv_view_entry_t* sv)
+{
+    Com_Printf (MSG_DEBUG,
+                "  - Comparing server: IP:\"%s\", p:%d\n",
+                ViewEntryToString (sv), sv->protocol);
+
+    if (sv->protocol != filter->protocol)
+        Com_Printf (MSG_DEBUG,
+                    "    Reject: protocol %d != requested %d\n",
+                    sv->protocol, filter->protocol);
+    else if (! filter->empty && sv->state == sv_state_empty)
+        Com_Printf (MSG_DEBUG, "    Reject: no empty server allowed\n");
+    else if (! filter->full && sv->state == sv_state_full)
+        Com_Printf (MSG_DEBUG, "    Reject: no full server allowed\n");
+    else if (! filter->ipv4 && sv->family == AF_INET)
+        Com_Printf (MSG_DEBUG, "    Reject: no IPv4 servers allowed\n");
+    else if (! filter->ipv6 && sv->family == AF_INET6)
+        Com_Printf (MSG_DEBUG, "    Reject: no IPv6 servers allowed\n");
+    else if (filter->gametype != NULL && strcmp (filter->gametype, sv->gametype) != 0)
+        Com_Printf (MSG_DEBUG,
+                    "    Reject: gametype \"%s\" != requested \"%s\"\n",
+                    sv->gametype, filter->gametype);
+}
+
+
+/*
+====================
+IsServerWanted
+
+Check if a server from a view matches the filtering options of a request
+====================
+*/
+static qboolean IsServerWanted (const list_filter_t* filter, const sv_view_entry_t* sv)
+{
+    // Extra debugging info
+    if (max_msg_level >= MSG_DEBUG)
+        PrintFilterResult (filter, sv);
+
+    // Check protocol, options and game type
+    return (sv->protocol == filter->protocol &&
+            (filter->empty || sv->state != sv_state_empty) &&
+            (filter->full || sv->state != sv_state_full) &&
+            (filter->ipv4 || sv->family != AF_INET) &&
+            (filter->ipv6 || sv->family != AF_INET6) &&
+            (filter->gametype == NULL || strcmp (filter->gametype, sv->gametype) == 0));
+}
+
+
+/*
+====================
+FlushServerList
+
+Send the packets of a server list built so far
+====================
+*/
+static void FlushServerList (server_list_t* list)
+{
+    unsigned int ind;
+
+    // Once a part of the list has been dropped, the rest of it (including
+    // the EOT mark) is dropped too, so the client knows its list is incomplete
+    if (! list->dropped)
+    {
+        switch (Pace_Send (list->sock, list_segments, list->segments_length,
+                           list->segment_size, list->addr, list->addrlen))
+        {
+            case PACE_STATUS_OK:
+                for (ind = 0; ind < list->nb_segments; ind++)
+                    Com_Printf (MSG_NORMAL, "> %s <--- %sResponse (%u servers)\n",
+                                peer_address, list->request_name, list->segment_servers[ind]);
+                break;
+
+            case PACE_STATUS_DROPPED:
+                Com_Printf (MSG_NORMAL, "> %s <--- %sResponse dropped by the pacing\n",
+                            peer_address, list->request_name);
+                list->dropped = true;
+                break;
+
+            default:
+                Com_Printf (MSG_WARNING, "> WARNING: can't send %s (%s)\n",
+                            list->request_name, Sys_GetLastNetErrorString ());
+                break;
+        }
+    }
+
+    list->segments_length = 0;
+    list->nb_segments = 0;
+}
+
+
+/*
+====================
+StartServerListPacket
+
+Start a new packet in a server list
+====================
+*/
+static void StartServerListPacket (server_list_t* list)
+{
+    list->packet = &list_segments[list->segments_length];
+    memcpy (list->packet, list->header, list->headersize);
+    list->packetind = list->headersize;
+    list->nb_servers = 0;
+}
+
+
+/*
+====================
+EndServerListPacket
+
+Finish the packet being built in a server list. The kernel can only
+send packets of the same size at once (the last one may be shorter),
+so we send the previous packets when the sizes don't match
+====================
+*/
+static void EndServerListPacket (server_list_t* list)
+{
+    size_t size = list->packetind;
+
+    if (list->nb_segments > 0 && size > list->segment_size)
+    {
+        FlushServerList (list);
+        memmove (list_segments, list->packet, size);
+        list->packet = list_segments;
+    }
+
+    if (list->nb_segments == 0)
+        list->segment_size = size;
+    list->segment_servers[list->nb_segments] = list->nb_servers;
+    list->nb_segments++;
+    list->segments_length += size;
+
+    if (size < list->segment_size || list->nb_segments == MAX_LIST_SEGMENTS)
+        FlushServerList (list);
+}
+
+
+/*
+====================
+AddToServerList
+
+Add a server to a server list, or its removal if it's a delta list
+====================
+*/
+static void AddToServerList (server_list_t* list, const sv_view_entry_t* sv, qboolean removed)
+{
+    size_t addr_size = (sv->family == AF_INET ? 4 : 16);
+    size_t sv_size = (removed ? 1 : 0) + 1 + addr_size + 2;
+    qbyte* record;
+
+    // If the packet doesn't have enough free space for this server
+    if (list->packetind + sv_size > list->packet_limit)
+    {
+        if (list->single_packet)
+        {
+            list->truncated = true;
+            return;
+        }
+        EndServerListPacket (list);
+        StartServerListPacket (list);
+    }
+    record = &list->packet[list->packetind];
+    list->packetind += sv_size;
+    list->nb_servers++;
+
+    // Heading '-' for removed servers
+    if (removed)
+        *record++ = '-';
+
+    // Heading '\' for IPv4 servers, '/' for IPv6 servers
+    *record++ = (sv->family == AF_INET ? '\\' : '/');
+
+    // IP address (the mapped one for IPv4 servers, if any). The copies
+    // have constant sizes, so that the compiler can inline them
+    if (sv->family == AF_INET)
+        memcpy (record, sv->address, 4);
+    else
+        memcpy (record, sv->address, 16);
+    record += addr_size;
+
+    // Port
+    record[0] = sv->port >> 8;
+    record[1] = sv->port & 0xFF;
+
+    if (max_msg_level >= MSG_DEBUG)
+        Com_Printf (MSG_DEBUG, "  - Sending %sserver %s\n",
+                    removed ? "removal of " : "", ViewEntryToString (sv));
+}
+
+
+/*
+====================
+EndServerList
+
+Add the EOT mark to a server list, and send its last packets
+====================
+*/
+static void EndServerList (server_list_t* list)
+{
+    // If the packet doesn't have enough free space for the EOT mark
+    if (list->packetind + 7 > MAX_PACKET_SIZE_OUT)
+    {
+        EndServerListPacket (list);
+        StartServerListPacket (list);
+    }
+
+    // End Of Transmission
+    list->packet[list->packetind    ] = '\\';
+    list->packet[list->packetind + 1] = 'E';
+    list->packet[list->packetind + 2] = 'O';
+    list->packet[list->packetind + 3] = 'T';
+    list->packet[list->packetind + 4] = '\0';
+    list->packet[list->packetind + 5] = '\0';
+    list->packet[list->packetind + 6] = '\0';
+    list->packetind += 7;
+
+    EndServerListPacket (list);
+    if (list->nb_segments > 0)
+        FlushServerList (list);
+}
+
+
+/*
+====================
+SendCookie
+
+Send to a client the cookie it must send back to get complete server lists
+====================
+*/
+static void SendCookie (const struct sockaddr_storage* addr, socklen_t addrlen, socket_t recv_socket)
+{
+    char msg [64];
+    unsigned int cookie = Cl_GetCookie (addr);
+
+    snprintf (msg, sizeof (msg), "\xFF\xFF\xFF\xFF" M2C_GETSERVERSCOOKIE " %08x", cookie);
+    msg[sizeof (msg) - 1] = '\0';
+    if (sendto (recv_socket, msg, strlen (msg), 0, (const struct sockaddr*)addr, addrlen) < 0)
+        Com_Printf (MSG_WARNING, "> WARNING: can't send " M2C_GETSERVERSCOOKIE " (%s)\n",
+                    Sys_GetLastNetErrorString ());
+    else
+        Com_Printf (MSG_NORMAL, "> %s <--- " M2C_GETSERVERSCOOKIE " %08x\n", peer_address, cookie);
+}
+
+
+/*
+====================
+GetQueryClass
+
+Compute a hash of what a server list request asks for. Two requests of the
+same class get the same servers from the same view, maybe in another order
+====================
+*/
+static unsigned int GetQueryClass (const char* request_name, const char* gamename,
+                                   const list_filter_t* filter)
+{
+    char query [MAX_PACKET_SIZE_IN];
+    const char* query_ptr;
+    unsigned int hash = 2166136261U;
+
+    snprintf (query, sizeof (query), "%s %s %d %d%d%d%d %s", request_name, gamename,
+              filter->protocol, filter->empty, filter->full, filter->ipv4, filter->ipv6,
+              filter->gametype != NULL ? filter->gametype : "");
+    query[sizeof (query) - 1] = '\0';
+
+    // FNV-1a
+    for (query_ptr = query; *query_ptr != '\0'; query_ptr++)
+    {
+        hash ^= (unsigned char)*query_ptr;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+
+/*
+====================
+SendUnchanged
+
+Tell a client that the server list it asks for hasn't changed since it got it
+====================
+*/
+static void SendUnchanged (const struct sockaddr_storage* addr, socklen_t addrlen, socket_t recv_socket)
+{
+    const char msg [] = "\xFF\xFF\xFF\xFF" M2C_GETSERVERSUNCHANGED;
+
+    if (sendto (recv_socket, msg, sizeof (msg) - 1, 0, (const struct sockaddr*)addr, addrlen) < 0)
+        Com_Printf (MSG_WARNING, "> WARNING: can't send " M2C_GETSERVERSUNCHANGED " (%s)\n",
+                    Sys_GetLastNetErrorString ());
+    else
+        Com_Printf (MSG_NORMAL, "> %s <--- " M2C_GETSERVERSUNCHANGED "\n", peer_address);
 }
 
 
@@ -308,37 +863,43 @@ static void HandleHeartbeat (const char* msg, const struct sockaddr_storage* add
 ====================
 HandleGetServers
 
-Parse getservers requests and send the appropriate response
+Parse getservers, getserversExt and getserversDelta requests and send the appropriate response
 ====================
 */
-static void HandleGetServers (const char* msg, const struct sockaddr_storage* addr, socklen_t addrlen, socket_t recv_socket, qboolean extended_request)
+static void HandleGetServers (const char* msg, const struct sockaddr_storage* addr, socklen_t addrlen, socket_t recv_socket, qboolean extended_request, qboolean delta_request)
 {
-    const char* packetheader;
-    size_t headersize;
     char* end_ptr;
     const char* msg_ptr;
     char gamename [GAMENAME_LENGTH] = "";
-    qbyte packet [MAX_PACKET_SIZE_OUT];
-    size_t packetind;
-    server_t* sv;
+    server_list_t list;
+    list_filter_t filter;
+    const sv_view_t* view;
+    unsigned int nb_view_servers, view_ind, nb_checked;
     int protocol;
     game_options_t game_options = GAME_OPTION_NONE;
     char gametype [GAMETYPE_LENGTH] = "0";
     qboolean use_dp_protocol;
-    qboolean opt_empty = false;
-    qboolean opt_full = false;
-    qboolean opt_ipv4 = (! extended_request);
-    qboolean opt_ipv6 = false;
-    qboolean opt_gametype = false;
+    qboolean send_delta;
+    qboolean has_list_version = false;
+    unsigned int list_epoch = 0;
     char filter_options [MAX_PACKET_SIZE_IN];
     char* option_ptr;
-    unsigned int nb_servers;
     const char* request_name;
+    qboolean has_cookie = false;
+    qboolean cookie_expiring = false;
+    unsigned int cookie = 0;
+    qboolean if_changed = false;
+    unsigned int query_class = 0;
 
-    if (Cl_BlockedByThrottle (addr, addrlen))
+    if (Cl_BlockedByThrottle (addr, addrlen, load_shedding))
         return;
 
-    if (extended_request)
+    if (delta_request)
+    {
+        request_name = "getserversDelta";
+        use_dp_protocol = true;
+    }
+    else if (extended_request)
     {
         request_name = "getserversExt";
         use_dp_protocol = true;
@@ -389,6 +950,30 @@ static void HandleGetServers (const char* msg, const struct sockaddr_storage* ad
                         request_name, peer_address);
             return;
         }
+
+        // Read the version of the list the client already has,
+        // "<registry id>.<epoch>", or "0" if it has none
+        if (delta_request)
+        {
+            unsigned long registry_id;
+
+            msg_ptr = end_ptr;
+            registry_id = strtoul (msg_ptr, &end_ptr, 10);
+            if (end_ptr != msg_ptr && *end_ptr == '.')
+            {
+                msg_ptr = end_ptr + 1;
+                list_epoch = (unsigned int)strtoul (msg_ptr, &end_ptr, 10);
+                has_list_version = (end_ptr != msg_ptr && registry_id == Sv_GetRegistryId ());
+            }
+            if (end_ptr == msg_ptr || (*end_ptr != ' ' && *end_ptr != '\0'))
+            {
+                Com_Printf (MSG_WARNING,
+                            "> WARNING: Rejecting %s from %s (missing or invalid list version)\n",
+                            request_name, peer_address);
+                return;
+            }
+            msg_ptr = end_ptr;
+        }
     }
     // Else, it comes from an anonymous client
     else
@@ -420,10 +1005,12 @@ static void HandleGetServers (const char* msg, const struct sockaddr_storage* ad
     }
 
     // Apply the game options
-    if ((game_options & GAME_OPTION_SEND_EMPTY_SERVERS) != 0)
-        opt_empty = true;
-    if ((game_options & GAME_OPTION_SEND_FULL_SERVERS) != 0)
-        opt_full = true;
+    filter.protocol = protocol;
+    filter.empty = ((game_options & GAME_OPTION_SEND_EMPTY_SERVERS) != 0);
+    filter.full = ((game_options & GAME_OPTION_SEND_FULL_SERVERS) != 0);
+    filter.ipv4 = (! extended_request && ! delta_request);
+    filter.ipv6 = false;
+    filter.gametype = NULL;
 
     // Parse the filtering options
     strncpy (filter_options, msg_ptr, sizeof (filter_options) - 1);
@@ -432,32 +1019,32 @@ static void HandleGetServers (const char* msg, const struct sockaddr_storage* ad
     while (option_ptr != NULL)
     {
         if (strcmp (option_ptr, "empty") == 0)
-            opt_empty = true;
+            filter.empty = true;
         else if (strcmp (option_ptr, "full") == 0)
-            opt_full = true;
+            filter.full = true;
         else if (strcmp (option_ptr, "ffa") == 0)
         {
             gametype[0] = '0';
             gametype[1] = '\0';
-            opt_gametype = true;
+            filter.gametype = gametype;
         }
         else if (strcmp (option_ptr, "tourney") == 0)
         {
             gametype[0] = '1';
             gametype[1] = '\0';
-            opt_gametype = true;
+            filter.gametype = gametype;
         }
         else if (strcmp (option_ptr, "team") == 0)
         {
             gametype[0] = '3';
             gametype[1] = '\0';
-            opt_gametype = true;
+            filter.gametype = gametype;
         }
         else if (strcmp (option_ptr, "ctf") == 0)
         {
             gametype[0] = '4';
             gametype[1] = '\0';
-            opt_gametype = true;
+            filter.gametype = gametype;
         }
         else if (strncmp (option_ptr, "gametype=", 9) == 0)
         {
@@ -465,106 +1052,46 @@ static void HandleGetServers (const char* msg, const struct sockaddr_storage* ad
 
             strncpy(gametype, gametype_string, sizeof(gametype) - 1);
             gametype[sizeof(gametype) - 1] = '\0';
-            opt_gametype = true;
+            filter.gametype = gametype;
         }
-        else if (extended_request)
+        else if (strncmp (option_ptr, "cookie=", 7) == 0)
+        {
+            const char* cookie_string = option_ptr + 7;
+
+            cookie = (unsigned int)strtoul (cookie_string, &end_ptr, 16);
+            has_cookie = (end_ptr != cookie_string && *end_ptr == '\0');
+        }
+        else if (strcmp (option_ptr, "ifchanged") == 0)
+            if_changed = ! delta_request;
+        else if (extended_request || delta_request)
         {
             if (strcmp (option_ptr, "ipv4") == 0)
-                opt_ipv4 = true;
+                filter.ipv4 = true;
             else if (strcmp (option_ptr, "ipv6") == 0)
-                opt_ipv6 = true;
+                filter.ipv6 = true;
         }
         option_ptr = strtok (NULL, " ");
     }
 
     // If no IP version was given for the filtering, accept any version
-    if (! opt_ipv4 && ! opt_ipv6)
+    if (! filter.ipv4 && ! filter.ipv6)
     {
-        opt_ipv4 = true;
-        opt_ipv6 = true;
+        filter.ipv4 = true;
+        filter.ipv6 = true;
     }
 
-    // Initialize the packet contents with the header
-    if (extended_request)
-        packetheader = "\xFF\xFF\xFF\xFF" M2C_GETSERVERSEXTREPONSE;
-    else
-        packetheader = "\xFF\xFF\xFF\xFF" M2C_GETSERVERSREPONSE;
-    headersize = strlen (packetheader);
-    packetind = headersize;
-    memcpy(packet, packetheader, headersize);
-
-    // Add every relevant server
-    nb_servers = 0;
-    for (sv = Sv_GetFirst (); sv != NULL; sv = Sv_GetNext ())
+    // If we still don't know the game name, use the one of
+    // the first server we find that uses the same protocol
+    if (gamename[0] == '\0')
     {
-        size_t next_sv_size;
-
-        assert (sv->state != sv_state_unused_slot);
-
-        // Extra debugging info
-        if (max_msg_level >= MSG_DEBUG)
-        {
-            const char * addrstr = Sys_SockaddrToString (&sv->user.address, sv->user.addrlen);
-            Com_Printf (MSG_DEBUG,
-                        "  - Comparing server: IP:\"%s\", p:%d, g:\"%s\"\n",
-                        addrstr, sv->protocol, sv->gamename);
+        const char* anon_game = Sv_GetAnonymousGame (protocol);
 
-            if (sv->state <= sv_state_uninitialized)
-                Com_Printf (MSG_DEBUG,
-                            "    Reject: server is not initialized\n");
-            else if (sv->protocol != protocol)
-                Com_Printf (MSG_DEBUG,
-                            "    Reject: protocol %d != requested %d\n",
-                            sv->protocol, protocol);
-            else if (! opt_empty && sv->state == sv_state_empty)
-                Com_Printf (MSG_DEBUG, "    Reject: no empty server allowed\n");
-            else if (! opt_full && sv->state == sv_state_full)
-                Com_Printf (MSG_DEBUG, "    Reject: no full server allowed\n");
-            else if (! opt_ipv4 && sv->user.address.ss_family == AF_INET)
-                Com_Printf (MSG_DEBUG, "    Reject: no IPv4 servers allowed\n");
-            else if (! opt_ipv6 && sv->user.address.ss_family == AF_INET6)
-                Com_Printf (MSG_DEBUG, "    Reject: no IPv6 servers allowed\n");
-            else if (opt_gametype && strcmp (gametype, sv->gametype) != 0)
-                Com_Printf (MSG_DEBUG,
-                            "    Reject: gametype \"%s\" != requested \"%s\"\n",
-                            sv->gametype, gametype);
-            else
-            {
-                if (gamename[0] != '\0')
-                {
-                    if (strcmp (gamename, sv->gamename) != 0)
-                        Com_Printf (MSG_DEBUG,
-                                    "    Reject: gamename \"%s\" != requested \"%s\"\n",
-                                    sv->gamename, gamename);
-                }
-                else
-                {
-                    if (sv->anon_properties == NULL)
-                        Com_Printf (MSG_DEBUG,
-                                    "    Reject: can't use \"%s\" as an anonymous game name\n",
-                                    sv->gamename);
-                }
-            }
-        }
-
-        // Check state and protocol
-        if (sv->state <= sv_state_uninitialized ||
-            sv->protocol != protocol)
-        {
-            // Skip it
-            continue;
-        }
-
-        // Since the protocols match, if we don't know the game name yet and
-        // that this server doesn't use the DarkPlaces protocol, use its game name
-        // (if the unknown game was using the DP protocol, the client should have
-        // sent a game name with its "getservers" query)
-        if (gamename[0] == '\0' && sv->anon_properties != NULL)
+        if (anon_game != NULL)
         {
-            strncpy (gamename, sv->gamename, sizeof (gamename) - 1);
+            strncpy (gamename, anon_game, sizeof (gamename) - 1);
             gamename[sizeof (gamename) - 1] = '\0';
 
-            Com_Printf (MSG_DEBUG, "  - Using this server's game name\n");
+            Com_Printf (MSG_DEBUG, "  - Using game name \"%s\" from a server\n", gamename);
 
             if (! Game_IsAccepted (gamename))
             {
@@ -574,144 +1101,132 @@ static void HandleGetServers (const char* msg, const struct sockaddr_storage* ad
                 return;
             }
         }
+    }
 
-        // Check options, game type and game name
-        if ((! opt_empty && sv->state == sv_state_empty) ||
-            (! opt_full && sv->state == sv_state_full) ||
-            (! opt_ipv4 && sv->user.address.ss_family == AF_INET) ||
-            (! opt_ipv6 && sv->user.address.ss_family == AF_INET6) ||
-            (opt_gametype && strcmp (gametype, sv->gametype) != 0) ||
-            strcmp (gamename, sv->gamename) != 0)
-        {
-            // Skip it
-            continue;
-        }
+    view = (gamename[0] != '\0' ? Sv_GetView (gamename) : NULL);
 
-        // If the packet doesn't have enough free space for this server
-        next_sv_size = (sv->user.address.ss_family == AF_INET ? 4 : 16) + 3;
-        if (packetind + next_sv_size > sizeof (packet))
-        {
-            // Send the packet to the client
-            if (sendto (recv_socket, (void*)packet, packetind, 0,
-                    (const struct sockaddr*)addr, addrlen) < 0)
-                Com_Printf (MSG_WARNING, "> WARNING: can't send %s (%s)\n",
-                            request_name, Sys_GetLastNetErrorString ());
-            else
-                Com_Printf (MSG_NORMAL, "> %s <--- %sResponse (%u servers)\n",
-                            peer_address, request_name, nb_servers);
+    // We can only send the changes since the version of the client's list
+    // if it's from the same registry and if we still know all these changes
+    send_delta = (has_list_version && view != NULL &&
+                  view->changes_since <= list_epoch && list_epoch <= view->epoch);
 
-            // Reset the packet index (no need to change the header)
-            packetind = headersize;
-            nb_servers = 0;
-        }
-
-        if (sv->user.address.ss_family == AF_INET)
+    // A client which asks again for a list it got recently and which hasn't changed
+    // since then just gets a short answer. The delta lists already do that by design
+    if (if_changed && view != NULL)
+    {
+        query_class = GetQueryClass (request_name, gamename, &filter);
+        if (Cl_IsListUnchanged (addr, addrlen, query_class, view->epoch))
         {
-            const struct sockaddr_in* sv_sockaddr;
-            unsigned int sv_addr;
-            unsigned short sv_port;
-
-            sv_sockaddr = (const struct sockaddr_in *)&sv->user.address;
-            sv_addr = ntohl (sv_sockaddr->sin_addr.s_addr);
-            sv_port = ntohs (sv_sockaddr->sin_port);
-
-            // Use the address mapping associated with the server, if any
-            if (sv->addrmap != NULL)
-            {
-                const addrmap_t* addrmap = sv->addrmap;
+            SendUnchanged (addr, addrlen, recv_socket);
+            Sv_ReleaseView (view);
+            return;
+        }
+    }
 
-                sv_addr = ntohl (addrmap->to.sin_addr.s_addr);
-                if (addrmap->to.sin_port != 0)
-                    sv_port = ntohs (addrmap->to.sin_port);
+    // When shedding load, the full lists are limited to one packet. The
+    // changes are still sent in full, since they're cheap by design
+    list.single_packet = (load_shedding && ! send_delta);
 
-                Com_Printf (MSG_DEBUG,
-                            "  - Using mapped address %u.%u.%u.%u:%hu\n",
-                            sv_addr >> 24, (sv_addr >> 16) & 0xFF,
-                            (sv_addr >> 8) & 0xFF, sv_addr & 0xFF,
-                            sv_port);
-            }
+    // Don't let a spoofed request make us send a big answer to its victim: unless
+    // the client proves it receives our packets by sending back its cookie, it only
+    // gets one packet of the list, whatever the list is, and a cookie for the next time
+    if (client_cookies)
+    {
+        if (! has_cookie || ! Cl_CheckCookie (addr, cookie, &cookie_expiring))
+        {
+            list.single_packet = true;
+            cookie_expiring = true;
+        }
 
-            // Heading '\'
-            packet[packetind    ] = '\\';
+        if (cookie_expiring)
+            SendCookie (addr, addrlen, recv_socket);
+    }
+    list.truncated = false;
+    list.dropped = false;
 
-            // IP address
-            packet[packetind + 1] =  sv_addr >> 24;
-            packet[packetind + 2] = (sv_addr >> 16) & 0xFF;
-            packet[packetind + 3] = (sv_addr >>  8) & 0xFF;
-            packet[packetind + 4] =  sv_addr        & 0xFF;
+    // A single packet must keep some room for the EOT mark
+    list.packet_limit = MAX_PACKET_SIZE_OUT - (list.single_packet ? 7 : 0);
 
-            // Port
-            packet[packetind + 5] = sv_port >> 8;
-            packet[packetind + 6] = sv_port & 0xFF;
+    // Initialize the packet contents with the header
+    list.addr = addr;
+    list.addrlen = addrlen;
+    list.sock = recv_socket;
+    list.request_name = request_name;
+    if (delta_request)
+    {
+        // A client without a list, or with a list we don't know, starts again
+        // with "0". A truncated list can't be the base of the next changes either
+        if (view != NULL && ! list.single_packet)
+            snprintf (list.header, sizeof (list.header),
+                      "\xFF\xFF\xFF\xFF" M2C_GETSERVERSDELTAREPONSE " %s %u.%u\x0A",
+                      send_delta ? "delta" : "full", Sv_GetRegistryId (), view->epoch);
+        else
+            snprintf (list.header, sizeof (list.header),
+                      "\xFF\xFF\xFF\xFF" M2C_GETSERVERSDELTAREPONSE " full 0\x0A");
+    }
+    else if (extended_request)
+        strcpy (list.header, "\xFF\xFF\xFF\xFF" M2C_GETSERVERSEXTREPONSE);
+    else
+        strcpy (list.header, "\xFF\xFF\xFF\xFF" M2C_GETSERVERSREPONSE);
+    list.headersize = strlen (list.header);
+    list.segments_length = 0;
+    list.nb_segments = 0;
+    StartServerListPacket (&list);
+
+    // Add every relevant server, or only the changes since the client's list. The servers of
+    // a view are shuffled, and each query starts at a different position in it. The changes
+    // are the last ones of each server, in the order they were made
+    if (view == NULL)
+        nb_view_servers = 0;
+    else
+        nb_view_servers = (send_delta ? view->nb_changes : view->nb_servers);
+    view_ind = (nb_view_servers > 0 && ! send_delta ? Sv_GetViewStart (view) : 0);
+    for (nb_checked = 0; nb_checked < nb_view_servers; nb_checked++)
+    {
+        const sv_view_entry_t* sv;
+        qboolean removed = false;
 
-            Com_Printf (MSG_DEBUG, "  - Sending server %u.%u.%u.%u:%hu\n",
-                        packet[packetind + 1], packet[packetind + 2],
-                        packet[packetind + 3], packet[packetind + 4],
-                        sv_port);
+        if (send_delta)
+        {
+            const sv_change_t* change = &view->changes[nb_checked];
 
-            packetind += 7;
+            if (change->epoch <= list_epoch)
+                continue;
+            sv = &change->server;
+            removed = change->removed;
         }
         else
         {
-            const struct sockaddr_in6* sv_sockaddr6;
-            unsigned short sv_port;
-
-            sv_sockaddr6 = (const struct sockaddr_in6 *)&sv->user.address;
-
-            // Heading '/'
-            packet[packetind] = '/';
-            packetind += 1;
-
-            // IP address
-            memcpy (&packet[packetind], &sv_sockaddr6->sin6_addr.s6_addr,
-                    sizeof(sv_sockaddr6->sin6_addr.s6_addr));
-            packetind += sizeof(sv_sockaddr6->sin6_addr.s6_addr);
+            sv = &view->servers[view_ind];
+            view_ind++;
+            if (view_ind == nb_view_servers)
+                view_ind = 0;
+        }
 
-            // Port
-            sv_port = ntohs (sv_sockaddr6->sin6_port);
-            packet[packetind    ] = sv_port >> 8;
-            packet[packetind + 1] = sv_port & 0xFF;
-            packetind += 2;
+        if (removed || ! IsServerWanted (&filter, sv))
+        {
+            // The servers that don't match anymore may be in the client's list,
+            // unless they're from an IP version it doesn't want
+            if (! send_delta || (sv->family == AF_INET ? ! filter.ipv4 : ! filter.ipv6))
+                continue;
+            removed = true;
         }
 
-        nb_servers++;
+        AddToServerList (&list, sv, removed);
+        if (list.truncated || list.dropped)
+            break;
     }
 
-    // If the packet doesn't have enough free space for the EOT mark
-    if (packetind + 7 > sizeof (packet))
-    {
-        // Send the packet to the client
-        if (sendto (recv_socket, (void*)packet, packetind, 0,
-                (const struct sockaddr*)addr, addrlen) < 0)
-            Com_Printf (MSG_WARNING, "> WARNING: can't send %s (%s)\n",
-                        request_name, Sys_GetLastNetErrorString ());
-        else
-            Com_Printf (MSG_NORMAL, "> %s <--- %sResponse (%u servers)\n",
-                        peer_address, request_name, nb_servers);
+    if (list.truncated)
+        Com_Printf (MSG_DEBUG, "  - List truncated to 1 packet (%s)\n",
+                    load_shedding ? "load shedding" : "unverified client");
 
-        // Reset the packet index (no need to change the header)
-        packetind = headersize;
-        nb_servers = 0;
-    }
+    EndServerList (&list);
 
-    // End Of Transmission
-    packet[packetind    ] = '\\';
-    packet[packetind + 1] = 'E';
-    packet[packetind + 2] = 'O';
-    packet[packetind + 3] = 'T';
-    packet[packetind + 4] = '\0';
-    packet[packetind + 5] = '\0';
-    packet[packetind + 6] = '\0';
-    packetind += 7;
-
-    // Send the packet to the client
-    if (sendto (recv_socket, (void*)packet, packetind, 0,
-            (const struct sockaddr*)addr, addrlen) < 0)
-        Com_Printf (MSG_WARNING, "> WARNING: can't send %s (%s)\n",
-                    request_name, Sys_GetLastNetErrorString ());
-    else
-        Com_Printf (MSG_NORMAL, "> %s <--- %sResponse (%u servers)\n",
-                    peer_address, request_name, nb_servers);
+    // Only a complete list can be the base of the next "unchanged" answers
+    if (if_changed && view != NULL && ! list.truncated && ! list.dropped)
+        Cl_RememberList (addr, addrlen, query_class, view->epoch);
+    Sv_ReleaseView (view);
 }
 
 
@@ -729,6 +1244,7 @@ static void HandleInfoResponse (server_t* server, const char* msg)
     char new_gametype [GAMETYPE_LENGTH];
     char* end_ptr;
     unsigned int new_maxclients, new_clients;
+    server_state_t new_state;
 
     // Check the challenge
     if (!server->challenge_timeout || server->challenge_timeout < crt_time)
@@ -858,19 +1374,176 @@ static void HandleInfoResponse (server_t* server, const char* msg)
     }
 
     // Save some useful informations in the server entry
-    strncpy (server->gamename, value, sizeof (server->gamename) - 1);
-    server->protocol = new_protocol;
-    server->anon_properties = server->hb_properties;
-    strncpy (server->gametype, new_gametype, sizeof (server->gametype) - 1);
     if (new_clients == 0)
-        server->state = sv_state_empty;
+        new_state = sv_state_empty;
     else if (new_clients == new_maxclients)
-        server->state = sv_state_full;
+        new_state = sv_state_full;
     else
-        server->state = sv_state_occupied;
+        new_state = sv_state_occupied;
+    Sv_SetInfo (server, value, new_protocol, new_gametype, new_state, server->hb_properties);
 
     // Set a new timeout
-    server->timeout = crt_time + TIMEOUT_INFORESPONSE;
+    server->timeout = crt_time + server_timeout;
+    server->verified_time = crt_time;
+
+    if (server->origin == sv_origin_heartbeat)
+        Peer_QueueAddition (server);
+}
+
+
+/*
+====================
+HandlePeerSync
+
+Parse peerSync messages
+====================
+*/
+static void HandlePeerSync (const qbyte* msg, size_t length, const struct sockaddr_storage* addr, socklen_t addrlen)
+{
+    char master_address [sizeof (peer_address)];
+    unsigned int nb_added = 0, nb_removed = 0;
+
+    Com_Printf (MSG_NORMAL, "> %s ---> peerSync\n", peer_address);
+
+    if (! Peer_IsPeer (addr, addrlen))
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: Rejecting peerSync from %s (not a peer master)\n",
+                    peer_address);
+        return;
+    }
+
+    // Its source address is easy to forge, so check it has been sent by a peer
+    if (! Peer_IsAuthentic (msg, length))
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: Rejecting peerSync from %s (invalid authentication code)\n",
+                    peer_address);
+        return;
+    }
+    msg += PEER_MAC_SIZE;
+    length -= PEER_MAC_SIZE;
+
+    // "peer_address" will be used for the servers while parsing the message
+    strncpy (master_address, peer_address, sizeof (master_address));
+
+    while (length > 0)
+    {
+        struct sockaddr_storage sv_address;
+        socklen_t sv_addrlen;
+        qbyte entry_type;
+        size_t addr_size;
+        const char* anon_name = NULL;
+        const game_properties_t* anon_props = NULL;
+        server_t* server;
+        socket_t sock;
+
+        // Read the entry type and the server address
+        if (length < 2)
+            break;
+        entry_type = msg[0];
+        addr_size = (msg[1] == PEER_ENTRY_IPV4 ? 4 : 16);
+        if ((entry_type != PEER_ENTRY_ADD && entry_type != PEER_ENTRY_REMOVE) ||
+            (msg[1] != PEER_ENTRY_IPV4 && msg[1] != PEER_ENTRY_IPV6) ||
+            length < 2 + addr_size + 2)
+            break;
+
+        memset (&sv_address, 0, sizeof (sv_address));
+        if (msg[1] == PEER_ENTRY_IPV4)
+        {
+            struct sockaddr_in* addr4 = (struct sockaddr_in*)&sv_address;
+
+            addr4->sin_family = AF_INET;
+            memcpy (&addr4->sin_addr.s_addr, &msg[2], 4);
+            memcpy (&addr4->sin_port, &msg[6], 2);
+            sv_addrlen = sizeof (*addr4);
+        }
+        else
+        {
+            struct sockaddr_in6* addr6 = (struct sockaddr_in6*)&sv_address;
+
+            addr6->sin6_family = AF_INET6;
+            memcpy (&addr6->sin6_addr.s6_addr, &msg[2], 16);
+            memcpy (&addr6->sin6_port, &msg[18], 2);
+            sv_addrlen = sizeof (*addr6);
+        }
+        msg += 2 + addr_size + 2;
+        length -= 2 + addr_size + 2;
+
+        // Read the anonymous game name
+        if (entry_type == PEER_ENTRY_ADD)
+        {
+            const qbyte* name_end = memchr (msg, '\0', length);
+
+            if (name_end == NULL || name_end - msg >= GAMENAME_LENGTH)
+                break;
+            anon_name = (const char*)msg;
+            length -= name_end - msg + 1;
+            msg = name_end + 1;
+        }
+
+        strncpy (peer_address, Sys_SockaddrToString (&sv_address, sv_addrlen),
+                 sizeof (peer_address));
+        peer_address[sizeof (peer_address) - 1] = '\0';
+
+        server = Sv_GetByAddr (&sv_address, sv_addrlen, false);
+
+        if (entry_type == PEER_ENTRY_REMOVE)
+        {
+            // We only forget the servers we haven't heard from directly
+            if (server != NULL && server->origin == sv_origin_peer)
+            {
+                Com_Printf (MSG_DEBUG, "  - removing server %s\n", peer_address);
+
+                Sv_Remove (server);
+                nb_removed++;
+            }
+            continue;
+        }
+
+        // If the server talks to us directly, we already know everything about it
+        if (server != NULL && server->origin == sv_origin_heartbeat)
+            continue;
+
+        if (anon_name[0] != '\0')
+        {
+            anon_props = Game_GetPropertiesByName (anon_name);
+            if (anon_props == NULL || ! Game_IsAccepted (anon_name))
+            {
+                Com_Printf (MSG_DEBUG,
+                            "  - ignoring server %s (game \"%s\" is unknown or not accepted)\n",
+                            peer_address, anon_name);
+                continue;
+            }
+        }
+
+        sock = Sys_GetListenSocket (sv_address.ss_family);
+        if (sock == INVALID_SOCKET)
+            continue;
+
+        if (server == NULL)
+        {
+            server = Sv_GetByAddr (&sv_address, sv_addrlen, true);
+            if (server == NULL)
+                continue;
+        }
+        server->origin = sv_origin_peer;
+
+        // Check it's really there before sending it to our clients
+        SendGetInfo (server, sock, server->hb_properties != anon_props);
+        server->hb_properties = anon_props;
+        nb_added++;
+    }
+
+    strncpy (peer_address, master_address, sizeof (peer_address));
+
+    if (length > 0)
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: invalid peerSync from %s (malformed entry)\n",
+                    peer_address);
+
+    Com_Printf (MSG_DEBUG, "  - %u server(s) to check, %u server(s) removed\n",
+                nb_added, nb_removed);
 }
 
 
@@ -914,17 +1587,184 @@ void HandleMessage (const char* msg, size_t length,
         HandleInfoResponse (server, msg + strlen (S2M_INFORESPONSE));
     }
 
+    // If it's a peerSync message
+    else if (!strncmp (M2M_PEERSYNC, msg, strlen (M2M_PEERSYNC)))
+    {
+        HandlePeerSync ((const qbyte*)msg + strlen (M2M_PEERSYNC),
+                        length - strlen (M2M_PEERSYNC), address, addrlen);
+    }
+
+    // If it's an answer from an upstream master
+    else if (!strncmp (M2C_GETSERVERSREPONSE, msg, strlen (M2C_GETSERVERSREPONSE)))
+    {
+        Upstream_HandleResponse ((const qbyte*)msg + strlen (M2C_GETSERVERSREPONSE),
+                                 length - strlen (M2C_GETSERVERSREPONSE),
+                                 address, addrlen, false);
+    }
+    else if (!strncmp (M2C_GETSERVERSEXTREPONSE, msg, strlen (M2C_GETSERVERSEXTREPONSE)))
+    {
+        Upstream_HandleResponse ((const qbyte*)msg + strlen (M2C_GETSERVERSEXTREPONSE),
+                                 length - strlen (M2C_GETSERVERSEXTREPONSE),
+                                 address, addrlen, true);
+    }
+
     // If it's a getservers request
     else if (!strncmp (C2M_GETSERVERS, msg, strlen (C2M_GETSERVERS)))
     {
         HandleGetServers (msg + strlen (C2M_GETSERVERS), address, addrlen,
-                          recv_socket, false);
+                          recv_socket, false, false);
     }
 
     // If it's a getserversExt request
     else if (!strncmp (C2M_GETSERVERSEXT, msg, strlen (C2M_GETSERVERSEXT)))
     {
         HandleGetServers (msg + strlen (C2M_GETSERVERSEXT), address, addrlen,
-                          recv_socket, true);
+                          recv_socket, true, false);
+    }
+
+    // If it's a getserversDelta request
+    else if (!strncmp (C2M_GETSERVERSDELTA, msg, strlen (C2M_GETSERVERSDELTA)))
+    {
+        HandleGetServers (msg + strlen (C2M_GETSERVERSDELTA), address, addrlen,
+                          recv_socket, false, true);
+    }
+}
+
+
+/*
+====================
+IsServerListRequest
+
+Return "true" if a message is a server list request from a client. Those
+are more costly to handle than the servers' messages, and less urgent
+====================
+*/
+qboolean IsServerListRequest (const char* msg)
+{
+    return (strncmp (C2M_GETSERVERS, msg, strlen (C2M_GETSERVERS)) == 0 ||
+            strncmp (C2M_GETSERVERSEXT, msg, strlen (C2M_GETSERVERSEXT)) == 0 ||
+            strncmp (C2M_GETSERVERSDELTA, msg, strlen (C2M_GETSERVERSDELTA)) == 0);
+}
+
+
+/*
+====================
+ChallengeAllServers
+
+Send a "getinfo" message to all registered servers (used after loading the registry snapshot)
+====================
+*/
+void ChallengeAllServers (void)
+{
+    int position = -1;
+    server_t* sv;
+
+    while ((sv = Sv_Browse (&position)) != NULL)
+    {
+        socket_t sock = Sys_GetListenSocket (sv->user.address.ss_family);
+
+        if (sock == INVALID_SOCKET)
+            continue;
+
+        strncpy (peer_address, Sys_SockaddrToString (&sv->user.address, sv->user.addrlen),
+                 sizeof (peer_address));
+        peer_address[sizeof (peer_address) - 1] = '\0';
+
+        SendGetInfo (sv, sock, true);
     }
 }
+
+
+/*
+====================
+SetTrustWindow
+
+Set the time during which the heartbeats of a server that has just sent a valid
+infoResponse don't trigger a "getinfo" right away (0 = they always do)
+====================
+*/
+qboolean SetTrustWindow (unsigned int window)
+{
+    // The servers must be asked again before they time out
+    if (window >= server_timeout)
+        return false;
+
+    trust_window = window;
+    return true;
+}
+
+
+/*
+====================
+SetServerTimeout
+
+Set the time a server stays registered after a valid infoResponse
+====================
+*/
+qboolean SetServerTimeout (unsigned int timeout)
+{
+    // The servers must be asked again by the trust window before they time out
+    if (timeout == 0 || timeout <= trust_window)
+        return false;
+
+    server_timeout = timeout;
+    return true;
+}
+
+
+/*
+====================
+SendDeferredGetInfos
+
+Send the "getinfo" messages deferred by the trust window that are due
+====================
+*/
+void SendDeferredGetInfos (void)
+{
+    while (nb_deferred_getinfos > 0 && deferred_getinfos[0].time <= crt_time)
+    {
+        server_t* sv = deferred_getinfos[0].server;
+        socket_t sock;
+
+        PopDeferredGetInfo ();
+        sv->getinfo_queued = false;
+
+        // Skip the servers that are gone, or that don't wait for a getinfo anymore
+        if (sv->state == sv_state_unused_slot || sv->timeout < crt_time ||
+            sv->getinfo_time == 0)
+            continue;
+
+        // If it has been verified again, wait for the end of its new trust window.
+        // There's room in the heap for it, since its entry has just been removed
+        if (sv->getinfo_time > crt_time)
+        {
+            PushDeferredGetInfo (sv);
+            sv->getinfo_queued = true;
+            continue;
+        }
+
+        sv->getinfo_time = 0;
+        sock = Sys_GetListenSocket (sv->user.address.ss_family);
+        if (sock == INVALID_SOCKET)
+            continue;
+
+        strncpy (peer_address, Sys_SockaddrToString (&sv->user.address, sv->user.addrlen),
+                 sizeof (peer_address));
+        peer_address[sizeof (peer_address) - 1] = '\0';
+
+        SendGetInfo (sv, sock, false);
+    }
+}
+
+
+/*
+====================
+GetNextDeferredGetInfoTime
+
+Returns the time of the next deferred "getinfo" message, or 0 if there's none
+====================
+*/
+time_t GetNextDeferredGetInfoTime (void)
+{
+    return (nb_deferred_getinfos > 0 ? deferred_getinfos[0].time : 0);
+}
@@ -25,6 +25,23 @@
 #define _MESSAGES_H_
 
 
+// ---------- Constants ---------- //
+
+// Default timeout after a valid infoResponse (in secondes)
+#define TIMEOUT_INFORESPONSE (15 * 60)
+
+
+// ---------- Public variables ---------- //
+
+// Is the master shedding the client load, to keep up with the servers' messages?
+// While it does, the server lists are cut after 1 packet and the clients are
+// throttled sooner, but the servers' messages are still handled as usual
+extern qboolean load_shedding;
+
+// The prefixes of all the messages HandleMessage accepts (NULL-terminated)
+extern const char* const message_prefixes [];
+
+
 // ---------- Public functions ---------- //
 
 // Parse a packet to figure out what to do with it
@@ -33,5 +50,27 @@ void HandleMessage (const char* msg, size_t length,
                     socklen_t addrlen,
                     socket_t recv_socket);
 
+// Return "true" if a message is a server list request from a client. Those
+// are more costly to handle than the servers' messages, and less urgent
+qboolean IsServerListRequest (const char* msg);
+
+// Send a "getinfo" message to all registered servers (used after loading the registry snapshot)
+void ChallengeAllServers (void);
+
+// Set the time during which the heartbeats of a server that has just sent a valid
+// infoResponse don't trigger a "getinfo" right away (0 = they always do).
+// It must be shorter than the time a server stays registered without sending them
+qboolean SetTrustWindow (unsigned int window);
+
+// Set the time a server stays registered after a valid infoResponse, in seconds.
+// It must be longer than the trust window
+qboolean SetServerTimeout (unsigned int timeout);
+
+// Send the "getinfo" messages deferred by the trust window that are due
+void SendDeferredGetInfos (void);
+
+// Returns the time of the next deferred "getinfo" message, or 0 if there's none
+time_t GetNextDeferredGetInfoTime (void);
+
 
 #endif  // #ifndef _MESSAGES_H_
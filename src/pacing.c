@@ -0,0 +1,581 @@
+/*
+    pacing.c
+
+    Outbound pacing of the server lists for dpmaster
+
+    Copyright (C) 2026  The ravenmaster contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "common.h"
+#include "system.h"
+
+#include "pacing.h"
+
+
+// ---------- Private types ---------- //
+
+// A token bucket. Its tokens are bytes we're allowed to send
+typedef struct
+{
+    double tokens;
+    double last_refill;
+} token_bucket_t;
+
+// A buffer of packets waiting to be sent to a destination
+typedef struct paced_block_s
+{
+    struct paced_block_s* next;
+    qbyte* data;
+    size_t length;
+    size_t segment_size;
+    size_t offset;          // number of bytes already sent
+    double queued_time;
+} paced_block_t;
+
+// A destination and its token bucket. It's forgotten once
+// it has nothing left to send and its bucket is full again
+typedef struct
+{
+    struct sockaddr_storage address;
+    socklen_t addrlen;
+    socket_t sock;
+    token_bucket_t bucket;
+    paced_block_t* first_block;
+    paced_block_t* last_block;
+} paced_flow_t;
+
+
+// ---------- Private variables ---------- //
+
+// The rate limits, in kilobytes per second (0 = no limit)
+static unsigned int client_rate = 0;
+static unsigned int upload_rate = 0;
+
+static qboolean pacing_initialized = false;
+static qboolean pacing_enabled = false;
+
+// The global bucket
+static token_bucket_t upload_bucket;
+static double upload_capacity;
+
+// The destinations
+static paced_flow_t flows [MAX_PACED_FLOWS];
+static unsigned int nb_flows = 0;
+static unsigned int first_flow = 0;  // the destinations take turns being served first
+static size_t queued_bytes = 0;
+
+// Statistics since the last report
+static time_t next_report = 0;
+static time_t report_start;
+static unsigned int nb_queued_blocks = 0;
+static unsigned int nb_sent_blocks = 0;
+static unsigned int nb_dropped_blocks = 0;
+static unsigned int max_queued_flows = 0;
+static size_t max_queued_bytes = 0;
+static double total_delay = 0.0;
+static double max_delay = 0.0;
+
+
+// ---------- Private functions ---------- //
+
+/*
+====================
+Pace_RefillBucket
+
+Add the tokens earned by a bucket since its last refill
+====================
+*/
+static void Pace_RefillBucket (token_bucket_t* bucket, unsigned int rate, double capacity, double now)
+{
+    if (rate == 0)
+        return;
+
+    bucket->tokens += (now - bucket->last_refill) * rate * 1000.0;
+    if (bucket->tokens > capacity)
+        bucket->tokens = capacity;
+    bucket->last_refill = now;
+}
+
+
+/*
+====================
+Pace_GetBucketTime
+
+Get the time when a bucket will have enough tokens to send "size" bytes
+====================
+*/
+static double Pace_GetBucketTime (const token_bucket_t* bucket, unsigned int rate, size_t size)
+{
+    if (rate == 0 || bucket->tokens >= (double)size)
+        return bucket->last_refill;
+
+    return bucket->last_refill + ((double)size - bucket->tokens) / (rate * 1000.0);
+}
+
+
+/*
+====================
+Pace_SendAffordable
+
+Send the first packets of a buffer that both buckets allow us to send right now.
+The number of bytes sent is put in "sent"
+====================
+*/
+static qboolean Pace_SendAffordable (paced_flow_t* flow, const void* data, size_t length,
+                                     size_t segment_size, double now, size_t* sent)
+{
+    size_t affordable = 0;
+
+    Pace_RefillBucket (&flow->bucket, client_rate, PACING_CLIENT_BURST, now);
+    Pace_RefillBucket (&upload_bucket, upload_rate, upload_capacity, now);
+
+    while (affordable < length)
+    {
+        size_t size = length - affordable;
+        double needed;
+
+        if (size > segment_size)
+            size = segment_size;
+        needed = (double)(affordable + size);
+
+        if ((client_rate != 0 && flow->bucket.tokens < needed) ||
+            (upload_rate != 0 && upload_bucket.tokens < needed))
+            break;
+        affordable += size;
+    }
+
+    *sent = affordable;
+    if (affordable == 0)
+        return true;
+
+    flow->bucket.tokens -= (double)affordable;
+    upload_bucket.tokens -= (double)affordable;
+    return Sys_SendSegments (flow->sock, data, affordable, segment_size,
+                             &flow->address, flow->addrlen);
+}
+
+
+/*
+====================
+Pace_ClearFlow
+
+Forget the packets waiting to be sent to a destination
+====================
+*/
+static void Pace_ClearFlow (paced_flow_t* flow)
+{
+    while (flow->first_block != NULL)
+    {
+        paced_block_t* block = flow->first_block;
+
+        queued_bytes -= block->length - block->offset;
+        nb_dropped_blocks++;
+        flow->first_block = block->next;
+        free (block);
+    }
+    flow->last_block = NULL;
+}
+
+
+/*
+====================
+Pace_SendFlow
+
+Send the queued packets of a destination that are due
+====================
+*/
+static void Pace_SendFlow (paced_flow_t* flow, double now)
+{
+    while (flow->first_block != NULL)
+    {
+        paced_block_t* block = flow->first_block;
+        size_t sent;
+        double delay;
+
+        if (! Pace_SendAffordable (flow, block->data + block->offset, block->length - block->offset,
+                                   block->segment_size, now, &sent))
+        {
+            Com_Printf (MSG_WARNING, "> WARNING: can't send the paced packets to %s (%s)\n",
+                        Sys_SockaddrToString (&flow->address, flow->addrlen),
+                        Sys_GetLastNetErrorString ());
+            Pace_ClearFlow (flow);
+            return;
+        }
+
+        block->offset += sent;
+        queued_bytes -= sent;
+        if (block->offset < block->length)
+            return;
+
+        delay = now - block->queued_time;
+        total_delay += delay;
+        if (delay > max_delay)
+            max_delay = delay;
+        nb_sent_blocks++;
+
+        flow->first_block = block->next;
+        if (flow->first_block == NULL)
+            flow->last_block = NULL;
+        free (block);
+    }
+}
+
+
+/*
+====================
+Pace_RemoveIdleFlows
+
+Forget the destinations that have nothing to send and a full bucket
+====================
+*/
+static void Pace_RemoveIdleFlows (double now)
+{
+    unsigned int flow_ind = nb_flows;
+
+    while (flow_ind > 0)
+    {
+        paced_flow_t* flow = &flows[--flow_ind];
+
+        if (flow->first_block != NULL)
+            continue;
+
+        Pace_RefillBucket (&flow->bucket, client_rate, PACING_CLIENT_BURST, now);
+        if (client_rate == 0 || flow->bucket.tokens >= PACING_CLIENT_BURST)
+        {
+            nb_flows--;
+            if (flow_ind < nb_flows)
+                *flow = flows[nb_flows];
+        }
+    }
+
+    if (first_flow >= nb_flows)
+        first_flow = 0;
+}
+
+
+/*
+====================
+Pace_GetFlow
+
+Get the destination using this address, or start tracking it
+====================
+*/
+static paced_flow_t* Pace_GetFlow (const struct sockaddr_storage* address, socklen_t addrlen, double now)
+{
+    paced_flow_t* flow;
+    unsigned int flow_ind;
+
+    for (flow_ind = 0; flow_ind < nb_flows; flow_ind++)
+    {
+        flow = &flows[flow_ind];
+        if (flow->addrlen == addrlen && memcmp (&flow->address, address, addrlen) == 0)
+            return flow;
+    }
+
+    if (nb_flows == MAX_PACED_FLOWS)
+    {
+        Pace_RemoveIdleFlows (now);
+        if (nb_flows == MAX_PACED_FLOWS)
+            return NULL;
+    }
+
+    flow = &flows[nb_flows++];
+    memcpy (&flow->address, address, addrlen);
+    flow->addrlen = addrlen;
+    flow->bucket.tokens = PACING_CLIENT_BURST;
+    flow->bucket.last_refill = now;
+    flow->first_block = NULL;
+    flow->last_block = NULL;
+    return flow;
+}
+
+
+/*
+====================
+Pace_ReportStatistics
+
+Report the queue depth and the pacing delays since the last report, if it's time to
+====================
+*/
+static void Pace_ReportStatistics (void)
+{
+    if (next_report == 0 || crt_time < next_report)
+        return;
+
+    Com_Printf (MSG_NORMAL,
+                "> Pacing: %u packet buffers queued and %u dropped during the last %u seconds, "
+                "queue peak: %u destinations / %u bytes, delays: %.0f ms on average / %.0f ms at most\n",
+                nb_queued_blocks, nb_dropped_blocks, (unsigned int)(crt_time - report_start),
+                max_queued_flows, (unsigned int)max_queued_bytes,
+                nb_sent_blocks > 0 ? total_delay * 1000.0 / nb_sent_blocks : 0.0,
+                max_delay * 1000.0);
+
+    nb_queued_blocks = 0;
+    nb_sent_blocks = 0;
+    nb_dropped_blocks = 0;
+    max_queued_flows = nb_flows;
+    max_queued_bytes = queued_bytes;
+    total_delay = 0.0;
+    max_delay = 0.0;
+
+    // Keep on reporting while packets are waiting
+    if (queued_bytes > 0)
+    {
+        report_start = crt_time;
+        next_report = crt_time + PACING_REPORT_PERIOD;
+    }
+    else
+        next_report = 0;
+}
+
+
+// ---------- Public functions ---------- //
+
+/*
+====================
+Pace_SetClientRate
+
+Set the maximum rate of the server lists sent to each client, in kilobytes per second
+====================
+*/
+qboolean Pace_SetClientRate (unsigned int rate)
+{
+    if (pacing_initialized)
+        return false;
+
+    client_rate = rate;
+    return true;
+}
+
+
+/*
+====================
+Pace_SetUploadRate
+
+Set the maximum rate of the server lists sent to all clients, in kilobytes per second
+====================
+*/
+qboolean Pace_SetUploadRate (unsigned int rate)
+{
+    if (pacing_initialized)
+        return false;
+
+    upload_rate = rate;
+    return true;
+}
+
+
+/*
+====================
+Pace_Init
+
+Start pacing the outbound server lists, if a rate has been set
+====================
+*/
+qboolean Pace_Init (void)
+{
+    pacing_initialized = true;
+    if (client_rate == 0 && upload_rate == 0)
+        return true;
+
+    upload_capacity = upload_rate * (double)PACING_UPLOAD_BURST_TIME;
+    if (upload_capacity < PACING_CLIENT_BURST)
+        upload_capacity = PACING_CLIENT_BURST;
+    upload_bucket.tokens = upload_capacity;
+    upload_bucket.last_refill = Sys_GetPreciseTime ();
+
+    Com_Printf (MSG_NORMAL,
+                "> Pacing the server lists (per client: %u KB/s, in total: %u KB/s, 0 = no limit)\n",
+                client_rate, upload_rate);
+
+    pacing_enabled = true;
+    return true;
+}
+
+
+/*
+====================
+Pace_Send
+
+Send a buffer made of several packets of "segment_size" bytes (the last one
+may be shorter) as soon as the rate limits allow it. The packets that can't be
+sent immediately are copied and queued, or dropped if the queue is full
+====================
+*/
+pace_status_t Pace_Send (socket_t sock, const void* data, size_t length, size_t segment_size,
+                         const struct sockaddr_storage* address, socklen_t addrlen)
+{
+    paced_flow_t* flow;
+    paced_block_t* block;
+    size_t sent = 0;
+    double now;
+
+    if (! pacing_enabled)
+    {
+        if (! Sys_SendSegments (sock, data, length, segment_size, address, addrlen))
+            return PACE_STATUS_ERROR;
+        return PACE_STATUS_OK;
+    }
+
+    now = Sys_GetPreciseTime ();
+    flow = Pace_GetFlow (address, addrlen, now);
+    if (flow == NULL)
+    {
+        Com_Printf (MSG_DEBUG, "  - Pacing: too many destinations, dropping %u bytes\n",
+                    (unsigned int)length);
+        nb_dropped_blocks++;
+        return PACE_STATUS_DROPPED;
+    }
+    flow->sock = sock;
+
+    // Send what we can right away, unless older packets are still waiting
+    if (flow->first_block == NULL)
+    {
+        if (! Pace_SendAffordable (flow, data, length, segment_size, now, &sent))
+            return PACE_STATUS_ERROR;
+        if (sent == length)
+            return PACE_STATUS_OK;
+    }
+
+    length -= sent;
+    block = NULL;
+    if (queued_bytes + length <= MAX_PACED_BYTES)
+        block = malloc (sizeof (*block) + length);
+    if (block == NULL)
+    {
+        Com_Printf (MSG_DEBUG, "  - Pacing: the queue is full, dropping %u bytes\n",
+                    (unsigned int)length);
+        nb_dropped_blocks++;
+        return PACE_STATUS_DROPPED;
+    }
+
+    block->next = NULL;
+    block->data = (qbyte*)(block + 1);
+    memcpy (block->data, (const qbyte*)data + sent, length);
+    block->length = length;
+    block->segment_size = segment_size;
+    block->offset = 0;
+    block->queued_time = now;
+
+    if (flow->last_block != NULL)
+        flow->last_block->next = block;
+    else
+        flow->first_block = block;
+    flow->last_block = block;
+    queued_bytes += length;
+
+    nb_queued_blocks++;
+    if (nb_flows > max_queued_flows)
+        max_queued_flows = nb_flows;
+    if (queued_bytes > max_queued_bytes)
+        max_queued_bytes = queued_bytes;
+    if (next_report == 0)
+    {
+        report_start = crt_time;
+        next_report = crt_time + PACING_REPORT_PERIOD;
+    }
+
+    Com_Printf (MSG_DEBUG, "  - Pacing: %u bytes queued for %s (queue: %u destinations, %u bytes)\n",
+                (unsigned int)length, Sys_SockaddrToString (address, addrlen),
+                nb_flows, (unsigned int)queued_bytes);
+    return PACE_STATUS_OK;
+}
+
+
+/*
+====================
+Pace_Update
+
+Send the queued packets that are due, and report the pacing statistics if it's time to
+====================
+*/
+void Pace_Update (void)
+{
+    if (! pacing_enabled)
+        return;
+
+    if (nb_flows > 0)
+    {
+        double now = Sys_GetPreciseTime ();
+        unsigned int flow_ind;
+
+        for (flow_ind = 0; flow_ind < nb_flows; flow_ind++)
+            Pace_SendFlow (&flows[(first_flow + flow_ind) % nb_flows], now);
+        first_flow = (first_flow + 1) % nb_flows;
+
+        Pace_RemoveIdleFlows (now);
+    }
+
+    Pace_ReportStatistics ();
+}
+
+
+/*
+====================
+Pace_GetNextSendTime
+
+Returns the time (see Sys_GetPreciseTime) when the next
+queued packet can be sent, or 0 if there's none
+====================
+*/
+double Pace_GetNextSendTime (void)
+{
+    double next_time = 0.0;
+    unsigned int flow_ind;
+
+    if (queued_bytes == 0)
+        return 0.0;
+
+    for (flow_ind = 0; flow_ind < nb_flows; flow_ind++)
+    {
+        const paced_flow_t* flow = &flows[flow_ind];
+        const paced_block_t* block = flow->first_block;
+        size_t size;
+        double flow_time, upload_time;
+
+        if (block == NULL)
+            continue;
+
+        size = block->length - block->offset;
+        if (size > block->segment_size)
+            size = block->segment_size;
+
+        flow_time = Pace_GetBucketTime (&flow->bucket, client_rate, size);
+        upload_time = Pace_GetBucketTime (&upload_bucket, upload_rate, size);
+        if (upload_time > flow_time)
+            flow_time = upload_time;
+
+        if (next_time == 0.0 || flow_time < next_time)
+            next_time = flow_time;
+    }
+
+    return next_time;
+}
+
+
+/*
+====================
+Pace_GetNextReportTime
+
+Returns the time of the next report of the pacing statistics, or 0 if there's none
+====================
+*/
+time_t Pace_GetNextReportTime (void)
+{
+    return next_report;
+}
@@ -0,0 +1,88 @@
+/*
+    pacing.h
+
+    Outbound pacing of the server lists for dpmaster
+
+    Copyright (C) 2026  The ravenmaster contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef _PACING_H_
+#define _PACING_H_
+
+
+// ---------- Constants ---------- //
+
+// The maximum number of destinations whose token bucket is tracked at once
+#define MAX_PACED_FLOWS 1024
+
+// The maximum number of bytes waiting to be sent, all destinations included
+#define MAX_PACED_BYTES (2 * 1024 * 1024)
+
+// The number of bytes that can be sent at once to a destination whose bucket is full
+#define PACING_CLIENT_BURST 16384
+
+// The capacity of the global bucket, in milliseconds of upload rate (but
+// at least PACING_CLIENT_BURST bytes, so a destination can get its burst)
+#define PACING_UPLOAD_BURST_TIME 50
+
+// Period between 2 reports of the pacing statistics, in seconds
+#define PACING_REPORT_PERIOD 60
+
+
+// ---------- Public types ---------- //
+
+// The results of Pace_Send
+typedef enum
+{
+    PACE_STATUS_OK,         // sent, or queued to be sent later
+    PACE_STATUS_DROPPED,    // not sent, because the queue or the flow table is full
+    PACE_STATUS_ERROR       // not sent, because of a network error
+} pace_status_t;
+
+
+// ---------- Public functions ---------- //
+
+// Set the maximum rate of the server lists sent to each client and to all of
+// them, in kilobytes per second. 0 means there's no limit. The pacing is
+// disabled if neither is set. Will simply return "false" if called after Pace_Init
+qboolean Pace_SetClientRate (unsigned int rate);
+qboolean Pace_SetUploadRate (unsigned int rate);
+
+// Start pacing the outbound server lists, if a rate has been set
+qboolean Pace_Init (void);
+
+// Send a buffer made of several packets of "segment_size" bytes (the last one
+// may be shorter) as soon as the rate limits allow it. The packets that can't be
+// sent immediately are copied and queued, or dropped if the queue is full.
+// Once a part of a list has been dropped, the rest of it must be dropped too, so
+// the client doesn't get a complete-looking list with a hole in it
+pace_status_t Pace_Send (socket_t sock, const void* data, size_t length, size_t segment_size,
+                         const struct sockaddr_storage* address, socklen_t addrlen);
+
+// Send the queued packets that are due, and report the pacing statistics if it's time to
+void Pace_Update (void);
+
+// Returns the time (see Sys_GetPreciseTime) when the next queued packet can
+// be sent, or 0 if there's none
+double Pace_GetNextSendTime (void);
+
+// Returns the time of the next report of the pacing statistics, or 0 if there's none
+time_t Pace_GetNextReportTime (void);
+
+
+#endif  // #ifndef _PACING_H_
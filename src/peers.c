@@ -0,0 +1,438 @@
+/*
+    peers.c
+
+    Server list replication between peer masters for dpmaster
+
+    Copyright (C) 2026  The ravenmaster contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "common.h"
+#include "system.h"
+
+#include "games.h"
+#include "peers.h"
+#include "servers.h"
+
+
+// ---------- Constants ---------- //
+
+// Maximum size of a "peerSync" packet
+#define MAX_PEERSYNC_SIZE 1400
+
+// Maximum size of an entry in a "peerSync" packet
+#define MAX_PEERSYNC_ENTRY_SIZE (2 + 16 + 2 + GAMENAME_LENGTH)
+
+// Size of the header of a "peerSync" packet, before its authentication code
+#define PEERSYNC_HEADER_SIZE (4 + sizeof (M2M_PEERSYNC) - 1)
+
+
+// ---------- Private types ---------- //
+
+typedef struct
+{
+    const char* addr_name;
+    struct sockaddr_storage address;
+    socklen_t addrlen;
+} peer_t;
+
+
+// ---------- Private variables ---------- //
+
+static peer_t peers [MAX_PEERS];
+static unsigned int nb_peers = 0;
+
+// Key of the authentication codes, derived from the secret shared by the peers
+static unsigned int peer_key [2];
+static qboolean peer_key_set = false;
+
+// The pending changes, ready to be sent to the peers
+static qbyte sync_packet [MAX_PEERSYNC_SIZE];
+static size_t sync_packet_size = 0;     // 0 = no pending change
+static unsigned int sync_nb_entries = 0;
+static time_t next_sync_time = 0;
+
+
+// ---------- Private functions ---------- //
+
+/*
+====================
+Peer_ComputeMac
+
+Compute the authentication code of some data (HalfSipHash-2-4 with a 64-bit
+output). The data is read as little-endian words, so that the peers agree
+on the code whatever their byte order
+====================
+*/
+static void Peer_ComputeMac (const unsigned int key [2], const qbyte* data, size_t size,
+                             qbyte mac [PEER_MAC_SIZE])
+{
+    unsigned int v [4];
+    unsigned int word;
+    size_t pos, ind;
+
+    v[0] = key[0];
+    v[1] = key[1] ^ 0xEE;
+    v[2] = 0x6C796765U ^ key[0];
+    v[3] = 0x74656462U ^ key[1];
+
+    for (pos = 0; pos + 4 <= size; pos += 4)
+    {
+        word = (unsigned int)data[pos] | ((unsigned int)data[pos + 1] << 8) |
+               ((unsigned int)data[pos + 2] << 16) | ((unsigned int)data[pos + 3] << 24);
+        v[3] ^= word;
+        Com_HalfSipRounds (v, 2);
+        v[0] ^= word;
+    }
+
+    // The last block contains the remaining bytes and the data size
+    word = (unsigned int)size << 24;
+    for (ind = pos; ind < size; ind++)
+        word |= (unsigned int)data[ind] << (8 * (ind - pos));
+    v[3] ^= word;
+    Com_HalfSipRounds (v, 2);
+    v[0] ^= word;
+
+    v[2] ^= 0xEE;
+    for (pos = 0; pos < PEER_MAC_SIZE; pos += 4)
+    {
+        Com_HalfSipRounds (v, 4);
+        word = v[1] ^ v[3];
+        for (ind = 0; ind < 4; ind++)
+            mac[pos + ind] = (qbyte)(word >> (8 * ind));
+        v[1] ^= 0xDD;
+    }
+}
+
+
+/*
+====================
+Peer_SendPendingChanges
+
+Send the pending changes to all the peers
+====================
+*/
+static void Peer_SendPendingChanges (void)
+{
+    unsigned int peer_ind;
+
+    if (sync_nb_entries == 0)
+        return;
+
+    Peer_ComputeMac (peer_key, &sync_packet[PEERSYNC_HEADER_SIZE + PEER_MAC_SIZE],
+                     sync_packet_size - (PEERSYNC_HEADER_SIZE + PEER_MAC_SIZE),
+                     &sync_packet[PEERSYNC_HEADER_SIZE]);
+
+    for (peer_ind = 0; peer_ind < nb_peers; peer_ind++)
+    {
+        const peer_t* peer = &peers[peer_ind];
+        socket_t sock = Sys_GetListenSocket (peer->address.ss_family);
+        const char* peer_name = Sys_SockaddrToString (&peer->address, peer->addrlen);
+
+        if (sock == INVALID_SOCKET)
+        {
+            Com_Printf (MSG_WARNING,
+                        "> WARNING: can't send peerSync to %s (no socket for this address family)\n",
+                        peer_name);
+            continue;
+        }
+
+        if (sendto (sock, (void*)sync_packet, sync_packet_size, 0,
+                    (const struct sockaddr*)&peer->address, peer->addrlen) < 0)
+            Com_Printf (MSG_WARNING, "> WARNING: can't send peerSync to %s (%s)\n",
+                        peer_name, Sys_GetLastNetErrorString ());
+        else
+            Com_Printf (MSG_NORMAL, "> %s <--- peerSync (%u changes)\n",
+                        peer_name, sync_nb_entries);
+    }
+
+    sync_packet_size = 0;
+    sync_nb_entries = 0;
+    next_sync_time = 0;
+}
+
+
+/*
+====================
+Peer_QueueEntry
+
+Add an entry to the pending changes
+====================
+*/
+static void Peer_QueueEntry (const server_t* server, qbyte entry_type)
+{
+    qbyte entry [MAX_PEERSYNC_ENTRY_SIZE];
+    size_t entry_size;
+
+    if (nb_peers == 0)
+        return;
+
+    entry[0] = entry_type;
+    if (server->user.address.ss_family == AF_INET)
+    {
+        const struct sockaddr_in* addr4 = (const struct sockaddr_in*)&server->user.address;
+
+        entry[1] = PEER_ENTRY_IPV4;
+        memcpy (&entry[2], &addr4->sin_addr.s_addr, 4);
+        memcpy (&entry[6], &addr4->sin_port, 2);
+        entry_size = 8;
+    }
+    else
+    {
+        const struct sockaddr_in6* addr6 = (const struct sockaddr_in6*)&server->user.address;
+
+        assert (server->user.address.ss_family == AF_INET6);
+
+        entry[1] = PEER_ENTRY_IPV6;
+        memcpy (&entry[2], &addr6->sin6_addr.s6_addr, 16);
+        memcpy (&entry[18], &addr6->sin6_port, 2);
+        entry_size = 20;
+    }
+
+    if (entry_type == PEER_ENTRY_ADD)
+    {
+        const char* anon_name = "";
+        size_t name_size;
+
+        if (server->anon_properties != NULL)
+            anon_name = server->anon_properties->name;
+        name_size = strlen (anon_name) + 1;
+        assert (name_size <= GAMENAME_LENGTH);
+
+        memcpy (&entry[entry_size], anon_name, name_size);
+        entry_size += name_size;
+    }
+
+    // If the packet doesn't have enough free space for this entry, send it now
+    if (sync_packet_size + entry_size > sizeof (sync_packet))
+        Peer_SendPendingChanges ();
+
+    // Start a new packet if necessary. Its authentication code
+    // will be computed when it will be sent
+    if (sync_packet_size == 0)
+    {
+        memcpy (sync_packet, "\xFF\xFF\xFF\xFF" M2M_PEERSYNC, PEERSYNC_HEADER_SIZE);
+        sync_packet_size = PEERSYNC_HEADER_SIZE + PEER_MAC_SIZE;
+        next_sync_time = crt_time + PEER_SYNC_DELAY;
+    }
+
+    memcpy (&sync_packet[sync_packet_size], entry, entry_size);
+    sync_packet_size += entry_size;
+    sync_nb_entries++;
+}
+
+
+// ---------- Public functions ---------- //
+
+/*
+====================
+Peer_Declare
+
+Step 1 - Add a peer master to the peer list
+====================
+*/
+qboolean Peer_Declare (const char* addr_name)
+{
+    if (nb_peers >= MAX_PEERS)
+    {
+        Com_Printf (MSG_ERROR, "> ERROR: too many peers (max: %d)\n", MAX_PEERS);
+        return false;
+    }
+
+    memset (&peers[nb_peers], 0, sizeof (peers[nb_peers]));
+    peers[nb_peers].addr_name = addr_name;
+    nb_peers++;
+
+    return true;
+}
+
+
+/*
+====================
+Peer_SetSecret
+
+Step 1 - Set the secret shared by the peer masters
+====================
+*/
+qboolean Peer_SetSecret (const char* secret)
+{
+    static const unsigned int null_key [2] = { 0, 0 };
+    qbyte digest [PEER_MAC_SIZE];
+    unsigned int word_ind;
+
+    if (secret[0] == '\0')
+        return false;
+
+    // Any secret gives a key of the right size
+    Peer_ComputeMac (null_key, (const qbyte*)secret, strlen (secret), digest);
+    for (word_ind = 0; word_ind < 2; word_ind++)
+    {
+        const qbyte* bytes = &digest[word_ind * 4];
+
+        peer_key[word_ind] = (unsigned int)bytes[0] | ((unsigned int)bytes[1] << 8) |
+                             ((unsigned int)bytes[2] << 16) | ((unsigned int)bytes[3] << 24);
+    }
+    peer_key_set = true;
+
+    return true;
+}
+
+
+/*
+====================
+Peer_ResolveAddresses
+
+Step 2 - Resolve the addresses of all the peers
+====================
+*/
+qboolean Peer_ResolveAddresses (const char* default_port)
+{
+    unsigned int peer_ind;
+
+    // Without a shared secret, anyone could forge the peers' messages
+    if (nb_peers > 0 && ! peer_key_set)
+    {
+        Com_Printf (MSG_ERROR,
+                    "> ERROR: the peer masters need a shared secret (option \"--peer-secret\")\n");
+        return false;
+    }
+
+    for (peer_ind = 0; peer_ind < nb_peers; peer_ind++)
+    {
+        peer_t* peer = &peers[peer_ind];
+
+        if (! Sys_ResolveAddress (peer->addr_name, default_port,
+                                  &peer->address, &peer->addrlen))
+            return false;
+
+        Com_Printf (MSG_NORMAL, "> Peer master: %s (%s)\n", peer->addr_name,
+                    Sys_SockaddrToString (&peer->address, peer->addrlen));
+    }
+
+    return true;
+}
+
+
+/*
+====================
+Peer_IsPeer
+
+Return "true" if this address is the one of a peer master
+====================
+*/
+qboolean Peer_IsPeer (const struct sockaddr_storage* address, socklen_t addrlen)
+{
+    unsigned int peer_ind;
+
+    for (peer_ind = 0; peer_ind < nb_peers; peer_ind++)
+    {
+        const peer_t* peer = &peers[peer_ind];
+        qboolean same_public_address;
+
+        if (peer->address.ss_family != address->ss_family || peer->addrlen != addrlen)
+            continue;
+
+        if (address->ss_family == AF_INET)
+        {
+            if (Com_SameIPv4Addr (&peer->address, address, &same_public_address))
+                return true;
+        }
+        else if (Com_SameIPv6Addr (&peer->address, address, &same_public_address))
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+====================
+Peer_IsAuthentic
+
+Return "true" if a peerSync message (after its header) has been
+authenticated with the secret shared by the peers
+====================
+*/
+qboolean Peer_IsAuthentic (const qbyte* msg, size_t length)
+{
+    qbyte mac [PEER_MAC_SIZE];
+    qbyte diff = 0;
+    unsigned int ind;
+
+    if (! peer_key_set || length < PEER_MAC_SIZE)
+        return false;
+
+    Peer_ComputeMac (peer_key, msg + PEER_MAC_SIZE, length - PEER_MAC_SIZE, mac);
+
+    // Don't tell how many bytes of the code are right by the time it takes to check it
+    for (ind = 0; ind < PEER_MAC_SIZE; ind++)
+        diff |= mac[ind] ^ msg[ind];
+    return (diff == 0);
+}
+
+
+/*
+====================
+Peer_QueueAddition
+
+Tell the peers that a server has been (re)validated by an infoResponse
+====================
+*/
+void Peer_QueueAddition (const server_t* server)
+{
+    Peer_QueueEntry (server, PEER_ENTRY_ADD);
+}
+
+
+/*
+====================
+Peer_QueueRemoval
+
+Tell the peers that a server has been removed from the list
+====================
+*/
+void Peer_QueueRemoval (const server_t* server)
+{
+    Peer_QueueEntry (server, PEER_ENTRY_REMOVE);
+}
+
+
+/*
+====================
+Peer_Update
+
+Send the pending changes to the peers if the sync delay has elapsed
+====================
+*/
+void Peer_Update (void)
+{
+    if (next_sync_time != 0 && next_sync_time <= crt_time)
+        Peer_SendPendingChanges ();
+}
+
+
+/*
+====================
+Peer_GetNextSyncTime
+
+Returns the time of the next transmission to the peers, or 0 if there's none
+====================
+*/
+time_t Peer_GetNextSyncTime (void)
+{
+    return next_sync_time;
+}
@@ -0,0 +1,94 @@
+/*
+    peers.h
+
+    Server list replication between peer masters for dpmaster
+
+    Copyright (C) 2026  The ravenmaster contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef _PEERS_H_
+#define _PEERS_H_
+
+
+// ---------- Constants ---------- //
+
+// The maximum number of peer masters
+#define MAX_PEERS 8
+
+// Delay between a change in the server list and its transmission to the peers,
+// so that several changes can be sent in the same packet (in seconds)
+#define PEER_SYNC_DELAY 1
+
+// M2M: "peerSync\x0A...(8 bytes)...+4...(6 bytes)...\0-6...(18 bytes)..."
+#define M2M_PEERSYNC "peerSync\x0A"
+
+// Size of the authentication code of a "peerSync" message
+#define PEER_MAC_SIZE 8
+
+// Format of a "peerSync" message (after its header):
+// - the authentication code of the entries (PEER_MAC_SIZE bytes): their
+//   HalfSipHash-2-4 with a 64-bit output, keyed with the secret shared by
+//   the peers, the words being read and written in little-endian order
+// - a list of entries, each made of:
+//   - the entry type: PEER_ENTRY_ADD or PEER_ENTRY_REMOVE (1 byte)
+//   - the address family: PEER_ENTRY_IPV4 or PEER_ENTRY_IPV6 (1 byte)
+//   - the IP address (4 or 16 bytes) and the port (2 bytes), in network order
+//   - for PEER_ENTRY_ADD only, the name of the game if the server uses
+//     an anonymous protocol, or "" otherwise, '\0'-terminated
+#define PEER_ENTRY_ADD      '+'
+#define PEER_ENTRY_REMOVE   '-'
+#define PEER_ENTRY_IPV4     '4'
+#define PEER_ENTRY_IPV6     '6'
+
+
+// ---------- Public functions ---------- //
+
+struct server_s;    // Defined in servers.h
+
+// Step 1 - Add a peer master to the peer list
+qboolean Peer_Declare (const char* addr_name);
+
+// Step 1 - Set the secret shared by the peer masters
+qboolean Peer_SetSecret (const char* secret);
+
+// Step 2 - Resolve the addresses of all the peers. Must be called
+// before the security initializations, since DNS requests may fail
+// from the chroot jail
+qboolean Peer_ResolveAddresses (const char* default_port);
+
+// Return "true" if this address is the one of a peer master
+qboolean Peer_IsPeer (const struct sockaddr_storage* address, socklen_t addrlen);
+
+// Return "true" if a peerSync message (after its header) has been
+// authenticated with the secret shared by the peers
+qboolean Peer_IsAuthentic (const qbyte* msg, size_t length);
+
+// Tell the peers that a server has been (re)validated by an infoResponse
+void Peer_QueueAddition (const struct server_s* server);
+
+// Tell the peers that a server has been removed from the list
+void Peer_QueueRemoval (const struct server_s* server);
+
+// Send the pending changes to the peers if the sync delay has elapsed
+void Peer_Update (void);
+
+// Returns the time of the next transmission to the peers, or 0 if there's none
+time_t Peer_GetNextSyncTime (void);
+
+
+#endif  // #ifndef _PEERS_H_
@@ -23,6 +23,8 @@
 
 #include "common.h"
 #include "system.h"
+#include "games.h"
+#include "peers.h"
 #include "servers.h"
 
 
@@ -31,31 +33,113 @@
 // Timeout for a newly added server (in seconds)
 #define TIMEOUT_HEARTBEAT   2
 
+// Number of server slots checked per main loop iteration after a game configuration reload
+#define REVALIDATION_BATCH_SIZE 256
+
+// Initial number of slots in a game shard
+#define SHARD_MIN_SLOTS 16
+
+// Period after which the servers of a view are shuffled again, in seconds
+#define VIEW_SHUFFLE_PERIOD 60
+
+// Number of changes remembered by each game shard (must be a power of 2)
+#define SHARD_CHANGE_LOG_SIZE 256
+
+// Registry snapshot file format. All numbers are big-endian. The file is a
+// fixed-size header followed by fixed-size records, one per verified server:
+//   header: magic (8 bytes), version, record size, number of records,
+//           checksum of the records (FNV-1a), save time, reserved (4 bytes each)
+//   record: see the SNAPREC_* offsets below
+#define SNAPSHOT_MAGIC          "DPMSNAP"
+#define SNAPSHOT_VERSION        1
+#define SNAPSHOT_HEADER_SIZE    32
+#define SNAPSHOT_RECORD_SIZE    192
+
+#define SNAPREC_FAMILY          0       // 4 or 6 (1 byte)
+#define SNAPREC_STATE           1       // server_state_t (1 byte)
+#define SNAPREC_PORT            2       // 2 bytes
+#define SNAPREC_ADDRESS         4       // 16 bytes (only 4 used for IPv4)
+#define SNAPREC_SCOPE_ID        20
+#define SNAPREC_PROTOCOL        24
+#define SNAPREC_TIMEOUT         28
+#define SNAPREC_GAMETYPE        32      // GAMETYPE_LENGTH bytes
+#define SNAPREC_GAMENAME        64      // GAMENAME_LENGTH bytes
+#define SNAPREC_ANON_GAMENAME   128     // GAMENAME_LENGTH bytes ("" if none)
+
+
+// ---------- Private types ---------- //
+
+// A game shard: the indexes of all the servers of a given game, packed
+// in an array so that queries only look at the servers they may return.
+// The queries read it through its current view, rebuilt when it's outdated
+typedef struct
+{
+    char* gamename;
+    unsigned int hash;
+    int next;                   // next shard in the same bucket, or next free shard
+    int* slots;
+    unsigned int nb_servers;
+    unsigned int max_servers;
+    sv_view_t* view;            // NULL if not built yet
+    qboolean view_outdated;     // if the servers have changed since the view was built
+    time_t next_timeout;        // none of its servers times out before this date
+
+    // Epoch of its last change, and a circular log of the last changes. All
+    // the changes more recent than "log_start" are in the log, if there's one
+    unsigned int epoch;
+    sv_change_t* changes;       // NULL if it couldn't be allocated
+    unsigned int first_change;
+    unsigned int nb_changes;
+    unsigned int log_start;
+} sv_shard_t;
+
 
 // ---------- Private variables ---------- //
 
 // All server structures are allocated in one block in the "servers" array.
-// Each used slot is also part of a linked list in "hash_table". A simple
-// hash of the address of a server gives its index in the table.
+// The index of each used slot is in "addr_table", where the servers are
+// looked up by address.
 static server_t* servers = NULL;
 static unsigned int max_nb_servers = DEFAULT_MAX_NB_SERVERS;
 static unsigned int nb_servers = 0;
-static user_hash_table_t hash_table;
-static size_t sv_hash_size = DEFAULT_SV_HASH_SIZE;
+static addr_table_t addr_table;
 
+// First of the registered servers for each public address (IPv4 address,
+// or IPv6 /64 subnet), for the address quota. They are linked in a ring
+static addr_table_t quota_table;
 static unsigned int max_per_address = DEFAULT_MAX_NB_SERVERS_PER_ADDRESS;
 
+// Game shards, and their hash table (there can't be more shards than servers).
+// If a shard can't grow, the views are built from the whole server list from then on
+static sv_shard_t* shards = NULL;
+static int* shard_buckets = NULL;
+static unsigned int shard_mask = 0;
+static int first_free_shard = -1;
+static qboolean shards_incomplete = false;
+
 // Used to speed up the server allocation / deallocation process
 static int last_used_slot = -1;  // -1 = no used slot
 static int first_free_slot = 0;  // -1 = no more room
 
-// Variables for Sv_GetFirst, Sv_GetNext and Sv_Remove
-static int crt_server_ind = -1;
-static int last_server_ind = -1;
+// Epoch of the last change of the registry, and identifier of the registry
+static unsigned int last_epoch = 0;
+static unsigned int registry_id = 0;
+
+// Position of the last reader in its view, as a fraction of the view size
+static unsigned int view_start_phase = 0;
 
 // List of address mappings. They are sorted by "from" field (IP, then port)
 static addrmap_t* addrmaps = NULL;
 
+// Registry snapshot
+static const char* snapshot_filepath = NULL;
+static FILE* snapshot_file = NULL;
+static unsigned int snapshot_period = DEFAULT_SNAPSHOT_PERIOD;
+static time_t next_snapshot_time = 0;
+
+// Next server slot to check after a game configuration reload (-1 = none)
+static int revalidation_ind = -1;
+
 
 // ---------- Public variables ---------- //
 
@@ -67,48 +151,336 @@ qboolean allow_loopback = false;
 
 /*
 ====================
-Sv_Remove
+Sv_HashGamename
 
-Remove a server from the lists
+Compute the hash of a game name (32-bit FNV-1a)
 ====================
 */
-static void Sv_Remove (server_t* sv)
+static unsigned int Sv_HashGamename (const char* gamename)
 {
-    int sv_ind;
+    unsigned int hash = 2166136261U;
 
-    Com_UserHashTable_Remove (&sv->user);
+    while (*gamename != '\0')
+    {
+        hash ^= (qbyte)*gamename++;
+        hash = (hash * 16777619U) & 0xFFFFFFFF;
+    }
 
-    // Mark this structure as "free"
-    sv->state = sv_state_unused_slot;
+    return hash;
+}
 
-    // Update first_free_slot if necessary
-    sv_ind = (int)(sv - servers);
-    assert (sv_ind >= 0);
-    assert (sv_ind <= last_used_slot);
-    if (first_free_slot == -1 || sv_ind < first_free_slot)
-        first_free_slot = sv_ind;
 
-    // If it was the last used slot, look for the previous one
-    if (last_used_slot == sv_ind)
-        do
+/*
+====================
+Sv_FindShard
+
+Return the index of the shard of a game, or -1 if there's none
+====================
+*/
+static int Sv_FindShard (const char* gamename, unsigned int hash)
+{
+    int shard_ind;
+
+    for (shard_ind = shard_buckets[hash & shard_mask];
+         shard_ind != -1;
+         shard_ind = shards[shard_ind].next)
+    {
+        const sv_shard_t* shard = &shards[shard_ind];
+
+        if (shard->hash == hash && strcmp (shard->gamename, gamename) == 0)
+            return shard_ind;
+    }
+
+    return -1;
+}
+
+
+/*
+====================
+Sv_UnrefView
+
+Drop a reference to a view, and free it if it was the last one
+====================
+*/
+static void Sv_UnrefView (sv_view_t* view)
+{
+    assert (view->refcount > 0);
+
+    view->refcount--;
+    if (view->refcount == 0)
+        free (view);
+}
+
+
+/*
+====================
+Sv_ReleaseShard
+
+Release an empty shard
+====================
+*/
+static void Sv_ReleaseShard (int shard_ind)
+{
+    sv_shard_t* shard = &shards[shard_ind];
+    int* link;
+
+    assert (shard->nb_servers == 0);
+
+    link = &shard_buckets[shard->hash & shard_mask];
+    while (*link != shard_ind)
+        link = &shards[*link].next;
+    *link = shard->next;
+
+    // The readers still holding its view keep it alive
+    if (shard->view != NULL)
+        Sv_UnrefView (shard->view);
+
+    free (shard->gamename);
+    free (shard->slots);
+    free (shard->changes);
+    memset (shard, 0, sizeof (*shard));
+    shard->next = first_free_shard;
+    first_free_shard = shard_ind;
+}
+
+
+/*
+====================
+Sv_BuildViewEntry
+
+Copy what the queries need to know about a server into a view entry
+====================
+*/
+static void Sv_BuildViewEntry (const server_t* sv, sv_view_entry_t* entry)
+{
+    entry->protocol = sv->protocol;
+    entry->state = sv->state;
+    memcpy (entry->gametype, sv->gametype, sizeof (entry->gametype));
+
+    if (sv->user.address.ss_family == AF_INET)
+    {
+        const struct sockaddr_in* addr4 = (const struct sockaddr_in*)&sv->user.address;
+        const struct in_addr* ip = &addr4->sin_addr;
+        unsigned short port = addr4->sin_port;
+
+        // Use the address mapping associated with the server, if any
+        if (sv->addrmap != NULL)
         {
-            last_used_slot--;
-        } while (last_used_slot >= 0 && servers[last_used_slot].state == sv_state_unused_slot);
+            ip = &sv->addrmap->to.sin_addr;
+            if (sv->addrmap->to.sin_port != 0)
+                port = sv->addrmap->to.sin_port;
+        }
+
+        entry->family = AF_INET;
+        memcpy (entry->address, &ip->s_addr, 4);
+        entry->port = ntohs (port);
+    }
+    else
+    {
+        const struct sockaddr_in6* addr6 = (const struct sockaddr_in6*)&sv->user.address;
 
-    // If we have removed the end of the server iteration, set it to the new end of the list
-    if (last_server_ind > last_used_slot)
-        last_server_ind = last_used_slot;
+        assert (sv->user.address.ss_family == AF_INET6);
 
-    // Same thing for the current iteration value
-    if (crt_server_ind > last_used_slot)
-        crt_server_ind = last_used_slot;
+        entry->family = AF_INET6;
+        memcpy (entry->address, &addr6->sin6_addr.s6_addr, 16);
+        entry->port = ntohs (addr6->sin6_port);
+    }
+}
 
-    nb_servers--;
-    Com_Printf (MSG_NORMAL,
-                "> %s timed out; %u server(s) currently registered\n",
-                Sys_SockaddrToString(&sv->user.address, sv->user.addrlen), nb_servers);
 
-    assert (last_used_slot >= (int)nb_servers - 1);
+/*
+====================
+Sv_LogChange
+
+Record a change of a server in the log of its shard
+====================
+*/
+static void Sv_LogChange (sv_shard_t* shard, const server_t* sv, qboolean removed)
+{
+    sv_change_t* change;
+    unsigned int ind;
+
+    shard->epoch = ++last_epoch;
+    shard->view_outdated = true;
+
+    if (shard->changes == NULL)
+    {
+        shard->log_start = shard->epoch;
+        return;
+    }
+
+    // If the log is full, forget the oldest change
+    if (shard->nb_changes == SHARD_CHANGE_LOG_SIZE)
+    {
+        change = &shard->changes[shard->first_change];
+        if (change->epoch != 0)
+            shard->log_start = change->epoch;
+        shard->first_change = (shard->first_change + 1) & (SHARD_CHANGE_LOG_SIZE - 1);
+        shard->nb_changes--;
+    }
+
+    change = &shard->changes[(shard->first_change + shard->nb_changes) & (SHARD_CHANGE_LOG_SIZE - 1)];
+    change->epoch = shard->epoch;
+    change->removed = removed;
+    Sv_BuildViewEntry (sv, &change->server);
+    shard->nb_changes++;
+
+    // Only the last change of each server is worth sending
+    for (ind = 0; ind < shard->nb_changes - 1; ind++)
+    {
+        sv_change_t* prev_change = &shard->changes[(shard->first_change + ind) & (SHARD_CHANGE_LOG_SIZE - 1)];
+
+        if (prev_change->epoch != 0 &&
+            prev_change->server.family == change->server.family &&
+            prev_change->server.port == change->server.port &&
+            memcmp (prev_change->server.address, change->server.address,
+                    change->server.family == AF_INET ? 4 : 16) == 0)
+            prev_change->epoch = 0;
+    }
+}
+
+
+/*
+====================
+Sv_LeaveShard
+
+Remove a server from the shard of its game
+====================
+*/
+static void Sv_LeaveShard (server_t* sv)
+{
+    sv_shard_t* shard;
+    int shard_ind = sv->shard;
+    int last_ind;
+
+    if (shard_ind == -1)
+        return;
+    sv->shard = -1;
+
+    shard = &shards[shard_ind];
+    assert (shard->slots[sv->shard_pos] == (int)(sv - servers));
+    shard->nb_servers--;
+    if (shard->nb_servers == 0)
+    {
+        // The lists of this game given to the clients can't be the base
+        // of the changes anymore, since the log is released with the shard
+        if (sv->state > sv_state_uninitialized)
+            last_epoch++;
+        Sv_ReleaseShard (shard_ind);
+        return;
+    }
+
+    // Move the last server of the shard to the free position
+    last_ind = shard->slots[shard->nb_servers];
+    shard->slots[sv->shard_pos] = last_ind;
+    servers[last_ind].shard_pos = sv->shard_pos;
+
+    // The servers that haven't been validated yet weren't in the views
+    if (sv->state > sv_state_uninitialized)
+        Sv_LogChange (shard, sv, true);
+    else
+        shard->view_outdated = true;
+}
+
+
+/*
+====================
+Sv_JoinShard
+
+Add a server to the shard of its game, creating it if necessary
+====================
+*/
+static qboolean Sv_JoinShard (server_t* sv)
+{
+    sv_shard_t* shard;
+    unsigned int hash;
+    int shard_ind;
+
+    assert (sv->shard == -1);
+    if (sv->gamename[0] == '\0')
+        return true;
+
+    hash = Sv_HashGamename (sv->gamename);
+    shard_ind = Sv_FindShard (sv->gamename, hash);
+    if (shard_ind == -1)
+    {
+        // The server isn't part of any shard yet, so there's a free one
+        assert (first_free_shard != -1);
+        shard_ind = first_free_shard;
+        shard = &shards[shard_ind];
+
+        shard->gamename = strdup (sv->gamename);
+        if (shard->gamename == NULL)
+            return false;
+        first_free_shard = shard->next;
+
+        shard->hash = hash;
+        shard->next = shard_buckets[hash & shard_mask];
+        shard_buckets[hash & shard_mask] = shard_ind;
+
+        // Without a log, the queries will simply get full lists. The log
+        // starts with a new epoch, so the lists given to the clients before
+        // (maybe by a previous shard of the same game) are sent in full
+        shard->changes = malloc (SHARD_CHANGE_LOG_SIZE * sizeof (shard->changes[0]));
+        shard->epoch = ++last_epoch;
+        shard->log_start = shard->epoch;
+    }
+    else
+        shard = &shards[shard_ind];
+
+    // Make room for this server
+    if (shard->nb_servers == shard->max_servers)
+    {
+        unsigned int new_max_servers = (shard->max_servers == 0 ? SHARD_MIN_SLOTS : shard->max_servers * 2);
+        int* new_slots = realloc (shard->slots, new_max_servers * sizeof (new_slots[0]));
+
+        if (new_slots == NULL)
+        {
+            // Release the shard if we've just created it
+            if (shard->nb_servers == 0)
+                Sv_ReleaseShard (shard_ind);
+            return false;
+        }
+
+        shard->slots = new_slots;
+        shard->max_servers = new_max_servers;
+    }
+
+    sv->shard = shard_ind;
+    sv->shard_pos = shard->nb_servers;
+    shard->slots[shard->nb_servers++] = (int)(sv - servers);
+    shard->view_outdated = true;
+
+    return true;
+}
+
+
+/*
+====================
+Sv_SetGamename
+
+Set the game name of a server, and move it to the shard of its game
+====================
+*/
+static void Sv_SetGamename (server_t* sv, const char* gamename)
+{
+    if (sv->shard != -1 && strcmp (sv->gamename, gamename) == 0)
+        return;
+
+    Sv_LeaveShard (sv);
+
+    strncpy (sv->gamename, gamename, sizeof (sv->gamename) - 1);
+    sv->gamename[sizeof (sv->gamename) - 1] = '\0';
+
+    if (! Sv_JoinShard (sv) && ! shards_incomplete)
+    {
+        Com_Printf (MSG_ERROR,
+                    "> ERROR: can't add server %s to the shard of game \"%s\" (%s). "
+                    "The server lists will now be built from all the servers\n",
+                    Sys_SockaddrToString (&sv->user.address, sv->user.addrlen),
+                    sv->gamename, strerror (errno));
+        shards_incomplete = true;
+    }
 }
 
 
@@ -136,6 +508,9 @@ static qboolean Sv_IsActive (unsigned int sv_ind)
     if (sv->timeout < crt_time)
     {
         Sv_Remove (sv);
+        Com_Printf (MSG_NORMAL,
+                    "> %s timed out; %u server(s) currently registered\n",
+                    Sys_SockaddrToString(&sv->user.address, sv->user.addrlen), nb_servers);
         return false;
     }
 
@@ -150,56 +525,19 @@ Sv_GetByAddr_Internal
 Search for a particular server in the list
 ====================
 */
-static server_t* Sv_GetByAddr_Internal (const struct sockaddr_storage* address, unsigned int* same_address_found)
+static server_t* Sv_GetByAddr_Internal (const struct sockaddr_storage* address)
 {
-    unsigned int hash = Com_AddressHash (address, sv_hash_size);
-    server_t* sv;
-    qboolean (*IsSameAddress) (const struct sockaddr_storage* addr1, const struct sockaddr_storage* addr2, qboolean* same_public_address);
-
-    if (address->ss_family == AF_INET6)
-        IsSameAddress = &Com_SameIPv6Addr;
-    else
-    {
-        assert (address->ss_family == AF_INET);
-        IsSameAddress = &Com_SameIPv4Addr;
-    }
-    sv = (server_t*)hash_table.entries[hash];
-
-    *same_address_found = 0;
-    while (sv != NULL)
-    {
-        server_t* next_sv = (server_t*)sv->user.next;
-        unsigned int sv_ind = (unsigned int)(sv - servers);
+    addr_key_t key;
+    const int* sv_ind;
 
-        if (Sv_IsActive (sv_ind))
-        {
-            const struct sockaddr_storage* sv_address = &sv->user.address;
-            if (address->ss_family == sv_address->ss_family)
-            {
-                // Same address?
-                qboolean same_public_address;
-                qboolean same_address;
-
-                same_public_address = false;
-                same_address = IsSameAddress (sv_address, address, &same_public_address);
-                if (same_public_address)
-                    *same_address_found += 1;
-                if (same_address)
-                {
-                    // Move it on top of the list (it's useful because heartbeats
-                    // are almost always followed by infoResponses)
-                    Com_UserHashTable_Remove (&sv->user);
-                    Com_UserHashTable_Add (&hash_table, &sv->user, hash);
-
-                    return sv;
-                }
-            }
-        }
+    Com_MakeAddrKey (address, false, &key);
+    sv_ind = Com_AddrTable_Find (&addr_table, &key);
 
-        sv = next_sv;
-    }
+    // Sv_IsActive removes the server if it has timed out
+    if (sv_ind == NULL || ! Sv_IsActive ((unsigned int)*sv_ind))
+        return NULL;
 
-    return NULL;
+    return &servers[*sv_ind];
 }
 
 
@@ -219,6 +557,153 @@ static void Sv_CheckTimeouts (void)
 }
 
 
+/*
+====================
+Sv_CheckAddressTimeouts
+
+Remove the servers sharing a public address that have timed out
+====================
+*/
+static void Sv_CheckAddressTimeouts (int first_ind)
+{
+    unsigned int nb_servers_left = servers[first_ind].nb_same_address;
+    int sv_ind = first_ind;
+
+    // Removing a server unlinks it from the ring, but its neighbours stay linked
+    while (nb_servers_left > 0)
+    {
+        int next_ind = servers[sv_ind].next_same_address;
+
+        Sv_IsActive ((unsigned int)sv_ind);
+        sv_ind = next_ind;
+        nb_servers_left--;
+    }
+}
+
+
+/*
+====================
+Sv_CheckShardTimeouts
+
+Remove the servers of a shard that have timed out
+====================
+*/
+static void Sv_CheckShardTimeouts (int shard_ind)
+{
+    sv_shard_t* shard = &shards[shard_ind];
+    time_t next_timeout = 0;
+    unsigned int pos;
+
+    // Removing a server moves the last one to its position,
+    // so we go backward to check each server exactly once
+    for (pos = shard->nb_servers; pos > 0; pos--)
+    {
+        unsigned int sv_ind = (unsigned int)shard->slots[pos - 1];
+
+        if (Sv_IsActive (sv_ind) &&
+            (next_timeout == 0 || servers[sv_ind].timeout < next_timeout))
+            next_timeout = servers[sv_ind].timeout;
+    }
+
+    // The shard has been released if all its servers have timed out
+    if (shard->nb_servers > 0)
+        shard->next_timeout = next_timeout;
+}
+
+
+/*
+====================
+Sv_BuildView
+
+Build a view of the servers of a game, from its shard if it's available.
+The servers are shuffled, so that the clients don't always get them in the
+same order, and don't all contact the same servers first
+====================
+*/
+static sv_view_t* Sv_BuildView (sv_shard_t* shard, const char* gamename)
+{
+    sv_view_t* view;
+    sv_change_t* changes;
+    unsigned int max_entries, max_changes, nb_candidates, ind;
+    time_t next_timeout = 0;
+
+    max_entries = (shard != NULL ? shard->nb_servers : nb_servers);
+    max_changes = (shard != NULL ? shard->nb_changes : 0);
+    view = malloc (sizeof (*view) + max_entries * sizeof (view->servers[0]) +
+                   max_changes * sizeof (view->changes[0]));
+    if (view == NULL)
+    {
+        Com_Printf (MSG_ERROR,
+                    "> ERROR: can't allocate the server list of game \"%s\" (%s)\n",
+                    gamename, strerror (errno));
+        return NULL;
+    }
+    view->refcount = 1;
+    view->shuffle_time = crt_time;
+    view->nb_servers = 0;
+    view->servers = (sv_view_entry_t*)(view + 1);
+
+    // Copy the changes still worth sending
+    changes = (sv_change_t*)(view->servers + max_entries);
+    view->nb_changes = 0;
+    view->changes = changes;
+    if (shard != NULL)
+    {
+        view->epoch = shard->epoch;
+        view->changes_since = shard->log_start;
+
+        for (ind = 0; ind < max_changes; ind++)
+        {
+            const sv_change_t* change = &shard->changes[(shard->first_change + ind) & (SHARD_CHANGE_LOG_SIZE - 1)];
+
+            if (change->epoch != 0)
+                changes[view->nb_changes++] = *change;
+        }
+    }
+
+    // The servers that aren't in a shard aren't logged
+    else
+    {
+        view->epoch = last_epoch;
+        view->changes_since = last_epoch + 1;
+    }
+
+    nb_candidates = (shard != NULL ? shard->nb_servers : (unsigned int)(last_used_slot + 1));
+    for (ind = 0; ind < nb_candidates; ind++)
+    {
+        const server_t* sv;
+
+        if (shard != NULL)
+            sv = &servers[shard->slots[ind]];
+        else
+        {
+            sv = &servers[ind];
+            if (sv->state == sv_state_unused_slot || strcmp (sv->gamename, gamename) != 0)
+                continue;
+        }
+
+        if (next_timeout == 0 || sv->timeout < next_timeout)
+            next_timeout = sv->timeout;
+
+        // Insert it at a random position (inside-out Fisher-Yates shuffle)
+        if (sv->state > sv_state_uninitialized && sv->timeout >= crt_time)
+        {
+            unsigned int pos = (unsigned int)rand () % (view->nb_servers + 1);
+
+            assert (view->nb_servers < max_entries);
+            view->servers[view->nb_servers] = view->servers[pos];
+            Sv_BuildViewEntry (sv, &view->servers[pos]);
+            view->nb_servers++;
+        }
+    }
+
+    if (shard != NULL)
+        shard->next_timeout = next_timeout;
+
+    return view;
+}
+
+
 /*
 ====================
 Sv_ResolveIPv4Addr
@@ -420,59 +905,348 @@ static qboolean Sv_ResolveAddrmap (addrmap_t* addrmap)
 }
 
 
-// ---------- Public functions (servers) ---------- //
-
 /*
 ====================
-Sv_SetHashSize
+Sv_WriteUInt32
 
-Set a new hash size value
+Write a 32-bit big-endian number into a buffer
 ====================
 */
-qboolean Sv_SetHashSize (unsigned int size)
+static void Sv_WriteUInt32 (qbyte* buffer, unsigned int value)
 {
-    // Too late? Or too big?
-    if (servers != NULL || size > MAX_HASH_SIZE)
-        return false;
-
-    sv_hash_size = size;
-    return true;
+    buffer[0] = (qbyte)(value >> 24);
+    buffer[1] = (qbyte)(value >> 16);
+    buffer[2] = (qbyte)(value >> 8);
+    buffer[3] = (qbyte)value;
 }
 
 
 /*
 ====================
-Sv_SetMaxNbServers
+Sv_ReadUInt32
 
-Set a new maximum number of servers
+Read a 32-bit big-endian number from a buffer
 ====================
 */
-qboolean Sv_SetMaxNbServers (unsigned int nb)
+static unsigned int Sv_ReadUInt32 (const qbyte* buffer)
 {
-    // Too late? Or too small?
-    if (servers != NULL || nb <= 0)
-        return false;
-
-    max_nb_servers = nb;
-    return true;
+    return ((unsigned int)buffer[0] << 24) | ((unsigned int)buffer[1] << 16) |
+           ((unsigned int)buffer[2] << 8) | (unsigned int)buffer[3];
 }
 
 
 /*
 ====================
-Sv_SetMaxNbServersPerAddress
+Sv_SnapshotChecksum
 
-Set a new maximum number of servers for one given IP address
+Update the checksum of the snapshot records (32-bit FNV-1a)
 ====================
 */
-qboolean Sv_SetMaxNbServersPerAddress (unsigned int nb)
+static unsigned int Sv_SnapshotChecksum (unsigned int checksum, const qbyte* data, size_t size)
 {
-    // Too late?
-    if (servers != NULL)
-        return false;
+    size_t ind;
 
-    max_per_address = nb;
-    return true;
+    for (ind = 0; ind < size; ind++)
+    {
+        checksum ^= data[ind];
+        checksum = (checksum * 16777619U) & 0xFFFFFFFF;
+    }
+
+    return checksum;
+}
+
+
+/*
+====================
+Sv_BuildSnapshotHeader
+
+Build the header of the snapshot file
+====================
+*/
+static void Sv_BuildSnapshotHeader (qbyte* header, unsigned int nb_records, unsigned int checksum)
+{
+    memset (header, 0, SNAPSHOT_HEADER_SIZE);
+    memcpy (header, SNAPSHOT_MAGIC, sizeof (SNAPSHOT_MAGIC));
+    Sv_WriteUInt32 (header + 8, SNAPSHOT_VERSION);
+    Sv_WriteUInt32 (header + 12, SNAPSHOT_RECORD_SIZE);
+    Sv_WriteUInt32 (header + 16, nb_records);
+    Sv_WriteUInt32 (header + 20, checksum);
+    Sv_WriteUInt32 (header + 24, (unsigned int)crt_time);
+}
+
+
+/*
+====================
+Sv_BuildSnapshotRecord
+
+Build the snapshot record of a server
+====================
+*/
+static void Sv_BuildSnapshotRecord (const server_t* sv, qbyte* record)
+{
+    memset (record, 0, SNAPSHOT_RECORD_SIZE);
+
+    if (sv->user.address.ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6* addr6 = (const struct sockaddr_in6*)&sv->user.address;
+
+        record[SNAPREC_FAMILY] = 6;
+        memcpy (&record[SNAPREC_PORT], &addr6->sin6_port, 2);
+        memcpy (&record[SNAPREC_ADDRESS], &addr6->sin6_addr.s6_addr, 16);
+        Sv_WriteUInt32 (&record[SNAPREC_SCOPE_ID], addr6->sin6_scope_id);
+    }
+    else
+    {
+        const struct sockaddr_in* addr4 = (const struct sockaddr_in*)&sv->user.address;
+
+        assert (sv->user.address.ss_family == AF_INET);
+
+        record[SNAPREC_FAMILY] = 4;
+        memcpy (&record[SNAPREC_PORT], &addr4->sin_port, 2);
+        memcpy (&record[SNAPREC_ADDRESS], &addr4->sin_addr.s_addr, 4);
+    }
+
+    record[SNAPREC_STATE] = (qbyte)sv->state;
+    Sv_WriteUInt32 (&record[SNAPREC_PROTOCOL], (unsigned int)sv->protocol);
+    Sv_WriteUInt32 (&record[SNAPREC_TIMEOUT], (unsigned int)sv->timeout);
+    memcpy (&record[SNAPREC_GAMETYPE], sv->gametype, GAMETYPE_LENGTH);
+    memcpy (&record[SNAPREC_GAMENAME], sv->gamename, GAMENAME_LENGTH);
+    if (sv->anon_properties != NULL)
+        strncpy ((char*)&record[SNAPREC_ANON_GAMENAME], sv->anon_properties->name, GAMENAME_LENGTH - 1);
+}
+
+
+/*
+====================
+Sv_LoadSnapshotRecord
+
+Register the server described by a snapshot record. Returns true if it has been added
+====================
+*/
+static qboolean Sv_LoadSnapshotRecord (qbyte* record)
+{
+    struct sockaddr_storage address;
+    socklen_t addrlen;
+    server_t* sv;
+    server_state_t state;
+    time_t timeout;
+    const char* anon_name;
+
+    // Make sure the strings are terminated, whatever the file contains
+    record[SNAPREC_GAMETYPE + GAMETYPE_LENGTH - 1] = '\0';
+    record[SNAPREC_GAMENAME + GAMENAME_LENGTH - 1] = '\0';
+    record[SNAPREC_ANON_GAMENAME + GAMENAME_LENGTH - 1] = '\0';
+
+    state = (server_state_t)record[SNAPREC_STATE];
+    timeout = (time_t)Sv_ReadUInt32 (&record[SNAPREC_TIMEOUT]);
+    if (state < sv_state_empty || state > sv_state_full ||
+        timeout < crt_time || record[SNAPREC_GAMENAME] == '\0')
+        return false;
+
+    memset (&address, 0, sizeof (address));
+    if (record[SNAPREC_FAMILY] == 6)
+    {
+        struct sockaddr_in6* addr6 = (struct sockaddr_in6*)&address;
+
+        addr6->sin6_family = AF_INET6;
+        memcpy (&addr6->sin6_port, &record[SNAPREC_PORT], 2);
+        memcpy (&addr6->sin6_addr.s6_addr, &record[SNAPREC_ADDRESS], 16);
+        addr6->sin6_scope_id = Sv_ReadUInt32 (&record[SNAPREC_SCOPE_ID]);
+        addrlen = sizeof (*addr6);
+    }
+    else if (record[SNAPREC_FAMILY] == 4)
+    {
+        struct sockaddr_in* addr4 = (struct sockaddr_in*)&address;
+
+        addr4->sin_family = AF_INET;
+        memcpy (&addr4->sin_port, &record[SNAPREC_PORT], 2);
+        memcpy (&addr4->sin_addr.s_addr, &record[SNAPREC_ADDRESS], 4);
+        addrlen = sizeof (*addr4);
+    }
+    else
+        return false;
+
+    // The game policy may have changed since the snapshot was saved
+    if (! Game_IsAccepted ((const char*)&record[SNAPREC_GAMENAME]))
+        return false;
+
+    strncpy (peer_address, Sys_SockaddrToString (&address, addrlen), sizeof (peer_address));
+    peer_address[sizeof (peer_address) - 1] = '\0';
+
+    sv = Sv_GetByAddr (&address, addrlen, true);
+    if (sv == NULL)
+        return false;
+
+    anon_name = (const char*)&record[SNAPREC_ANON_GAMENAME];
+    Sv_SetInfo (sv, (const char*)&record[SNAPREC_GAMENAME],
+                (int)Sv_ReadUInt32 (&record[SNAPREC_PROTOCOL]),
+                (const char*)&record[SNAPREC_GAMETYPE], state,
+                anon_name[0] != '\0' ? Game_GetPropertiesByName (anon_name) : NULL);
+    sv->hb_properties = sv->anon_properties;
+    sv->timeout = timeout;
+
+    return true;
+}
+
+
+/*
+====================
+Sv_LoadSnapshot
+
+Load the registry snapshot, if it's valid
+====================
+*/
+static void Sv_LoadSnapshot (void)
+{
+    qbyte header [SNAPSHOT_HEADER_SIZE];
+    qbyte* records;
+    unsigned int nb_records, record_ind, nb_loaded;
+    size_t records_size;
+
+    rewind (snapshot_file);
+    if (fread (header, sizeof (header), 1, snapshot_file) != 1)
+    {
+        Com_Printf (MSG_NORMAL, "> The registry snapshot is empty\n");
+        return;
+    }
+
+    if (memcmp (header, SNAPSHOT_MAGIC, sizeof (SNAPSHOT_MAGIC)) != 0 ||
+        Sv_ReadUInt32 (header + 8) != SNAPSHOT_VERSION ||
+        Sv_ReadUInt32 (header + 12) != SNAPSHOT_RECORD_SIZE)
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: ignoring the registry snapshot (unknown format or version)\n");
+        return;
+    }
+
+    nb_records = Sv_ReadUInt32 (header + 16);
+    if (nb_records == 0)
+        return;
+    if (nb_records > max_nb_servers * 2)
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: ignoring the registry snapshot (too many records: %u)\n",
+                    nb_records);
+        return;
+    }
+
+    records_size = (size_t)nb_records * SNAPSHOT_RECORD_SIZE;
+    records = malloc (records_size);
+    if (records == NULL)
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: can't allocate memory for loading the registry snapshot\n");
+        return;
+    }
+
+    if (fread (records, records_size, 1, snapshot_file) != 1 ||
+        Sv_SnapshotChecksum (2166136261U, records, records_size) != Sv_ReadUInt32 (header + 20))
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: ignoring the registry snapshot (truncated or corrupted)\n");
+        free (records);
+        return;
+    }
+
+    nb_loaded = 0;
+    for (record_ind = 0; record_ind < nb_records; record_ind++)
+        if (Sv_LoadSnapshotRecord (&records[record_ind * SNAPSHOT_RECORD_SIZE]))
+            nb_loaded++;
+
+    free (records);
+
+    Com_Printf (MSG_NORMAL,
+                "> %u server(s) loaded from the registry snapshot (saved %u seconds ago)\n",
+                nb_loaded, (unsigned int)(crt_time - (time_t)Sv_ReadUInt32 (header + 24)));
+}
+
+
+/*
+====================
+Sv_WriteSnapshot
+
+Write the registry snapshot to the snapshot file
+====================
+*/
+static qboolean Sv_WriteSnapshot (unsigned int* nb_records)
+{
+    qbyte header [SNAPSHOT_HEADER_SIZE];
+    qbyte record [SNAPSHOT_RECORD_SIZE];
+    unsigned int checksum = 2166136261U;
+    int ind;
+
+    *nb_records = 0;
+
+    // Invalidate the snapshot (no record) while we're writing it, so a
+    // partially written file is never loaded
+    Sv_BuildSnapshotHeader (header, 0, checksum);
+    rewind (snapshot_file);
+    if (fwrite (header, sizeof (header), 1, snapshot_file) != 1)
+        return false;
+
+    for (ind = 0; ind <= last_used_slot; ind++)
+    {
+        // Only save the servers we have verified
+        if (! Sv_IsActive (ind) || servers[ind].state <= sv_state_uninitialized ||
+            servers[ind].origin == sv_origin_upstream)
+            continue;
+
+        Sv_BuildSnapshotRecord (&servers[ind], record);
+        if (fwrite (record, sizeof (record), 1, snapshot_file) != 1)
+            return false;
+
+        checksum = Sv_SnapshotChecksum (checksum, record, sizeof (record));
+        *nb_records += 1;
+    }
+    if (fflush (snapshot_file) != 0)
+        return false;
+
+    // Now that all records are written, validate the snapshot
+    Sv_BuildSnapshotHeader (header, *nb_records, checksum);
+    rewind (snapshot_file);
+    if (fwrite (header, sizeof (header), 1, snapshot_file) != 1 ||
+        fflush (snapshot_file) != 0)
+        return false;
+
+    return true;
+}
+
+
+// ---------- Public functions (servers) ---------- //
+
+/*
+====================
+Sv_SetMaxNbServers
+
+Set a new maximum number of servers
+====================
+*/
+qboolean Sv_SetMaxNbServers (unsigned int nb)
+{
+    // Too late? Or too small?
+    if (servers != NULL || nb <= 0)
+        return false;
+
+    max_nb_servers = nb;
+    return true;
+}
+
+
+/*
+====================
+Sv_SetMaxNbServersPerAddress
+
+Set a new maximum number of servers for one given IP address
+====================
+*/
+qboolean Sv_SetMaxNbServersPerAddress (unsigned int nb)
+{
+    // Too late?
+    if (servers != NULL)
+        return false;
+
+    max_per_address = nb;
+    return true;
 }
 
 
@@ -486,6 +1260,7 @@ Initialize the server list and hash tables
 qboolean Sv_Init (void)
 {
     size_t array_size;
+    unsigned int ind;
 
     // Allocate "servers" and clean it
     array_size = max_nb_servers * sizeof (servers[0]);
@@ -506,9 +1281,38 @@ qboolean Sv_Init (void)
     else
         Com_Printf (MSG_NORMAL, "%u)\n", max_per_address);
 
-    if (! Com_UserHashTable_Init (&hash_table, sv_hash_size, "server"))
+    if (! Com_AddrTable_Init (&addr_table, max_nb_servers, "server") ||
+        ! Com_AddrTable_Init (&quota_table, max_nb_servers, "server quota"))
         return false;
 
+    // Allocate the game shards, all free
+    shards = calloc (max_nb_servers, sizeof (shards[0]));
+    for (shard_mask = 16 - 1; shard_mask < max_nb_servers - 1; shard_mask = shard_mask * 2 + 1)
+        ;
+    shard_buckets = malloc ((shard_mask + 1) * sizeof (shard_buckets[0]));
+    if (shards == NULL || shard_buckets == NULL)
+    {
+        Com_Printf (MSG_ERROR,
+                    "> ERROR: can't allocate the game shards (%s)\n",
+                    strerror (errno));
+        return false;
+    }
+    for (ind = 0; ind < max_nb_servers; ind++)
+        shards[ind].next = (int)ind + 1;
+    shards[max_nb_servers - 1].next = -1;
+    first_free_shard = 0;
+    for (ind = 0; ind <= shard_mask; ind++)
+        shard_buckets[ind] = -1;
+
+    registry_id = (unsigned int)crt_time ^ (unsigned int)rand ();
+
+    if (snapshot_file != NULL)
+    {
+        Sv_LoadSnapshot ();
+        if (snapshot_period > 0)
+            next_snapshot_time = crt_time + snapshot_period;
+    }
+
     return true;
 }
 
@@ -522,13 +1326,15 @@ Search for a particular server in the list; add it if necessary
 */
 server_t* Sv_GetByAddr (const struct sockaddr_storage* address, socklen_t addrlen, qboolean add_it)
 {
-    unsigned int nb_same_address = 0;
+    unsigned int nb_same_address;
     server_t *sv;
     const addrmap_t* addrmap = NULL;
-    unsigned int hash;
+    addr_key_t key, quota_key;
+    int* sv_ind_ptr;
+    int* quota_ptr;
     unsigned int ind;
 
-    sv = Sv_GetByAddr_Internal (address, &nb_same_address);
+    sv = Sv_GetByAddr_Internal (address);
     if (sv != NULL)
     {
         assert (addrlen == sv->user.addrlen);
@@ -538,6 +1344,19 @@ server_t* Sv_GetByAddr (const struct sockaddr_storage* address, socklen_t addrle
     if (! add_it)
         return NULL;
 
+    Com_MakeAddrKey (address, true, &quota_key);
+    quota_ptr = Com_AddrTable_Find (&quota_table, &quota_key);
+    nb_same_address = (quota_ptr != NULL ? servers[*quota_ptr].nb_same_address : 0);
+
+    // Some of the servers counted may have timed out already
+    if (nb_same_address >= max_per_address && max_per_address != 0)
+    {
+        Sv_CheckAddressTimeouts (*quota_ptr);
+
+        quota_ptr = Com_AddrTable_Find (&quota_table, &quota_key);
+        nb_same_address = (quota_ptr != NULL ? servers[*quota_ptr].nb_same_address : 0);
+    }
+
     assert (nb_same_address <= max_per_address || max_per_address == 0);
     if (nb_same_address >= max_per_address && max_per_address != 0)
     {
@@ -625,10 +1444,38 @@ server_t* Sv_GetByAddr (const struct sockaddr_storage* address, socklen_t addrle
     memcpy (&sv->user.address, address, sizeof (sv->user.address));
     sv->user.addrlen = addrlen;
     sv->addrmap = addrmap;
+    sv->shard = -1;
+
+    // Add it to the address table, and count it in the address quota.
+    // Both tables are big enough for all the servers
+    Com_MakeAddrKey (address, false, &key);
+    sv_ind_ptr = Com_AddrTable_Insert (&addr_table, &key);
+    assert (sv_ind_ptr != NULL);
+    *sv_ind_ptr = (int)(sv - servers);
+
+    quota_ptr = Com_AddrTable_Find (&quota_table, &quota_key);
+    if (quota_ptr == NULL)
+    {
+        quota_ptr = Com_AddrTable_Insert (&quota_table, &quota_key);
+        assert (quota_ptr != NULL);
+        *quota_ptr = *sv_ind_ptr;
 
-    // Add it to the list it belongs to
-    hash = Com_AddressHash (address, sv_hash_size);
-    Com_UserHashTable_Add (&hash_table, &sv->user, hash);
+        sv->prev_same_address = *sv_ind_ptr;
+        sv->next_same_address = *sv_ind_ptr;
+        sv->nb_same_address = 1;
+    }
+    else
+    {
+        server_t* first = &servers[*quota_ptr];
+
+        // Insert it at the end of the ring
+        sv->prev_same_address = first->prev_same_address;
+        sv->next_same_address = *quota_ptr;
+        servers[first->prev_same_address].next_same_address = *sv_ind_ptr;
+        first->prev_same_address = *sv_ind_ptr;
+        first->nb_same_address++;
+    }
+    nb_same_address = servers[*quota_ptr].nb_same_address;
 
     sv->state = sv_state_uninitialized;
     sv->timeout = crt_time + TIMEOUT_HEARTBEAT;
@@ -637,11 +1484,8 @@ server_t* Sv_GetByAddr (const struct sockaddr_storage* address, socklen_t addrle
 
     Com_Printf (MSG_NORMAL,
                 "> New server added: %s. %u server(s) now registered, including %u for this address quota\n",
-                peer_address, nb_servers, nb_same_address + 1);
-    Com_Printf (MSG_DEBUG,
-                "  - index: %u\n"
-                "  - hash: 0x%04X\n",
-                (unsigned int)(sv - servers), hash);
+                peer_address, nb_servers, nb_same_address);
+    Com_Printf (MSG_DEBUG, "  - index: %u\n", (unsigned int)(sv - servers));
 
     return sv;
 }
@@ -649,57 +1493,237 @@ server_t* Sv_GetByAddr (const struct sockaddr_storage* address, socklen_t addrle
 
 /*
 ====================
-Sv_GetFirst
+Sv_Remove
 
-Get the first server in the list
+Remove a server from the lists
 ====================
 */
-server_t* Sv_GetFirst (void)
+void Sv_Remove (server_t* sv)
 {
-    if (nb_servers <= 0)
-        return NULL;
+    addr_key_t key;
+    int* first_ind;
+    int sv_ind;
 
-    // Pick the start of the iteration at random
-    crt_server_ind = rand () % (last_used_slot + 1);
+    // Only the servers we've validated ourselves are propagated to the peers
+    if (sv->origin == sv_origin_heartbeat && sv->state > sv_state_uninitialized)
+        Peer_QueueRemoval (sv);
 
-    // Set the end of the iteration
-    if (crt_server_ind == 0)
-        last_server_ind = last_used_slot;
+    Com_MakeAddrKey (&sv->user.address, false, &key);
+    Com_AddrTable_Remove (&addr_table, &key);
+
+    // Unlink it from the ring of the servers sharing its public address
+    sv_ind = (int)(sv - servers);
+    Com_MakeAddrKey (&sv->user.address, true, &key);
+    first_ind = Com_AddrTable_Find (&quota_table, &key);
+    assert (first_ind != NULL && servers[*first_ind].nb_same_address > 0);
+    if (servers[*first_ind].nb_same_address == 1)
+    {
+        assert (*first_ind == sv_ind);
+        Com_AddrTable_Remove (&quota_table, &key);
+    }
     else
-        last_server_ind = crt_server_ind - 1;
+    {
+        servers[sv->prev_same_address].next_same_address = sv->next_same_address;
+        servers[sv->next_same_address].prev_same_address = sv->prev_same_address;
 
-    // If this first server is active, returns it
-    if (Sv_IsActive(crt_server_ind))
-        return &servers[crt_server_ind];
+        // If it was the first one, the next one takes its place
+        if (*first_ind == sv_ind)
+        {
+            servers[sv->next_same_address].nb_same_address = sv->nb_same_address;
+            *first_ind = sv->next_same_address;
+        }
+        servers[*first_ind].nb_same_address--;
+    }
 
-    // Else, go on with the iteration
-    return Sv_GetNext ();
+    Sv_LeaveShard (sv);
+
+    // Mark this structure as "free"
+    sv->state = sv_state_unused_slot;
+
+    // Update first_free_slot if necessary
+    assert (sv_ind >= 0);
+    assert (sv_ind <= last_used_slot);
+    if (first_free_slot == -1 || sv_ind < first_free_slot)
+        first_free_slot = sv_ind;
+
+    // If it was the last used slot, look for the previous one
+    if (last_used_slot == sv_ind)
+        do
+        {
+            last_used_slot--;
+        } while (last_used_slot >= 0 && servers[last_used_slot].state == sv_state_unused_slot);
+
+    nb_servers--;
+
+    assert (last_used_slot >= (int)nb_servers - 1);
 }
 
 
 /*
 ====================
-Sv_GetNext
+Sv_Browse
 
-Get the next server in the list
+Get the next registered server
 ====================
 */
-server_t* Sv_GetNext (void)
+server_t* Sv_Browse (int* position)
 {
-    assert(last_used_slot >= -1);
-    assert(last_used_slot < (int)max_nb_servers);
+    assert (*position >= -1);
 
-    while (crt_server_ind != last_server_ind)
+    for ((*position)++; *position <= last_used_slot; (*position)++)
     {
-        crt_server_ind = (crt_server_ind + 1) % (last_used_slot + 1);
-        if (Sv_IsActive(crt_server_ind))
-            return &servers[crt_server_ind];
+        server_t* sv = &servers[*position];
+
+        if (sv->state != sv_state_unused_slot && sv->timeout >= crt_time)
+            return sv;
     }
 
     return NULL;
 }
 
 
+/*
+====================
+Sv_GetView
+
+Get the current view of the servers of a game
+====================
+*/
+const sv_view_t* Sv_GetView (const char* gamename)
+{
+    sv_shard_t* shard;
+    int shard_ind;
+
+    if (shards_incomplete)
+        return Sv_BuildView (NULL, gamename);
+
+    shard_ind = Sv_FindShard (gamename, Sv_HashGamename (gamename));
+    if (shard_ind == -1)
+        return NULL;
+    shard = &shards[shard_ind];
+
+    if (shard->next_timeout < crt_time)
+    {
+        Sv_CheckShardTimeouts (shard_ind);
+        if (shard->nb_servers == 0)
+            return NULL;
+    }
+
+    if (shard->view == NULL || shard->view_outdated ||
+        shard->view->shuffle_time + VIEW_SHUFFLE_PERIOD <= crt_time)
+    {
+        sv_view_t* view = Sv_BuildView (shard, gamename);
+
+        if (view == NULL)
+            return NULL;
+
+        if (shard->view != NULL)
+            Sv_UnrefView (shard->view);
+        shard->view = view;
+        shard->view_outdated = false;
+    }
+
+    shard->view->refcount++;
+    return shard->view;
+}
+
+
+/*
+====================
+Sv_GetViewStart
+
+Get the position where a new reader should start reading a view. The
+successive positions are spread evenly over the view (golden ratio)
+====================
+*/
+unsigned int Sv_GetViewStart (const sv_view_t* view)
+{
+    view_start_phase += 0x9E3779B9;
+
+    if (view->nb_servers <= 0xFFFF)
+        return ((view_start_phase >> 16) * view->nb_servers) >> 16;
+    return view_start_phase % view->nb_servers;
+}
+
+
+/*
+====================
+Sv_ReleaseView
+
+Release a view obtained from Sv_GetView
+====================
+*/
+void Sv_ReleaseView (const sv_view_t* view)
+{
+    if (view != NULL)
+        Sv_UnrefView ((sv_view_t*)view);
+}
+
+
+/*
+====================
+Sv_GetRegistryId
+
+Get the identifier of the registry
+====================
+*/
+unsigned int Sv_GetRegistryId (void)
+{
+    return registry_id;
+}
+
+
+/*
+====================
+Sv_GetAnonymousGame
+
+Get the game name of a registered server using a given protocol
+and allowing anonymous queries, or NULL if there's none
+====================
+*/
+const char* Sv_GetAnonymousGame (int protocol)
+{
+    int position = -1;
+    const server_t* sv;
+
+    while ((sv = Sv_Browse (&position)) != NULL)
+        if (sv->state > sv_state_uninitialized && sv->protocol == protocol &&
+            sv->anon_properties != NULL)
+            return sv->gamename;
+
+    return NULL;
+}
+
+
+/*
+====================
+Sv_SetInfo
+
+Update the information that the server lists contain
+====================
+*/
+void Sv_SetInfo (server_t* sv, const char* gamename, int protocol, const char* gametype,
+                 server_state_t state, const struct game_properties_s* anon_properties)
+{
+    qboolean changed;
+
+    // A change of game name removes the server from the list of its previous game
+    changed = (sv->shard == -1 || strcmp (sv->gamename, gamename) != 0 ||
+               sv->protocol != protocol || sv->state != state ||
+               strcmp (sv->gametype, gametype) != 0);
+
+    Sv_SetGamename (sv, gamename);
+    sv->protocol = protocol;
+    sv->state = state;
+    strncpy (sv->gametype, gametype, sizeof (sv->gametype) - 1);
+    sv->gametype[sizeof (sv->gametype) - 1] = '\0';
+    sv->anon_properties = anon_properties;
+
+    if (changed && sv->shard != -1)
+        Sv_LogChange (&shards[sv->shard], sv, (state <= sv_state_uninitialized));
+}
+
+
 /*
 ====================
 Sv_PrintServerList
@@ -709,57 +1733,257 @@ Print the list of servers to the output
 */
 void Sv_PrintServerList (msg_level_t msg_level)
 {
-    int ind;
+    int position = -1;
+    const server_t* sv;
 
     Com_Printf (msg_level, "\n> %u servers registered (time: %lu):\n",
                 nb_servers, (unsigned long)crt_time);
 
-    for (ind = 0; ind <= last_used_slot; ind++)
-        if (Sv_IsActive(ind))
+    while ((sv = Sv_Browse (&position)) != NULL)
+    {
+        const char* state_string;
+
+        Com_Printf (msg_level, " * %s",
+                    Sys_SockaddrToString (&sv->user.address, sv->user.addrlen));
+        if (sv->addrmap != NULL)
+            Com_Printf (msg_level, ", mapped to %s",
+                        sv->addrmap->to_string);
+
+        assert(sv->state > sv_state_unused_slot);
+        assert(sv->state <= sv_state_full);
+        switch (sv->state)
         {
-            const server_t* sv = &servers[ind];
-            const char* state_string;
-
-            Com_Printf (msg_level, " * %s",
-                        Sys_SockaddrToString (&sv->user.address, sv->user.addrlen));
-            if (sv->addrmap != NULL)
-                Com_Printf (msg_level, ", mapped to %s",
-                            sv->addrmap->to_string);
-
-            assert(sv->state > sv_state_unused_slot);
-            assert(sv->state <= sv_state_full);
-            switch (sv->state)
-            {
-                case sv_state_unused_slot:
-                    state_string = "unused";
-                    break;
-                case sv_state_uninitialized:
-                    state_string = "not initialized";
-                    break;
-                case sv_state_empty:
-                    state_string = "empty";
-                    break;
-                case sv_state_occupied:
-                    state_string = "occupied";
-                    break;
-                case sv_state_full:
-                    state_string = "full";
-                    break;
-                default:
-                    state_string = "UNKNOWN";
-                    break;
-            }
+            case sv_state_unused_slot:
+                state_string = "unused";
+                break;
+            case sv_state_uninitialized:
+                state_string = "not initialized";
+                break;
+            case sv_state_empty:
+                state_string = "empty";
+                break;
+            case sv_state_occupied:
+                state_string = "occupied";
+                break;
+            case sv_state_full:
+                state_string = "full";
+                break;
+            default:
+                state_string = "UNKNOWN";
+                break;
+        }
+
+        Com_Printf (msg_level,
+                    " (timeout: %lu)\n"
+                    "\tgame: \"%s\" (protocol: %d, gametype: %s)\n"
+                    "\tstate: %s\n"
+                    "\tchallenge: \"%s\" (timeout: %lu)\n",
+                    (unsigned long)sv->timeout,
+                    sv->gamename, sv->protocol, sv->gametype,
+                    state_string,
+                    sv->challenge, (unsigned long)sv->challenge_timeout);
+    }
+}
 
-            Com_Printf (msg_level,
-                        " (timeout: %lu)\n"
-                        "\tgame: \"%s\" (protocol: %d, gametype: %s)\n"
-                        "\tstate: %s\n"
-                        "\tchallenge: \"%s\" (timeout: %lu)\n",
-                        (unsigned long)sv->timeout,
-                        sv->gamename, sv->protocol, sv->gametype,
-                        state_string,
-                        sv->challenge, (unsigned long)sv->challenge_timeout);
+
+// ---------- Public functions (registry snapshot) ---------- //
+
+/*
+====================
+Sv_SetSnapshotFile
+
+Set the path of the registry snapshot file
+====================
+*/
+qboolean Sv_SetSnapshotFile (const char* filepath)
+{
+    // Too late? Or invalid?
+    if (servers != NULL || filepath == NULL || filepath[0] == '\0')
+        return false;
+
+    snapshot_filepath = filepath;
+    return true;
+}
+
+
+/*
+====================
+Sv_SetSnapshotPeriod
+
+Set the period between 2 saves of the registry snapshot (0 = only when exiting)
+====================
+*/
+qboolean Sv_SetSnapshotPeriod (unsigned int period)
+{
+    // Too late?
+    if (servers != NULL)
+        return false;
+
+    snapshot_period = period;
+    return true;
+}
+
+
+/*
+====================
+Sv_OpenSnapshot
+
+Open the snapshot file, creating it if necessary
+====================
+*/
+qboolean Sv_OpenSnapshot (void)
+{
+    if (snapshot_filepath == NULL)
+        return true;
+
+    snapshot_file = fopen (snapshot_filepath, "r+b");
+    if (snapshot_file == NULL && errno == ENOENT)
+        snapshot_file = fopen (snapshot_filepath, "w+b");
+    if (snapshot_file == NULL)
+    {
+        Com_Printf (MSG_ERROR, "> ERROR: can't open registry snapshot file \"%s\" (%s)\n",
+                    snapshot_filepath, strerror (errno));
+        return false;
+    }
+
+    Com_Printf (MSG_NORMAL, "> Using registry snapshot file \"%s\"\n",
+                snapshot_filepath);
+    return true;
+}
+
+
+/*
+====================
+Sv_SaveSnapshot
+
+Save the registry snapshot now
+====================
+*/
+void Sv_SaveSnapshot (void)
+{
+    unsigned int nb_records;
+
+    if (snapshot_file == NULL)
+        return;
+
+    if (snapshot_period > 0)
+        next_snapshot_time = crt_time + snapshot_period;
+
+    if (Sv_WriteSnapshot (&nb_records))
+        Com_Printf (MSG_DEBUG, "> Registry snapshot saved (%u servers)\n",
+                    nb_records);
+    else
+    {
+        Com_Printf (MSG_WARNING, "> WARNING: can't save the registry snapshot (%s)\n",
+                    strerror (errno));
+        clearerr (snapshot_file);
+    }
+}
+
+
+/*
+====================
+Sv_UpdateSnapshot
+
+Save the registry snapshot if its period has elapsed
+====================
+*/
+void Sv_UpdateSnapshot (void)
+{
+    if (next_snapshot_time != 0 && next_snapshot_time <= crt_time)
+        Sv_SaveSnapshot ();
+}
+
+
+/*
+====================
+Sv_GetNextSnapshotTime
+
+Returns the time of the next periodic save, or 0 if there's none
+====================
+*/
+time_t Sv_GetNextSnapshotTime (void)
+{
+    return next_snapshot_time;
+}
+
+
+// ---------- Public functions (game configuration reload) ---------- //
+
+/*
+====================
+Sv_StartRevalidation
+
+Start checking all the servers against the new game tables
+====================
+*/
+void Sv_StartRevalidation (void)
+{
+    revalidation_ind = 0;
+}
+
+
+/*
+====================
+Sv_UpdateRevalidation
+
+Check the next batch of servers against the new game tables. Once they've
+all been checked, the previous game tables are released
+====================
+*/
+void Sv_UpdateRevalidation (void)
+{
+    unsigned int nb_checked;
+
+    if (revalidation_ind < 0)
+        return;
+
+    for (nb_checked = 0;
+         nb_checked < REVALIDATION_BATCH_SIZE && revalidation_ind <= last_used_slot;
+         nb_checked++, revalidation_ind++)
+    {
+        server_t* sv = &servers[revalidation_ind];
+
+        if (! Sv_IsActive (revalidation_ind))
+            continue;
+
+        // Servers without a game name yet will be checked by their infoResponse
+        if (sv->gamename[0] != '\0' && ! Game_IsAccepted (sv->gamename))
+        {
+            Sv_Remove (sv);
+            Com_Printf (MSG_NORMAL,
+                        "> %s removed (game \"%s\" is not accepted anymore); %u server(s) currently registered\n",
+                        Sys_SockaddrToString(&sv->user.address, sv->user.addrlen),
+                        sv->gamename, nb_servers);
+            continue;
         }
+
+        // Use the game properties from the new tables
+        if (sv->anon_properties != NULL)
+            sv->anon_properties = Game_GetPropertiesByName (sv->anon_properties->name);
+        if (sv->hb_properties != NULL)
+            sv->hb_properties = Game_GetPropertiesByName (sv->hb_properties->name);
+    }
+
+    if (revalidation_ind > last_used_slot)
+    {
+        revalidation_ind = -1;
+        Game_ReleasePreviousTables ();
+        Com_Printf (MSG_DEBUG, "> All servers checked against the new game configuration\n");
+    }
+}
+
+
+/*
+====================
+Sv_GetNextRevalidationTime
+
+Returns the current time if some servers still have to be checked, or 0 otherwise
+====================
+*/
+time_t Sv_GetNextRevalidationTime (void)
+{
+    return (revalidation_ind >= 0 ? crt_time : 0);
 }
 
 
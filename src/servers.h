@@ -33,9 +33,6 @@
 // Maximum number of servers for one given IP address by default
 #define DEFAULT_MAX_NB_SERVERS_PER_ADDRESS 32
 
-// Address hash size in bits for servers (between 0 and MAX_HASH_SIZE)
-#define DEFAULT_SV_HASH_SIZE 10
-
 // Number of characters in a challenge, including the '\0'
 #define CHALLENGE_MIN_LENGTH 9
 #define CHALLENGE_MAX_LENGTH 12
@@ -46,6 +43,9 @@
 // Max number of characters for a gametype, including the '\0'
 #define GAMETYPE_LENGTH 32
 
+// Default period between 2 saves of the registry snapshot, in seconds
+#define DEFAULT_SNAPSHOT_PERIOD 60
+
 
 // ---------- Types ---------- //
 
@@ -69,6 +69,14 @@ typedef enum
     sv_state_full,
 } server_state_t;
 
+// Where we've learned about a server
+typedef enum
+{
+    sv_origin_heartbeat,    // the server itself
+    sv_origin_peer,         // a peer master
+    sv_origin_upstream,     // an upstream master (never verified)
+} server_origin_t;
+
 // Server properties
 struct game_properties_s;       // Defined in games.h
 typedef struct server_s
@@ -79,13 +87,59 @@ typedef struct server_s
     const struct game_properties_s* hb_properties;      // future "anon_properties", not yet validated by an infoResponse
     time_t timeout;
     time_t challenge_timeout;
+    time_t verified_time;                               // time of the last valid infoResponse (0 = none)
+    time_t getinfo_time;                                // time of the deferred getinfo (0 = none)
+    qboolean getinfo_queued;                            // is it in the queue of the deferred getinfos?
     int protocol;
     server_state_t state;
+    server_origin_t origin;
+    int shard;                                          // shard of its game (-1 = none)
+    unsigned int shard_pos;                             // position in the shard
+    int prev_same_address;                              // ring of the servers sharing its public address
+    int next_same_address;
+    unsigned int nb_same_address;                       // size of this ring (only kept in its first server)
     char challenge [CHALLENGE_MAX_LENGTH];
     char gametype [GAMETYPE_LENGTH];
     char gamename [GAMENAME_LENGTH];
 } server_t;
 
+// A server, as seen by the queries
+typedef struct
+{
+    int family;                     // AF_INET or AF_INET6
+    qbyte address [16];             // mapped address, only 4 bytes used for IPv4
+    unsigned short port;            // mapped port
+    int protocol;
+    server_state_t state;
+    char gametype [GAMETYPE_LENGTH];
+} sv_view_entry_t;
+
+// A change of the servers of a game: a server that has been added or updated, or removed
+typedef struct
+{
+    unsigned int epoch;             // 0 if a later change of the same server replaces it
+    qboolean removed;
+    sv_view_entry_t server;
+} sv_change_t;
+
+// An immutable list of the servers of a game, for the queries. Each change to
+// these servers makes the registry build a new view, with a greater epoch,
+// but the previous one stays valid until all its readers have released it
+typedef struct
+{
+    unsigned int refcount;
+    unsigned int epoch;
+    time_t shuffle_time;            // when the servers have been shuffled
+    unsigned int nb_servers;
+    sv_view_entry_t* servers;       // in random order
+
+    // The last changes, oldest first. All the changes more recent than
+    // "changes_since" are there (it's greater than "epoch" if they aren't known)
+    unsigned int changes_since;
+    unsigned int nb_changes;
+    const sv_change_t* changes;
+} sv_view_t;
+
 
 // ---------- Public variables ---------- //
 
@@ -96,7 +150,6 @@ extern qboolean allow_loopback;
 // ---------- Public functions (servers) ---------- //
 
 // Will simply return "false" if called after Sv_Init
-qboolean Sv_SetHashSize (unsigned int size);
 qboolean Sv_SetMaxNbServers (unsigned int nb);
 qboolean Sv_SetMaxNbServersPerAddress (unsigned int nb);
 
@@ -104,19 +157,75 @@ qboolean Sv_SetMaxNbServersPerAddress (unsigned int nb);
 qboolean Sv_Init (void);
 
 // Search for a particular server in the list; add it if necessary
-// NOTE: doesn't change the current position for "Sv_GetNext"
 server_t* Sv_GetByAddr (const struct sockaddr_storage* address, socklen_t addrlen, qboolean add_it);
 
-// Get the first server in the list
-server_t* Sv_GetFirst (void);
+// Remove a server from the lists. It's immediately left out of the views, and
+// the delta lists tell the clients it's gone
+void Sv_Remove (server_t* sv);
+
+// Get the next registered server, or NULL if there's none. "*position" must
+// be set to -1 before the first call. Servers that have timed out are skipped
+server_t* Sv_Browse (int* position);
+
+// Get the current view of the servers of a game (NULL if there's none).
+// It must be released with Sv_ReleaseView once the caller is done with it
+const sv_view_t* Sv_GetView (const char* gamename);
+void Sv_ReleaseView (const sv_view_t* view);
 
-// Get the next server in the list
-server_t* Sv_GetNext (void);
+// Get the position where a reader should start browsing a view, and
+// wrap around, so that successive readers don't start with the same servers
+unsigned int Sv_GetViewStart (const sv_view_t* view);
+
+// Get the identifier of the registry. It changes each time dpmaster is
+// started, so that the epochs of a previous run can't be mistaken for ours
+unsigned int Sv_GetRegistryId (void);
+
+// Get the game name of a registered server using a given protocol
+// and allowing anonymous queries, or NULL if there's none
+const char* Sv_GetAnonymousGame (int protocol);
+
+// Update the information of a server that the views contain
+void Sv_SetInfo (server_t* sv, const char* gamename, int protocol, const char* gametype,
+                 server_state_t state, const struct game_properties_s* anon_properties);
 
 // Print the list of servers to the output
 void Sv_PrintServerList (msg_level_t msg_level);
 
 
+// ---------- Public functions (registry snapshot) ---------- //
+
+// Will simply return "false" if called after Sv_Init
+qboolean Sv_SetSnapshotFile (const char* filepath);
+qboolean Sv_SetSnapshotPeriod (unsigned int period);
+
+// Open the snapshot file. Must be called before the security initializations,
+// since the file may not be reachable from the chroot jail. The snapshot
+// itself is loaded by Sv_Init
+qboolean Sv_OpenSnapshot (void);
+
+// Save the registry snapshot now
+void Sv_SaveSnapshot (void);
+
+// Save the registry snapshot if its period has elapsed
+void Sv_UpdateSnapshot (void);
+
+// Returns the time of the next periodic save, or 0 if there's none
+time_t Sv_GetNextSnapshotTime (void);
+
+
+// ---------- Public functions (game configuration reload) ---------- //
+
+// Start checking all the servers against the new game tables
+void Sv_StartRevalidation (void);
+
+// Check the next batch of servers. When all servers have been
+// checked, the previous game tables are released
+void Sv_UpdateRevalidation (void);
+
+// Returns the current time if some servers still have to be checked, or 0 otherwise
+time_t Sv_GetNextRevalidationTime (void);
+
+
 // ---------- Public functions (address mappings) ---------- //
 
 // NOTE: this is a 2-step process because resolving address mappings directly
@@ -21,12 +21,90 @@
 */
 
 
+// recvmmsg() is a GNU extension
+#if defined(__linux__) && ! defined(_GNU_SOURCE)
+#   define _GNU_SOURCE
+#endif
+
 #include "common.h"
 #include "system.h"
 
+#ifdef __linux__
+#   include <netinet/udp.h>
+#   include <linux/filter.h>
+#   include <linux/sock_diag.h>
+#endif
+
+#ifdef WIN32
+#   include <ntsecapi.h>  // RtlGenRandom
+#else
+#   include <sys/stat.h>
+#endif
+
 
 // ---------- Constants ---------- //
 
+// Can we receive several packets with one system call?
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#   define SYS_USE_RECVMMSG
+#endif
+
+// Can the kernel split a buffer into several packets for us (UDP GSO)?
+#if defined(__linux__) && defined(UDP_SEGMENT)
+#   define SYS_USE_UDP_SEGMENT
+#endif
+
+// Can we drop the invalid packets in the kernel, before they reach us?
+#if defined(__linux__) && defined(SO_ATTACH_FILTER)
+#   define SYS_USE_SOCKET_FILTER
+#endif
+
+// Can we get the number of packets the kernel dropped on a socket?
+#if defined(__linux__) && defined(SO_MEMINFO)
+#   define SYS_USE_DROP_COUNTS
+#endif
+
+// Can the received packets tell how many packets the kernel dropped before them?
+#if defined(SYS_USE_RECVMMSG) && defined(SO_RXQ_OVFL)
+#   define SYS_USE_RXQ_OVFL
+#endif
+
+// Can several sockets listen on the same address, and can we choose which one gets a packet?
+#if defined(__linux__) && defined(SO_REUSEPORT) && defined(SO_ATTACH_REUSEPORT_CBPF)
+#   define SYS_USE_REUSEPORT
+#endif
+
+#ifdef SYS_USE_SOCKET_FILTER
+
+// The maximum number of message prefixes the socket filter can check
+#define MAX_FILTER_PREFIXES 16
+
+// The maximum number of instructions in the socket filter: the header
+// checks, 2 words per prefix, and the 2 return instructions
+#define MAX_FILTER_INSTRUCTIONS (4 + MAX_FILTER_PREFIXES * 4 + 2)
+
+// Offset of the UDP payload in the packets seen by the socket filter
+#define FILTER_PAYLOAD_OFFSET 8
+
+#endif
+
+#ifdef SYS_USE_REUSEPORT
+
+// The maximum number of sockets listening on the same address
+#define MAX_REUSEPORT_SOCKETS 8
+
+// The maximum number of instructions in the program steering the packets among them
+#define MAX_STEERING_INSTRUCTIONS 10
+
+#endif
+
+#ifdef SYS_USE_DROP_COUNTS
+
+// Period between 2 reports of the packets dropped by the kernel, in seconds
+#define DROP_REPORT_PERIOD 60
+
+#endif
+
 #ifndef WIN32
 
 // Default path we use for chroot
@@ -51,6 +129,59 @@ static const char* low_priv_user = DEFAULT_LOW_PRIV_USER;
 // File descriptor to /dev/null, used by the daemonization process
 static int null_device = -1;
 
+// Are we chrooted? (files can't be opened by their paths anymore)
+static qboolean chrooted = false;
+
+#endif
+
+#ifdef SYS_USE_RECVMMSG
+
+// Set to false if the kernel doesn't support recvmmsg()
+static qboolean recvmmsg_available = true;
+
+#endif
+
+#ifdef SYS_USE_UDP_SEGMENT
+
+// Set to false if the kernel or the network interfaces don't support UDP GSO
+static qboolean udp_segment_available = true;
+
+#endif
+
+#ifdef SYS_USE_SOCKET_FILTER
+
+// Should we attach a filter to the listening sockets?
+static qboolean use_socket_filter = false;
+
+#endif
+
+#ifdef SYS_USE_REUSEPORT
+
+// Number of sockets listening on each address
+static unsigned int nb_reuseport_sockets = 1;
+
+#endif
+
+// Sizes of the socket buffers (0 = system default)
+static unsigned int recv_buffer_size = 0;
+static unsigned int send_buffer_size = 0;
+
+#ifdef SYS_USE_RXQ_OVFL
+
+// Room for the drop counts attached to the received packets
+static union
+{
+    struct cmsghdr header;
+    char buffer [CMSG_SPACE (sizeof (unsigned int))];
+} recv_controls [MAX_RECV_BATCH];
+
+#endif
+
+#ifdef SYS_USE_DROP_COUNTS
+
+// Time of the next report of the packets dropped by the kernel
+static time_t next_drop_report = 0;
+
 #endif
 
 
@@ -97,6 +228,29 @@ const cmdlineopt_t sys_cmdline_options [] =
         1,
         1
     },
+#endif
+#ifdef SYS_USE_REUSEPORT
+    {
+        "reuseport",
+        "<nb_sockets>",
+        "Open <nb_sockets> sockets on each listening address, and give the\n"
+        "   packets to them according to their source address (default: 1, max: %d)",
+        { MAX_REUSEPORT_SOCKETS, 0 },
+        '\0',
+        1,
+        1
+    },
+#endif
+#ifdef SYS_USE_SOCKET_FILTER
+    {
+        "socket-filter",
+        NULL,
+        "Make the kernel drop the packets that can't be valid messages",
+        { 0, 0 },
+        '\0',
+        0,
+        0
+    },
 #endif
     {
         NULL,
@@ -153,6 +307,205 @@ static void Sys_CloseAllSockets (void)
 }
 
 
+#if defined(SYS_USE_SOCKET_FILTER) || defined(SYS_USE_REUSEPORT)
+
+/*
+====================
+Sys_AddBPFInstruction
+
+Append an instruction to a classic BPF program
+====================
+*/
+static void Sys_AddBPFInstruction (struct sock_filter* program, unsigned int* nb_insns,
+                                   unsigned short code, unsigned int k,
+                                   unsigned char jt, unsigned char jf)
+{
+    struct sock_filter* insn = &program[(*nb_insns)++];
+
+    insn->code = code;
+    insn->jt = jt;
+    insn->jf = jf;
+    insn->k = k;
+}
+
+#endif
+
+#ifdef SYS_USE_SOCKET_FILTER
+
+/*
+====================
+Sys_ReadFilterWord
+
+Read a 4-byte word of a message prefix, in network byte order like the socket filter loads
+====================
+*/
+static unsigned int Sys_ReadFilterWord (const char* str)
+{
+    const qbyte* bytes = (const qbyte*)str;
+
+    return ((unsigned int)bytes[0] << 24) | ((unsigned int)bytes[1] << 16) |
+           ((unsigned int)bytes[2] << 8) | (unsigned int)bytes[3];
+}
+
+
+/*
+====================
+Sys_BuildSocketFilter
+
+Build a classic BPF program dropping the packets which are too short, don't
+start with the out-of-band header, or whose command doesn't start with one of
+the prefixes. Only the first 8 characters of each prefix are checked. Returns
+the number of instructions, or 0 if the prefixes can't fit in the program
+====================
+*/
+static unsigned short Sys_BuildSocketFilter (const char* const* prefixes,
+                                             struct sock_filter* program)
+{
+    unsigned int nb_insns = 0;
+    unsigned int prefix_ind;
+    unsigned int drop_ind, insn_ind;
+
+    // Drop the packets too short to be valid messages. The jump
+    // offsets to the final "drop" instruction are fixed at the end
+    Sys_AddBPFInstruction (program, &nb_insns, BPF_LD | BPF_W | BPF_LEN, 0, 0, 0);
+    Sys_AddBPFInstruction (program, &nb_insns, BPF_JMP | BPF_JGE | BPF_K,
+                           FILTER_PAYLOAD_OFFSET + MIN_PACKET_SIZE_IN, 0, 0);
+
+    // Drop the packets without the out-of-band header
+    Sys_AddBPFInstruction (program, &nb_insns, BPF_LD | BPF_W | BPF_ABS, FILTER_PAYLOAD_OFFSET, 0, 0);
+    Sys_AddBPFInstruction (program, &nb_insns, BPF_JMP | BPF_JEQ | BPF_K, 0xFFFFFFFF, 0, 0);
+
+    // Accept the packet as soon as its command matches a prefix
+    for (prefix_ind = 0; prefixes[prefix_ind] != NULL; prefix_ind++)
+    {
+        const char* prefix = prefixes[prefix_ind];
+        unsigned int nb_words, word_ind, prev_ind;
+
+        nb_words = (unsigned int)strlen (prefix) / 4;
+        if (nb_words > 2)
+            nb_words = 2;
+
+        // A prefix shorter than a word would let everything through
+        if (nb_words == 0)
+            return 0;
+
+        // Skip the prefixes which look the same as a previous one to the filter
+        for (prev_ind = 0; prev_ind < prefix_ind; prev_ind++)
+            if (strlen (prefixes[prev_ind]) / 4 >= nb_words &&
+                strncmp (prefixes[prev_ind], prefix, nb_words * 4) == 0)
+                break;
+        if (prev_ind < prefix_ind)
+            continue;
+
+        if (nb_insns + nb_words * 2 + 2 > MAX_FILTER_INSTRUCTIONS)
+            return 0;
+
+        for (word_ind = 0; word_ind < nb_words; word_ind++)
+        {
+            // Number of instructions left in this prefix check after the jump
+            unsigned char nb_remaining = (unsigned char)((nb_words - word_ind - 1) * 2);
+
+            Sys_AddBPFInstruction (program, &nb_insns, BPF_LD | BPF_W | BPF_ABS,
+                                   FILTER_PAYLOAD_OFFSET + 4 + word_ind * 4, 0, 0);
+
+            // On the last word, a match jumps over the remaining prefixes
+            // to the "accept" instruction, which is fixed at the end too
+            Sys_AddBPFInstruction (program, &nb_insns, BPF_JMP | BPF_JEQ | BPF_K,
+                                   Sys_ReadFilterWord (prefix + word_ind * 4),
+                                   0, nb_remaining);
+        }
+    }
+
+    drop_ind = nb_insns;
+    Sys_AddBPFInstruction (program, &nb_insns, BPF_RET | BPF_K, 0, 0, 0);
+    Sys_AddBPFInstruction (program, &nb_insns, BPF_RET | BPF_K, 0xFFFFFFFF, 0, 0);
+
+    // Fix the jump offsets: the checks of the header drop the packet if they
+    // fail, and the last word of each prefix accepts it if it matches
+    program[1].jf = (unsigned char)(drop_ind - 2);
+    program[3].jf = (unsigned char)(drop_ind - 4);
+    for (insn_ind = 4; insn_ind < drop_ind; insn_ind += 2)
+    {
+        struct sock_filter* jump = &program[insn_ind + 1];
+
+        if (jump->jf == 0)
+            jump->jt = (unsigned char)(drop_ind - insn_ind - 1);
+    }
+
+    return (unsigned short)nb_insns;
+}
+
+#endif
+
+#ifdef SYS_USE_REUSEPORT
+
+/*
+====================
+Sys_BuildSteeringProgram
+
+Build a classic BPF program choosing the socket of a SO_REUSEPORT group which
+gets a packet. Like Com_AddressHash, it hashes the source address (only the
+first 64 bits of an IPv6 address), but never its port, so all the packets of
+a host go to the same socket. Returns the number of instructions
+====================
+*/
+static unsigned short Sys_BuildSteeringProgram (int addr_family, unsigned int nb_socks,
+                                                struct sock_filter* program)
+{
+    unsigned int nb_insns = 0;
+
+    // The program sees the UDP payload, so the IP header
+    // must be read using the special network header offset
+    if (addr_family == AF_INET6)
+    {
+        Sys_AddBPFInstruction (program, &nb_insns, BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 8, 0, 0);
+        Sys_AddBPFInstruction (program, &nb_insns, BPF_MISC | BPF_TAX, 0, 0, 0);
+        Sys_AddBPFInstruction (program, &nb_insns, BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12, 0, 0);
+        Sys_AddBPFInstruction (program, &nb_insns, BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0);
+    }
+    else
+        Sys_AddBPFInstruction (program, &nb_insns, BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12, 0, 0);
+
+    // Merge all the bits in the first 16 bits, then pick a socket
+    Sys_AddBPFInstruction (program, &nb_insns, BPF_MISC | BPF_TAX, 0, 0, 0);
+    Sys_AddBPFInstruction (program, &nb_insns, BPF_ALU | BPF_RSH | BPF_K, 16, 0, 0);
+    Sys_AddBPFInstruction (program, &nb_insns, BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0);
+    Sys_AddBPFInstruction (program, &nb_insns, BPF_ALU | BPF_AND | BPF_K, 0xFFFF, 0, 0);
+    Sys_AddBPFInstruction (program, &nb_insns, BPF_ALU | BPF_MOD | BPF_K, nb_socks, 0, 0);
+    Sys_AddBPFInstruction (program, &nb_insns, BPF_RET | BPF_A, 0, 0, 0);
+
+    return (unsigned short)nb_insns;
+}
+
+#endif
+
+
+/*
+====================
+Sys_SetBufferSize
+
+Set the size of the receive or send buffer of a socket
+====================
+*/
+static void Sys_SetBufferSize (socket_t sock, qboolean recv_buffer, unsigned int size)
+{
+    int buffer_size = (int)size;
+
+#ifdef SO_RCVBUFFORCE
+    // Unlike SO_RCVBUF and SO_SNDBUF, the "force" options aren't capped by the system
+    // settings. They only work with the super-user privileges we still have though
+    if (setsockopt (sock, SOL_SOCKET, recv_buffer ? SO_RCVBUFFORCE : SO_SNDBUFFORCE,
+                    (const void *)&buffer_size, sizeof (buffer_size)) == 0)
+        return;
+#endif
+
+    if (setsockopt (sock, SOL_SOCKET, recv_buffer ? SO_RCVBUF : SO_SNDBUF,
+                    (const void *)&buffer_size, sizeof (buffer_size)) != 0)
+        Com_Printf (MSG_WARNING, "> WARNING: can't set the size of the %s buffer (%s)\n",
+                    recv_buffer ? "receive" : "send", Sys_GetLastNetErrorString ());
+}
+
+
 /*
 ====================
 Sys_BuildSockaddr
@@ -406,12 +759,58 @@ qboolean Sys_ResolveListenAddresses (listen_ports_t* listen_ports)
 ====================
 Sys_CreateListenSockets
 
-Step 3 - Create the listening sockets
+Step 3 - Create the listening sockets. If the socket filter is enabled, the
+kernel will drop the packets whose command doesn't start with a prefix of
+"filter_prefixes" (a NULL-terminated list)
 ====================
 */
-qboolean Sys_CreateListenSockets (void)
+qboolean Sys_CreateListenSockets (const char* const* filter_prefixes)
 {
     unsigned int sock_ind;
+#ifdef SYS_USE_SOCKET_FILTER
+    struct sock_filter filter_program [MAX_FILTER_INSTRUCTIONS];
+    struct sock_fprog filter;
+
+    filter.len = 0;
+    filter.filter = filter_program;
+    if (use_socket_filter)
+    {
+        filter.len = Sys_BuildSocketFilter (filter_prefixes, filter_program);
+        if (filter.len == 0)
+            Com_Printf (MSG_WARNING, "> WARNING: can't build the socket filter, it won't be used\n");
+    }
+#endif
+
+#ifdef SYS_USE_DROP_COUNTS
+    next_drop_report = crt_time + DROP_REPORT_PERIOD;
+#endif
+
+#ifdef SYS_USE_REUSEPORT
+    // Each listening address gets a group of sockets, next to each other
+    if (nb_reuseport_sockets > 1)
+    {
+        if (nb_sockets * nb_reuseport_sockets > MAX_LISTEN_SOCKETS)
+        {
+            Com_Printf (MSG_ERROR, "> ERROR: too many listening sockets (%u addresses, %u sockets each)\n",
+                        nb_sockets, nb_reuseport_sockets);
+            return false;
+        }
+
+        for (sock_ind = nb_sockets; sock_ind-- > 0; )
+        {
+            unsigned int group_ind;
+
+            for (group_ind = nb_reuseport_sockets; group_ind-- > 0; )
+            {
+                listen_socket_t* member = &listen_sockets[sock_ind * nb_reuseport_sockets + group_ind];
+
+                *member = listen_sockets[sock_ind];
+                member->reuseport_index = group_ind;
+            }
+        }
+        nb_sockets *= nb_reuseport_sockets;
+    }
+#endif
 
     for (sock_ind = 0; sock_ind < nb_sockets; sock_ind++)
     {
@@ -434,7 +833,7 @@ qboolean Sys_CreateListenSockets (void)
 
                 if (sock_ind + 1 < nb_sockets)
                     memmove (&listen_sockets[sock_ind], &listen_sockets[sock_ind + 1],
-                             (nb_sockets - sock_ind - 2) * sizeof (listen_sockets[0]));
+                             (nb_sockets - sock_ind - 1) * sizeof (listen_sockets[0]));
 
                 sock_ind--;
                 nb_sockets--;
@@ -474,16 +873,67 @@ qboolean Sys_CreateListenSockets (void)
         addr_str = Sys_SockaddrToString(&listen_sock->local_addr,
                                         listen_sock->local_addr_len);
 
-        if (listen_sock->local_addr_name != NULL)
+        // The sockets sharing an address are only announced once
+        if (listen_sock->reuseport_index == 0)
         {
-            Com_Printf (MSG_NORMAL, "> Listening on address %s (%s)\n",
-                        listen_sock->local_addr_name_no_port,
-                        addr_str);
+            if (listen_sock->local_addr_name != NULL)
+            {
+                Com_Printf (MSG_NORMAL, "> Listening on address %s (%s)\n",
+                            listen_sock->local_addr_name_no_port,
+                            addr_str);
+            }
+            else
+                Com_Printf (MSG_NORMAL, "> Listening on all %s addresses (%s)\n",
+                            addr_family == AF_INET6 ? "IPv6" : "IPv4",
+                            addr_str);
         }
-        else
-            Com_Printf (MSG_NORMAL, "> Listening on all %s addresses (%s)\n",
-                        addr_family == AF_INET6 ? "IPv6" : "IPv4",
-                        addr_str);
+
+#ifdef SYS_USE_REUSEPORT
+        if (nb_reuseport_sockets > 1)
+        {
+            int reuse_port = 1;
+
+            if (setsockopt (crt_sock, SOL_SOCKET, SO_REUSEPORT,
+                            (const void *)&reuse_port, sizeof (reuse_port)) != 0)
+            {
+                Com_Printf (MSG_ERROR, "> ERROR: setsockopt(SO_REUSEPORT) failed (%s)\n",
+                            Sys_GetLastNetErrorString ());
+
+                Sys_CloseAllSockets ();
+                return false;
+            }
+        }
+#endif
+
+        if (recv_buffer_size > 0)
+            Sys_SetBufferSize (crt_sock, true, recv_buffer_size);
+        if (send_buffer_size > 0)
+            Sys_SetBufferSize (crt_sock, false, send_buffer_size);
+
+#ifdef SYS_USE_RXQ_OVFL
+        {
+            int rxq_ovfl = 1;
+
+            if (setsockopt (crt_sock, SOL_SOCKET, SO_RXQ_OVFL,
+                            (const void *)&rxq_ovfl, sizeof (rxq_ovfl)) != 0)
+                Com_Printf (MSG_WARNING, "> WARNING: setsockopt(SO_RXQ_OVFL) failed (%s)\n",
+                            Sys_GetLastNetErrorString ());
+        }
+#endif
+
+#ifdef SYS_USE_SOCKET_FILTER
+        // Attach the filter before binding the socket, so no packet can slip through
+        listen_sock->filtered = false;
+        if (filter.len != 0)
+        {
+            if (setsockopt (crt_sock, SOL_SOCKET, SO_ATTACH_FILTER,
+                            (const void *)&filter, sizeof (filter)) == 0)
+                listen_sock->filtered = true;
+            else
+                Com_Printf (MSG_WARNING, "> WARNING: can't attach the socket filter (%s)\n",
+                            Sys_GetLastNetErrorString ());
+        }
+#endif
 
         if (bind (crt_sock, (struct sockaddr*)&listen_sock->local_addr,
                   listen_sock->local_addr_len) != 0)
@@ -496,6 +946,211 @@ qboolean Sys_CreateListenSockets (void)
         }
 
         listen_sock->socket = crt_sock;
+        listen_sock->nb_dropped = 0;
+
+#ifdef SYS_USE_REUSEPORT
+        // Once the group is complete, choose how the packets are steered among its
+        // sockets. If we can't, the kernel will use a hash of the source and
+        // destination addresses and ports, so a server will still use only 1 socket
+        if (nb_reuseport_sockets > 1 &&
+            listen_sock->reuseport_index == nb_reuseport_sockets - 1)
+        {
+            struct sock_filter steering_program [MAX_STEERING_INSTRUCTIONS];
+            struct sock_fprog steering;
+
+            steering.len = Sys_BuildSteeringProgram (addr_family, nb_reuseport_sockets,
+                                                     steering_program);
+            steering.filter = steering_program;
+            if (setsockopt (crt_sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                            (const void *)&steering, sizeof (steering)) != 0)
+            {
+                Com_Printf (MSG_WARNING, "> WARNING: can't attach the reuseport steering program (%s)\n",
+                            Sys_GetLastNetErrorString ());
+            }
+        }
+#endif
+    }
+
+    return true;
+}
+
+
+/*
+====================
+Sys_GetListenSocket
+
+Get a listening socket using this address family (INVALID_SOCKET if none)
+====================
+*/
+socket_t Sys_GetListenSocket (int addr_family)
+{
+    unsigned int sock_ind;
+
+    for (sock_ind = 0; sock_ind < nb_sockets; sock_ind++)
+    {
+        const listen_socket_t* listen_sock = &listen_sockets[sock_ind];
+
+        if (listen_sock->local_addr.ss_family == addr_family)
+            return listen_sock->socket;
+    }
+
+    return INVALID_SOCKET;
+}
+
+
+/*
+====================
+Sys_RecvPackets
+
+Receive the packets waiting on a listening socket, up to "max_packets".
+Wait for the first one if there's none. Returns the number of packets
+received, or -1 in case of error. If the kernel tells it, the number of
+packets it has dropped on this socket so far is put in "nb_dropped"
+====================
+*/
+int Sys_RecvPackets (socket_t sock, recv_packet_t* packets, unsigned int max_packets,
+                     unsigned int* nb_dropped)
+{
+    int nb_bytes;
+
+    assert (max_packets > 0 && max_packets <= MAX_RECV_BATCH);
+
+#ifdef SYS_USE_RECVMMSG
+    if (recvmmsg_available)
+    {
+        struct mmsghdr msgs [MAX_RECV_BATCH];
+        struct iovec iovecs [MAX_RECV_BATCH];
+        unsigned int ind;
+        int nb_packets;
+
+        memset (msgs, 0, max_packets * sizeof (msgs[0]));
+        for (ind = 0; ind < max_packets; ind++)
+        {
+            iovecs[ind].iov_base = packets[ind].data;
+            iovecs[ind].iov_len = sizeof (packets[ind].data) - 1;
+            msgs[ind].msg_hdr.msg_name = &packets[ind].address;
+            msgs[ind].msg_hdr.msg_namelen = sizeof (packets[ind].address);
+            msgs[ind].msg_hdr.msg_iov = &iovecs[ind];
+            msgs[ind].msg_hdr.msg_iovlen = 1;
+#ifdef SYS_USE_RXQ_OVFL
+            msgs[ind].msg_hdr.msg_control = recv_controls[ind].buffer;
+            msgs[ind].msg_hdr.msg_controllen = sizeof (recv_controls[ind].buffer);
+#endif
+        }
+
+        // Only the first packet is waited for
+        nb_packets = recvmmsg (sock, msgs, max_packets, MSG_WAITFORONE, NULL);
+        if (nb_packets >= 0)
+        {
+            for (ind = 0; ind < (unsigned int)nb_packets; ind++)
+            {
+                packets[ind].addrlen = msgs[ind].msg_hdr.msg_namelen;
+                packets[ind].length = (int)msgs[ind].msg_len;
+            }
+
+#ifdef SYS_USE_RXQ_OVFL
+            // The kernel only attaches the count once it has dropped
+            // something, and the last packet has the latest one
+            if (nb_packets > 0)
+            {
+                struct msghdr* last_msg = &msgs[nb_packets - 1].msg_hdr;
+                struct cmsghdr* cmsg;
+
+                for (cmsg = CMSG_FIRSTHDR (last_msg); cmsg != NULL; cmsg = CMSG_NXTHDR (last_msg, cmsg))
+                    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+                        memcpy (nb_dropped, CMSG_DATA (cmsg), sizeof (*nb_dropped));
+            }
+#endif
+
+            return nb_packets;
+        }
+
+        if (errno != ENOSYS)
+            return -1;
+
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: recvmmsg() isn't supported by the kernel, packets will be received one by one\n");
+        recvmmsg_available = false;
+    }
+#endif
+
+    packets[0].addrlen = sizeof (packets[0].address);
+    nb_bytes = recvfrom (sock, packets[0].data, sizeof (packets[0].data) - 1, 0,
+                         (struct sockaddr*)&packets[0].address, &packets[0].addrlen);
+    if (nb_bytes < 0)
+        return -1;
+
+    packets[0].length = nb_bytes;
+    return 1;
+}
+
+
+/*
+====================
+Sys_SendSegments
+
+Send a buffer made of several packets of "segment_size" bytes (the last one
+may be shorter), with one system call if the kernel supports it
+====================
+*/
+qboolean Sys_SendSegments (socket_t sock, const void* data, size_t length, size_t segment_size,
+                           const struct sockaddr_storage* address, socklen_t addrlen)
+{
+    const char* segment = (const char*)data;
+    size_t remaining = length;
+
+    assert (segment_size > 0);
+
+#ifdef SYS_USE_UDP_SEGMENT
+    if (udp_segment_available && length > segment_size)
+    {
+        char control [CMSG_SPACE (sizeof (uint16_t))];
+        struct iovec iov;
+        struct msghdr msg;
+        struct cmsghdr* cmsg;
+        uint16_t gso_size = (uint16_t)segment_size;
+
+        iov.iov_base = (void*)data;
+        iov.iov_len = length;
+
+        memset (&msg, 0, sizeof (msg));
+        memset (control, 0, sizeof (control));
+        msg.msg_name = (void*)address;
+        msg.msg_namelen = addrlen;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof (control);
+
+        cmsg = CMSG_FIRSTHDR (&msg);
+        cmsg->cmsg_level = IPPROTO_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN (sizeof (gso_size));
+        memcpy (CMSG_DATA (cmsg), &gso_size, sizeof (gso_size));
+
+        if (sendmsg (sock, &msg, 0) >= 0)
+            return true;
+
+        // If the failure isn't due to a lack of support for UDP GSO
+        if (errno != EINVAL && errno != EIO && errno != ENOPROTOOPT && errno != EOPNOTSUPP)
+            return false;
+
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: UDP segmentation offload isn't available (%s), packets will be sent one by one\n",
+                    strerror (errno));
+        udp_segment_available = false;
+    }
+#endif
+
+    while (remaining > 0)
+    {
+        size_t size = (remaining > segment_size ? segment_size : remaining);
+
+        if (sendto (sock, segment, size, 0, (const struct sockaddr*)address, addrlen) < 0)
+            return false;
+
+        segment += size;
+        remaining -= size;
     }
 
     return true;
@@ -504,6 +1159,100 @@ qboolean Sys_CreateListenSockets (void)
 
 // ---------- Public functions (the rest) ---------- //
 
+/*
+====================
+Sys_ReportDroppedPackets
+
+Report the packets the kernel dropped on the listening sockets since the last
+report, either because of the socket filter or because their buffers were full
+====================
+*/
+void Sys_ReportDroppedPackets (void)
+{
+#ifdef SYS_USE_DROP_COUNTS
+    unsigned int sock_ind;
+
+    if (next_drop_report == 0 || crt_time < next_drop_report)
+        return;
+    next_drop_report = crt_time + DROP_REPORT_PERIOD;
+
+    for (sock_ind = 0; sock_ind < nb_sockets; sock_ind++)
+    {
+        listen_socket_t* listen_sock = &listen_sockets[sock_ind];
+        unsigned int meminfo [SK_MEMINFO_VARS];
+        socklen_t meminfo_len = sizeof (meminfo);
+        unsigned int nb_dropped;
+
+        if (getsockopt (listen_sock->socket, SOL_SOCKET, SO_MEMINFO,
+                        meminfo, &meminfo_len) != 0 ||
+            meminfo_len <= SK_MEMINFO_DROPS * sizeof (meminfo[0]))
+            continue;
+
+        nb_dropped = meminfo[SK_MEMINFO_DROPS] - listen_sock->nb_dropped;
+        if (nb_dropped == 0)
+            continue;
+        listen_sock->nb_dropped = meminfo[SK_MEMINFO_DROPS];
+
+        Com_Printf (MSG_NORMAL, "> The kernel dropped %u packets on %s during the last %u seconds\n",
+                    nb_dropped,
+                    Sys_SockaddrToString (&listen_sock->local_addr, listen_sock->local_addr_len),
+                    DROP_REPORT_PERIOD);
+    }
+#endif
+}
+
+
+/*
+====================
+Sys_GetNextDropReportTime
+
+Returns the time of the next report of the dropped packets, or 0 if there's none
+====================
+*/
+time_t Sys_GetNextDropReportTime (void)
+{
+#ifdef SYS_USE_DROP_COUNTS
+    return next_drop_report;
+#else
+    return 0;
+#endif
+}
+
+
+/*
+====================
+Sys_SetRecvBufferSize
+
+Set the size of the receive buffer of the listening sockets
+====================
+*/
+qboolean Sys_SetRecvBufferSize (unsigned int size)
+{
+    if (size == 0 || size > INT_MAX)
+        return false;
+
+    recv_buffer_size = size;
+    return true;
+}
+
+
+/*
+====================
+Sys_SetSendBufferSize
+
+Set the size of the send buffer of the listening sockets
+====================
+*/
+qboolean Sys_SetSendBufferSize (unsigned int size)
+{
+    if (size == 0 || size > INT_MAX)
+        return false;
+
+    send_buffer_size = size;
+    return true;
+}
+
+
 /*
 ====================
 Sys_Cmdline_Option
@@ -531,6 +1280,30 @@ cmdline_status_t Sys_Cmdline_Option (const cmdlineopt_t* opt, const char** param
     else if (strcmp (opt_name, "user") == 0)
         low_priv_user = params[0];
 
+#ifdef SYS_USE_REUSEPORT
+    // Number of sockets per listening address
+    else if (strcmp (opt_name, "reuseport") == 0)
+    {
+        const char* start_ptr;
+        char* end_ptr;
+        unsigned int nb_socks;
+
+        start_ptr = params[0];
+        nb_socks = (unsigned int)strtol (start_ptr, &end_ptr, 0);
+        if (end_ptr == start_ptr || *end_ptr != '\0' ||
+            nb_socks < 1 || nb_socks > MAX_REUSEPORT_SOCKETS)
+            return CMDLINE_STATUS_INVALID_OPT_PARAMS;
+
+        nb_reuseport_sockets = nb_socks;
+    }
+#endif
+
+#ifdef SYS_USE_SOCKET_FILTER
+    // Socket filter
+    else if (strcmp (opt_name, "socket-filter") == 0)
+        use_socket_filter = true;
+#endif
+
     return CMDLINE_STATUS_OK;
 
 #else
@@ -612,6 +1385,7 @@ qboolean Sys_SecurityInit (void)
             return false;
         }
         Com_Printf (MSG_NORMAL, "  - Chrooted myself to %s\n", jail_path);
+        chrooted = true;
 
         // Switch to lower privileges
         if (setgid (pw->pw_gid) || setuid (pw->pw_uid))
@@ -673,6 +1447,39 @@ qboolean Sys_SecureInit (void)
 }
 
 
+/*
+====================
+Sys_ResolveAddress
+
+Resolve an address of the form "name", "name:port", "[IPv6]" or "[IPv6]:port"
+====================
+*/
+qboolean Sys_ResolveAddress (const char* address, const char* default_port,
+                             struct sockaddr_storage* sock_address,
+                             socklen_t* sock_address_len)
+{
+    const char* port_name = default_port;
+    const char* port_sep;
+
+    // Look for an explicit port number
+    if (address[0] == '[')
+    {
+        port_sep = strchr (address, ']');
+        if (port_sep != NULL && port_sep[1] == ':')
+            port_name = port_sep + 2;
+    }
+    else
+    {
+        port_sep = strchr (address, ':');
+        if (port_sep != NULL && strchr (port_sep + 1, ':') == NULL)
+            port_name = port_sep + 1;
+    }
+
+    return Sys_StringToSockaddr (address, port_name, sock_address,
+                                 sock_address_len, NULL);
+}
+
+
 /*
 ====================
 Sys_SockaddrToString
@@ -800,3 +1607,96 @@ const char* Sys_GetLastNetErrorString (void)
     }
 #endif
 }
+
+
+/*
+====================
+Sys_GetPreciseTime
+
+Get a monotonic time, in seconds, with a sub-second precision
+====================
+*/
+double Sys_GetPreciseTime (void)
+{
+#ifdef WIN32
+    static LARGE_INTEGER frequency = { 0 };
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency (&frequency);
+    QueryPerformanceCounter (&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+
+/*
+====================
+Sys_GetRandomBytes
+
+Fill a buffer with random bytes, suitable for a secret key. Must be
+called before the security initializations, because of the chroot
+====================
+*/
+qboolean Sys_GetRandomBytes (void* buffer, size_t size)
+{
+#ifdef WIN32
+    // The system random generator, available since Windows XP (advapi32.dll)
+    if (size > ULONG_MAX)
+        return false;
+    return (RtlGenRandom (buffer, (ULONG)size) != FALSE);
+#else
+    FILE* random_file;
+    size_t nb_read;
+
+    random_file = fopen ("/dev/urandom", "rb");
+    if (random_file == NULL)
+        return false;
+
+    nb_read = fread (buffer, 1, size, random_file);
+    fclose (random_file);
+    return (nb_read == size);
+#endif
+}
+
+
+/*
+====================
+Sys_IsChrooted
+
+Tell if we are chrooted, in which case the files opened before can't be opened again by their paths
+====================
+*/
+qboolean Sys_IsChrooted (void)
+{
+#ifdef WIN32
+    return false;
+#else
+    return chrooted;
+#endif
+}
+
+
+/*
+====================
+Sys_IsFileReplaced
+
+Tell if an open file has been deleted since it was opened, or replaced by another file
+====================
+*/
+qboolean Sys_IsFileReplaced (FILE* file)
+{
+#ifdef WIN32
+    // An open file can't be deleted on Windows
+    return false;
+#else
+    struct stat file_stat;
+
+    return (fstat (fileno (file), &file_stat) == 0 && file_stat.st_nlink == 0);
+#endif
+}
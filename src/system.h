@@ -40,6 +40,9 @@
 // The maximum number of listening sockets
 #define MAX_LISTEN_SOCKETS      8 * MAX_LISTEN_ADDRESSES
 
+// The maximum number of packets received at once from a listening socket
+#define MAX_RECV_BATCH          32
+
 // Network errors code
 #ifdef WIN32
 #   define NETERR_AFNOSUPPORT   WSAEAFNOSUPPORT
@@ -91,8 +94,20 @@ typedef struct
     const char* local_addr_name_no_port;    // Without any port
     struct sockaddr_storage local_addr;
     qboolean optional;
+    unsigned int nb_dropped;                // Packets dropped by the kernel, at the last report
+    unsigned int reuseport_index;           // Position in its group of sockets sharing the address
+    qboolean filtered;                      // Is there a socket filter dropping packets?
 } listen_socket_t;
 
+// A packet received on a listening socket
+typedef struct
+{
+    struct sockaddr_storage address;
+    socklen_t addrlen;
+    int length;
+    char data [MAX_PACKET_SIZE_IN + 1];  // "+ 1" so we can append a '\0'
+} recv_packet_t;
+
 // The steps for running as a daemon (no console output)
 typedef enum
 {
@@ -121,14 +136,42 @@ extern daemon_state_t daemon_state;
 
 // ---------- Public functions (listening sockets) ---------- //
 
+// Set the sizes of the buffers of the listening sockets. Must be called
+// before Sys_CreateListenSockets, the system defaults are used otherwise
+qboolean Sys_SetRecvBufferSize (unsigned int size);
+qboolean Sys_SetSendBufferSize (unsigned int size);
+
 // Step 1 - Add a listen socket to the listening socket list
 qboolean Sys_DeclareListenAddress (const char* local_addr_name);
 
 // Step 2 - Resolve the address names of all the listening sockets
 qboolean Sys_ResolveListenAddresses (listen_ports_t* listen_ports);
 
-// Step 3 - Create the listening sockets
-qboolean Sys_CreateListenSockets (void);
+// Step 3 - Create the listening sockets. If the socket filter is enabled, the
+// kernel will drop the packets whose command doesn't start with a prefix of
+// "filter_prefixes" (a NULL-terminated list)
+qboolean Sys_CreateListenSockets (const char* const* filter_prefixes);
+
+// Get a listening socket using this address family (INVALID_SOCKET if none)
+socket_t Sys_GetListenSocket (int addr_family);
+
+// Receive the packets waiting on a listening socket, up to "max_packets" (and
+// MAX_RECV_BATCH). Wait for the first one if there's none. Returns the number
+// of packets received, or -1 in case of error. If the kernel tells it, the number
+// of packets it has dropped on this socket so far is put in "nb_dropped"
+int Sys_RecvPackets (socket_t sock, recv_packet_t* packets, unsigned int max_packets,
+                     unsigned int* nb_dropped);
+
+// Send a buffer made of several packets of "segment_size" bytes (the last
+// one may be shorter), with one system call if the kernel supports it
+qboolean Sys_SendSegments (socket_t sock, const void* data, size_t length, size_t segment_size,
+                           const struct sockaddr_storage* address, socklen_t addrlen);
+
+// Report the packets the kernel dropped on the listening sockets, if it's time to
+void Sys_ReportDroppedPackets (void);
+
+// Returns the time of the next report of the dropped packets, or 0 if there's none
+time_t Sys_GetNextDropReportTime (void);
 
 
 // ---------- Public functions (the rest) ---------- //
@@ -152,6 +195,11 @@ qboolean Sys_SecurityInit (void);
 // System dependent initializations (called AFTER security initializations)
 qboolean Sys_SecureInit (void);
 
+// Resolve an address of the form "name", "name:port", "[IPv6]" or "[IPv6]:port"
+qboolean Sys_ResolveAddress (const char* address, const char* default_port,
+                             struct sockaddr_storage* sock_address,
+                             socklen_t* sock_address_len);
+
 // Returns a pointer to its static character buffer (do NOT free it!)
 const char* Sys_SockaddrToString (const struct sockaddr_storage* address, socklen_t socklen);
 
@@ -164,5 +212,18 @@ int Sys_GetLastNetError (void);
 // Get the last network error string
 const char* Sys_GetLastNetErrorString (void);
 
+// Get a monotonic time, in seconds, with a sub-second precision
+double Sys_GetPreciseTime (void);
+
+// Fill a buffer with random bytes, suitable for a secret key. Must be
+// called before the security initializations, because of the chroot
+qboolean Sys_GetRandomBytes (void* buffer, size_t size);
+
+// Are we chrooted? The files can't be opened by their paths anymore, then
+qboolean Sys_IsChrooted (void);
+
+// Has an open file been deleted, or replaced by another file, since it was opened?
+qboolean Sys_IsFileReplaced (FILE* file);
+
 
 #endif  // #ifndef _SYSTEM_H_
@@ -0,0 +1,511 @@
+/*
+    upstream.c
+
+    Server list aggregation from upstream masters for dpmaster
+
+    Copyright (C) 2026  The ravenmaster contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "common.h"
+#include "system.h"
+
+#include "games.h"
+#include "servers.h"
+#include "upstream.h"
+
+
+// ---------- Private types ---------- //
+
+// A query sent to an upstream master
+typedef struct
+{
+    const char* gamename;
+    int protocol;
+    qboolean anonymous;     // true if it's an anonymous game (game properties may be reloaded)
+} upstream_query_t;
+
+// An upstream master. Its queries are sent one after the other, since the
+// answers don't tell which query they belong to, but all upstream masters
+// are queried in parallel so a slow one doesn't delay the others
+typedef struct
+{
+    const char* addr_name;
+    struct sockaddr_storage address;
+    socklen_t addrlen;
+    upstream_query_t queries [MAX_UPSTREAM_QUERIES];
+    unsigned int nb_queries;
+    int crt_query;              // -1 = no query in progress
+    time_t query_timeout;
+    unsigned int nb_received;   // number of servers received for the current query
+} upstream_t;
+
+
+// ---------- Private variables ---------- //
+
+static upstream_t upstreams [MAX_UPSTREAMS];
+static unsigned int nb_upstreams = 0;
+
+static unsigned int upstream_period = DEFAULT_UPSTREAM_PERIOD;
+static time_t next_cycle_time = 0;
+
+static qboolean upstream_initialized = false;
+
+
+// ---------- Private functions ---------- //
+
+/*
+====================
+Upstream_GetByAddr
+
+Get the upstream master using this address, if any
+====================
+*/
+static upstream_t* Upstream_GetByAddr (const struct sockaddr_storage* address, socklen_t addrlen)
+{
+    unsigned int up_ind;
+
+    for (up_ind = 0; up_ind < nb_upstreams; up_ind++)
+    {
+        upstream_t* upstream = &upstreams[up_ind];
+        qboolean same_public_address;
+
+        if (upstream->address.ss_family != address->ss_family || upstream->addrlen != addrlen)
+            continue;
+
+        if (address->ss_family == AF_INET)
+        {
+            if (Com_SameIPv4Addr (&upstream->address, address, &same_public_address))
+                return upstream;
+        }
+        else if (Com_SameIPv6Addr (&upstream->address, address, &same_public_address))
+            return upstream;
+    }
+
+    return NULL;
+}
+
+
+/*
+====================
+Upstream_SendQuery
+
+Send the first query that can be sent to an upstream master, starting at "query_ind"
+====================
+*/
+static void Upstream_SendQuery (upstream_t* upstream, unsigned int query_ind)
+{
+    socket_t sock = Sys_GetListenSocket (upstream->address.ss_family);
+    const char* upstream_name = Sys_SockaddrToString (&upstream->address, upstream->addrlen);
+
+    upstream->crt_query = -1;
+    if (sock == INVALID_SOCKET)
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: can't query upstream master %s (no socket for this address family)\n",
+                    upstream_name);
+        return;
+    }
+
+    for (; query_ind < upstream->nb_queries; query_ind++)
+    {
+        const upstream_query_t* query = &upstream->queries[query_ind];
+        char msg [128];
+
+        // Anonymous games may not be known by their name on the upstream master
+        if (query->anonymous)
+            snprintf (msg, sizeof (msg), "\xFF\xFF\xFF\xFFgetservers %d empty full",
+                      query->protocol);
+        else
+            snprintf (msg, sizeof (msg), "\xFF\xFF\xFF\xFFgetserversExt %s %d empty full ipv4 ipv6",
+                      query->gamename, query->protocol);
+        msg[sizeof (msg) - 1] = '\0';
+
+        if (sendto (sock, msg, strlen (msg), 0,
+                    (const struct sockaddr*)&upstream->address, upstream->addrlen) < 0)
+        {
+            Com_Printf (MSG_WARNING, "> WARNING: can't query upstream master %s (%s)\n",
+                        upstream_name, Sys_GetLastNetErrorString ());
+            continue;
+        }
+
+        Com_Printf (MSG_NORMAL, "> %s <--- %s (%s, %d)\n", upstream_name,
+                    query->anonymous ? "getservers" : "getserversExt",
+                    query->gamename, query->protocol);
+
+        upstream->crt_query = (int)query_ind;
+        upstream->query_timeout = crt_time + UPSTREAM_QUERY_TIMEOUT;
+        upstream->nb_received = 0;
+        return;
+    }
+}
+
+
+/*
+====================
+Upstream_MergeServer
+
+Add a server received from an upstream master to our list, or refresh it
+====================
+*/
+static void Upstream_MergeServer (const upstream_query_t* query,
+                                  const struct sockaddr_storage* address,
+                                  socklen_t addrlen)
+{
+    server_t* sv;
+
+    strncpy (peer_address, Sys_SockaddrToString (address, addrlen),
+             sizeof (peer_address));
+    peer_address[sizeof (peer_address) - 1] = '\0';
+
+    sv = Sv_GetByAddr (address, addrlen, false);
+
+    // If we know it from a better source, keep our own information
+    if (sv != NULL && sv->origin != sv_origin_upstream)
+        return;
+
+    if (sv == NULL)
+    {
+        sv = Sv_GetByAddr (address, addrlen, true);
+        if (sv == NULL)
+            return;
+        sv->origin = sv_origin_upstream;
+    }
+
+    // We don't know the actual state of the server, so we assume
+    // it's neither empty nor full so that it's always sent
+    Sv_SetInfo (sv, query->gamename, query->protocol, "0", sv_state_occupied,
+                query->anonymous ? Game_GetPropertiesByName (query->gamename) : NULL);
+    sv->hb_properties = sv->anon_properties;
+    sv->timeout = crt_time + upstream_period * UPSTREAM_LIFETIME_PERIODS;
+}
+
+
+// ---------- Public functions ---------- //
+
+/*
+====================
+Upstream_SetPeriod
+
+Set the period between 2 queries of the upstream masters
+====================
+*/
+qboolean Upstream_SetPeriod (unsigned int period)
+{
+    // Too late? Or invalid period?
+    if (upstream_initialized || period == 0)
+        return false;
+
+    upstream_period = period;
+    return true;
+}
+
+
+/*
+====================
+Upstream_Declare
+
+Step 1 - Add a query to an upstream master
+====================
+*/
+qboolean Upstream_Declare (const char* addr_name, const char* gamename, const char* protocol)
+{
+    upstream_t* upstream = NULL;
+    upstream_query_t* query;
+    unsigned int up_ind;
+    char* end_ptr;
+
+    // Several queries can be sent to the same upstream master
+    for (up_ind = 0; up_ind < nb_upstreams; up_ind++)
+        if (strcmp (upstreams[up_ind].addr_name, addr_name) == 0)
+        {
+            upstream = &upstreams[up_ind];
+            break;
+        }
+
+    if (upstream == NULL)
+    {
+        if (nb_upstreams >= MAX_UPSTREAMS)
+        {
+            Com_Printf (MSG_ERROR, "> ERROR: too many upstream masters (max: %d)\n",
+                        MAX_UPSTREAMS);
+            return false;
+        }
+
+        upstream = &upstreams[nb_upstreams++];
+        memset (upstream, 0, sizeof (*upstream));
+        upstream->addr_name = addr_name;
+        upstream->crt_query = -1;
+    }
+
+    if (upstream->nb_queries >= MAX_UPSTREAM_QUERIES)
+    {
+        Com_Printf (MSG_ERROR, "> ERROR: too many queries for upstream master %s (max: %d)\n",
+                    addr_name, MAX_UPSTREAM_QUERIES);
+        return false;
+    }
+
+    if (gamename[0] == '\0' || strlen (gamename) >= GAMENAME_LENGTH ||
+        strchr (gamename, ' ') != NULL)
+        return false;
+
+    query = &upstream->queries[upstream->nb_queries];
+    query->gamename = gamename;
+    query->protocol = (int)strtol (protocol, &end_ptr, 0);
+    if (end_ptr == protocol || *end_ptr != '\0')
+        return false;
+
+    upstream->nb_queries++;
+    return true;
+}
+
+
+/*
+====================
+Upstream_ResolveAddresses
+
+Step 2 - Resolve the addresses of all the upstream masters
+====================
+*/
+qboolean Upstream_ResolveAddresses (const char* default_port)
+{
+    unsigned int up_ind;
+
+    for (up_ind = 0; up_ind < nb_upstreams; up_ind++)
+    {
+        upstream_t* upstream = &upstreams[up_ind];
+
+        if (! Sys_ResolveAddress (upstream->addr_name, default_port,
+                                  &upstream->address, &upstream->addrlen))
+            return false;
+
+        Com_Printf (MSG_NORMAL, "> Upstream master: %s (%s)\n", upstream->addr_name,
+                    Sys_SockaddrToString (&upstream->address, upstream->addrlen));
+    }
+
+    return true;
+}
+
+
+/*
+====================
+Upstream_Init
+
+Step 3 - Start querying the upstream masters
+====================
+*/
+qboolean Upstream_Init (void)
+{
+    unsigned int up_ind;
+
+    upstream_initialized = true;
+    if (nb_upstreams == 0)
+        return true;
+
+    for (up_ind = 0; up_ind < nb_upstreams; up_ind++)
+    {
+        upstream_t* upstream = &upstreams[up_ind];
+        unsigned int query_ind;
+
+        for (query_ind = 0; query_ind < upstream->nb_queries; query_ind++)
+        {
+            upstream_query_t* query = &upstream->queries[query_ind];
+            const char* anon_game;
+
+            if (! Game_IsAccepted (query->gamename))
+            {
+                Com_Printf (MSG_ERROR,
+                            "> ERROR: can't query %s for game \"%s\" (game is not accepted)\n",
+                            upstream->addr_name, query->gamename);
+                return false;
+            }
+
+            anon_game = Game_GetNameByProtocol (query->protocol, NULL);
+            query->anonymous = (anon_game != NULL && strcmp (anon_game, query->gamename) == 0);
+        }
+    }
+
+    // Send the first queries as soon as possible
+    next_cycle_time = crt_time;
+    return true;
+}
+
+
+/*
+====================
+Upstream_HandleResponse
+
+Parse a getserversResponse or getserversExtResponse message from an upstream master
+====================
+*/
+void Upstream_HandleResponse (const qbyte* msg, size_t length,
+                              const struct sockaddr_storage* address,
+                              socklen_t addrlen, qboolean extended_response)
+{
+    const char* response_name = (extended_response ? "getserversExtResponse" : "getserversResponse");
+    char upstream_name [sizeof (peer_address)];
+    upstream_t* upstream;
+    const upstream_query_t* query;
+    qboolean eot_found = false;
+    qboolean game_accepted;
+
+    Com_Printf (MSG_NORMAL, "> %s ---> %s\n", peer_address, response_name);
+
+    upstream = Upstream_GetByAddr (address, addrlen);
+    if (upstream == NULL || upstream->crt_query < 0)
+    {
+        Com_Printf (MSG_WARNING,
+                    "> WARNING: Rejecting %s from %s (unexpected answer)\n",
+                    response_name, peer_address);
+        return;
+    }
+    query = &upstream->queries[upstream->crt_query];
+
+    // The game policy may have changed since the query was declared
+    game_accepted = Game_IsAccepted (query->gamename);
+
+    // "peer_address" will be used for the servers while parsing the message
+    strncpy (upstream_name, peer_address, sizeof (upstream_name));
+
+    while (length > 0)
+    {
+        struct sockaddr_storage sv_address;
+        socklen_t sv_addrlen;
+
+        memset (&sv_address, 0, sizeof (sv_address));
+
+        // End Of Transmission
+        if (length >= 7 && memcmp (msg, "\\EOT\0\0\0", 7) == 0)
+        {
+            eot_found = true;
+            break;
+        }
+
+        // IPv4 server
+        if (msg[0] == '\\' && length >= 7)
+        {
+            struct sockaddr_in* addr4 = (struct sockaddr_in*)&sv_address;
+
+            addr4->sin_family = AF_INET;
+            memcpy (&addr4->sin_addr.s_addr, &msg[1], 4);
+            memcpy (&addr4->sin_port, &msg[5], 2);
+            sv_addrlen = sizeof (*addr4);
+
+            msg += 7;
+            length -= 7;
+        }
+
+        // IPv6 server
+        else if (msg[0] == '/' && extended_response && length >= 19)
+        {
+            struct sockaddr_in6* addr6 = (struct sockaddr_in6*)&sv_address;
+
+            addr6->sin6_family = AF_INET6;
+            memcpy (&addr6->sin6_addr.s6_addr, &msg[1], 16);
+            memcpy (&addr6->sin6_port, &msg[17], 2);
+            sv_addrlen = sizeof (*addr6);
+
+            msg += 19;
+            length -= 19;
+        }
+        else
+        {
+            Com_Printf (MSG_WARNING,
+                        "> WARNING: invalid %s from %s (malformed entry)\n",
+                        response_name, upstream_name);
+            break;
+        }
+
+        if (game_accepted)
+            Upstream_MergeServer (query, &sv_address, sv_addrlen);
+        upstream->nb_received++;
+    }
+
+    strncpy (peer_address, upstream_name, sizeof (peer_address));
+
+    // Go on with the next query if this one is over
+    if (eot_found)
+    {
+        Com_Printf (MSG_DEBUG, "  - %u server(s) received for game \"%s\"\n",
+                    upstream->nb_received, query->gamename);
+        Upstream_SendQuery (upstream, (unsigned int)upstream->crt_query + 1);
+    }
+}
+
+
+/*
+====================
+Upstream_Update
+
+Send the queries that are due, and give up on the answers that take too long
+====================
+*/
+void Upstream_Update (void)
+{
+    unsigned int up_ind;
+    qboolean new_cycle;
+
+    if (nb_upstreams == 0)
+        return;
+
+    new_cycle = (next_cycle_time <= crt_time);
+    if (new_cycle)
+        next_cycle_time = crt_time + upstream_period;
+
+    for (up_ind = 0; up_ind < nb_upstreams; up_ind++)
+    {
+        upstream_t* upstream = &upstreams[up_ind];
+
+        // Some masters don't send EOT marks, so a timeout
+        // is also the normal end of their answers
+        if (upstream->crt_query >= 0 && upstream->query_timeout <= crt_time)
+        {
+            Com_Printf (MSG_DEBUG,
+                        "> No more answer from upstream master %s (%u server(s) received for game \"%s\")\n",
+                        Sys_SockaddrToString (&upstream->address, upstream->addrlen),
+                        upstream->nb_received, upstream->queries[upstream->crt_query].gamename);
+            Upstream_SendQuery (upstream, (unsigned int)upstream->crt_query + 1);
+        }
+
+        if (new_cycle && upstream->crt_query < 0)
+            Upstream_SendQuery (upstream, 0);
+    }
+}
+
+
+/*
+====================
+Upstream_GetNextTime
+
+Returns the time of the next action on the upstream masters, or 0 if there's none
+====================
+*/
+time_t Upstream_GetNextTime (void)
+{
+    time_t next_time = next_cycle_time;
+    unsigned int up_ind;
+
+    for (up_ind = 0; up_ind < nb_upstreams; up_ind++)
+    {
+        const upstream_t* upstream = &upstreams[up_ind];
+
+        if (upstream->crt_query >= 0 && upstream->query_timeout < next_time)
+            next_time = upstream->query_timeout;
+    }
+
+    return next_time;
+}
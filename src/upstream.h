@@ -0,0 +1,75 @@
+/*
+    upstream.h
+
+    Server list aggregation from upstream masters for dpmaster
+
+    Copyright (C) 2026  The ravenmaster contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef _UPSTREAM_H_
+#define _UPSTREAM_H_
+
+
+// ---------- Constants ---------- //
+
+// The maximum number of upstream masters
+#define MAX_UPSTREAMS 8
+
+// The maximum number of queries (game name + protocol) per upstream master
+#define MAX_UPSTREAM_QUERIES 8
+
+// Period between 2 queries of the upstream masters by default, in seconds
+#define DEFAULT_UPSTREAM_PERIOD 120
+
+// The servers obtained from an upstream master are forgotten if they aren't
+// part of its answers anymore after this number of periods
+#define UPSTREAM_LIFETIME_PERIODS 3
+
+// Time we wait for the end of an upstream answer before sending the next query, in seconds
+#define UPSTREAM_QUERY_TIMEOUT 5
+
+
+// ---------- Public functions ---------- //
+
+// Will simply return "false" if called after Upstream_Init
+qboolean Upstream_SetPeriod (unsigned int period);
+
+// Step 1 - Add a query to an upstream master
+qboolean Upstream_Declare (const char* addr_name, const char* gamename, const char* protocol);
+
+// Step 2 - Resolve the addresses of all the upstream masters. Must be called
+// before the security initializations, since DNS requests may fail
+// from the chroot jail
+qboolean Upstream_ResolveAddresses (const char* default_port);
+
+// Step 3 - Start querying the upstream masters
+qboolean Upstream_Init (void);
+
+// Parse a getserversResponse or getserversExtResponse message from an upstream master
+void Upstream_HandleResponse (const qbyte* msg, size_t length,
+                              const struct sockaddr_storage* address,
+                              socklen_t addrlen, qboolean extended_response);
+
+// Send the queries that are due, and give up on the answers that take too long
+void Upstream_Update (void);
+
+// Returns the time of the next action on the upstream masters, or 0 if there's none
+time_t Upstream_GetNextTime (void);
+
+
+#endif  // #ifndef _UPSTREAM_H_
@@ -0,0 +1,24 @@
+#!/usr/bin/perl -w
+
+use strict;
+use testlib;
+
+
+Master_SetProperty ("extraOptions", [ "--client-cookies" ]);
+Master_SetProperty ("maxNbServersPerAddr", 0);
+
+# Enough servers for the list not to fit in a single packet
+for (my $i = 0; $i < 250; $i++) {
+	Server_New ();
+}
+
+# A client which doesn't send back its cookie only gets the first packet of the list
+my $clientRef = Client_New ();
+Client_SetProperty ($clientRef, "truncatedList", 1);
+Test_Run ("Client cookies (client without a cookie)");
+
+# Once it sends back its cookie, it gets the whole list
+Client_SetProperty ($clientRef, "truncatedList", 0);
+Client_SetProperty ($clientRef, "sendCookies", 1);
+Client_SetProperty ($clientRef, "nbQueries", 2);
+Test_Run ("Client cookies (client sending back its cookie)", 5);
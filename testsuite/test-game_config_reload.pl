@@ -0,0 +1,40 @@
+#!/usr/bin/perl -w
+
+use strict;
+use testlib;
+
+
+my @gameNames = ( "DpmasterTest", "DpmasterTest2" );
+foreach my $gameName (@gameNames) {
+	my $serverRef = Server_New ();
+	Server_SetGameProperty ($serverRef, "gamename", $gameName);
+
+	# The second query is sent after the reload
+	my $clientRef = Client_New ();
+	Client_SetGameProperty ($clientRef, "gamename", $gameName);
+	Client_SetProperty ($clientRef, "nbQueries", 2);
+	Client_SetProperty ($clientRef, "queryInterval", 2);
+}
+
+my %reloadedGamePolicy = (
+	policy => "reject",
+	gamenames => [ "DpmasterTest2" ],
+);
+Master_SetProperty ("gameConfig", [ "# No game policy for now" ]);
+Master_SetProperty ("reloadedGameConfig", [ "game-policy reject DpmasterTest2" ]);
+Master_SetProperty ("reloadedGamePolicy", \%reloadedGamePolicy);
+Master_SetProperty ("reloadDelay", 2);
+Test_Run ("Game rejected after a reload of the game configuration", 4);
+
+# The master keeps its configuration if the new file is invalid
+Master_SetProperty ("reloadedGameConfig", [ "game-policy reject DpmasterTest2", "invalid-option DpmasterTest2 foo" ]);
+Master_SetProperty ("reloadedGamePolicy", undef);
+Test_Run ("Invalid game configuration ignored at reload", 4);
+
+# A chrooted master can only read the file it has opened at startup
+if ($> != 0) {
+	Master_SetProperty ("reloadedGameConfig", [ "game-policy reject DpmasterTest2" ]);
+	Master_SetProperty ("reloadedGamePolicy", \%reloadedGamePolicy);
+	Master_SetProperty ("reloadByRename", 1);
+	Test_Run ("Game configuration replaced by a new file", 4);
+}
@@ -0,0 +1,42 @@
+#!/usr/bin/perl -w
+
+use strict;
+use testlib;
+
+
+my $server1Ref = Server_New ();
+my $server2Ref = Server_New ();
+
+my $clientRef = Client_New ();
+Client_SetProperty ($clientRef, "useDeltaQuery", 1);
+
+# A client without a list gets the complete list, and its version
+Client_SetProperty ($clientRef, "expectedListStates", [ "full" ]);
+Test_Run ("Client using a delta query (getserversDelta) without a list");
+
+# A list version from another registry can't be the base of the changes
+Client_SetProperty ($clientRef, "listVersion", "12345.678");
+Test_Run ("Client using a delta query with an unknown list version");
+
+# An invalid list version is rejected
+Client_SetProperty ($clientRef, "listVersion", "12345.abc");
+Test_Run ("Client using a delta query with an invalid list version");
+Client_SetProperty ($clientRef, "listVersion", "0");
+
+# The second query only gets the changes: the 2nd server is removed
+# from the list when it switches to another game, and a 3rd one appears
+my $server3Ref = Server_New ();
+Server_SetProperty ($server3Ref, "startDelay", 1.5);
+Server_SetProperty ($server2Ref, "updateDelay", 1.5);
+Server_SetProperty ($server2Ref, "updatedGameProperties", { gamename => "DpmasterTest2" });
+Client_SetProperty ($clientRef, "nbQueries", 2);
+Client_SetProperty ($clientRef, "queryInterval", 1.5);
+Client_SetProperty ($clientRef, "expectedListStates", [ "full", "delta" ]);
+Test_Run ("Client using delta queries while servers come and go", 4);
+
+# A client asking for a game without any server gets an empty list with no version
+my $client2Ref = Client_New ();
+Client_SetGameProperty ($client2Ref, "gamename", "DpmasterTestNoServer");
+Client_SetProperty ($client2Ref, "useDeltaQuery", 1);
+Client_SetProperty ($client2Ref, "expectedListStates", [ "full 0" ]);
+Test_Run ("Client using a delta query for a game without any server", 4);
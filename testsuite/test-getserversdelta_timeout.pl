@@ -0,0 +1,26 @@
+#!/usr/bin/perl -w
+
+use strict;
+use testlib;
+
+
+# When the only server of a game times out, the game is dropped from the registry with
+# its changes. If another server registers later, the lists of the previous servers
+# are sent in full, so the clients don't keep the server that timed out
+Master_SetProperty ("extraOptions", [ "--server-timeout", "3" ]);
+my $server1Ref = Server_New ();
+Server_SetProperty ($server1Ref, "timesOut", 1);
+my $server2Ref = Server_New ();
+Server_SetProperty ($server2Ref, "startDelay", 6.5);
+
+my $clientRef = Client_New ();
+Client_SetProperty ($clientRef, "useDeltaQuery", 1);
+Client_SetProperty ($clientRef, "nbQueries", 2);
+Client_SetProperty ($clientRef, "queryInterval", 7);
+Client_SetProperty ($clientRef, "expectedListStates", [ "full", "full" ]);
+
+# The 2nd query of this client makes the master notice the timeout
+my $client2Ref = Client_New ();
+Client_SetProperty ($client2Ref, "nbQueries", 3);
+Client_SetProperty ($client2Ref, "queryInterval", 4);
+Test_Run ("Client using delta queries after the only server of its game timed out", 10);
@@ -27,3 +27,20 @@ Server_SetProperty ($server3Ref, "useIPv6", 1);
 Client_SetProperty ($clientRef, "useIPv6", 1);
 
 Test_Run ("Maximum number of servers per address (IPv6)");
+
+
+# Once the 2 first servers have timed out, the 3rd one should be accepted
+Master_SetProperty ("extraOptions", [ "--server-timeout", "3" ]);
+Server_SetProperty ($server1Ref, "useIPv6", 0);
+Server_SetProperty ($server1Ref, "timesOut", 1);
+Server_SetProperty ($server2Ref, "useIPv6", 0);
+Server_SetProperty ($server2Ref, "timesOut", 1);
+Server_SetProperty ($server3Ref, "useIPv6", 0);
+Server_SetProperty ($server3Ref, "cannotBeAnswered", 0);
+Server_SetProperty ($server3Ref, "startDelay", 5.5);
+
+Client_SetProperty ($clientRef, "useIPv6", 0);
+Client_SetProperty ($clientRef, "nbQueries", 2);
+Client_SetProperty ($clientRef, "queryInterval", 5);
+
+Test_Run ("Maximum number of servers per address, after some of them timed out", 7);
@@ -0,0 +1,20 @@
+#!/usr/bin/perl -w
+
+use strict;
+use testlib;
+
+
+Master_SetProperty ("peerPort", 27951);
+
+# A server which only sends its heartbeats to the peer master is added to
+# the list of the main master once it has answered its getinfo too
+my $serverRef = Server_New ();
+Server_SetProperty ($serverRef, "usePeerMaster", 1);
+my $clientRef = Client_New ();
+Client_SetProperty ($clientRef, "nbQueries", 2);
+Client_SetProperty ($clientRef, "queryInterval", 2.5);
+Test_Run ("Server known by the peer master only", 5);
+
+# The main master ignores the messages of a peer which uses another secret
+Master_SetProperty ("peerMasterSecret", "AnotherSecret");
+Test_Run ("Server known by a peer master using another secret", 5);
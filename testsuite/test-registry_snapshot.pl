@@ -0,0 +1,20 @@
+#!/usr/bin/perl -w
+
+use strict;
+use testlib;
+
+
+my $snapshotFile = "test-registry_snapshot.dat";
+unlink ($snapshotFile);
+Master_SetProperty ("extraOptions", [ "--snapshot-file", $snapshotFile ]);
+
+my $serverRef = Server_New ();
+my $clientRef = Client_New ();
+Test_Run ("Registry saved into the snapshot when exiting");
+
+# The server doesn't send any heartbeat this time, so it can only be
+# known from the snapshot saved by the master when it got its SIGTERM
+Server_SetProperty ($serverRef, "startDelay", 10);
+Test_Run ("Registry reloaded from the snapshot at startup");
+
+unlink ($snapshotFile);
@@ -0,0 +1,24 @@
+#!/usr/bin/perl -w
+
+use strict;
+use testlib;
+
+
+# A server which has just answered a getinfo isn't asked again when it sends
+# another heartbeat, until the end of the trust window
+Master_SetProperty ("extraOptions", [ "--trust-window", "10" ]);
+my $serverRef = Server_New ();
+Server_SetProperty ($serverRef, "trustWindow", 10);
+Server_SetProperty ($serverRef, "updateDelay", 1.5);
+Server_SetProperty ($serverRef, "updatedGameProperties", { });
+my $clientRef = Client_New ();
+Client_SetProperty ($clientRef, "nbQueries", 2);
+Client_SetProperty ($clientRef, "queryInterval", 2);
+Test_Run ("Server sending a heartbeat during its trust window", 4);
+
+# At the end of the trust window, the server gets a single getinfo
+Master_SetProperty ("extraOptions", [ "--trust-window", "3" ]);
+Server_SetProperty ($serverRef, "trustWindow", 3);
+Server_SetProperty ($serverRef, "updateDelay", 1);
+Client_SetProperty ($clientRef, "queryInterval", 4);
+Test_Run ("Server sending a heartbeat during a short trust window", 6);
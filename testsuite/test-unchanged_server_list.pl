@@ -0,0 +1,44 @@
+#!/usr/bin/perl -w
+
+use strict;
+use testlib;
+
+
+my $server1Ref = Server_New ();
+my $server2Ref = Server_New ();
+
+# A client asking again for a list which hasn't changed is told so
+my $clientRef = Client_New ();
+Client_SetProperty ($clientRef, "queryFilters", "empty full ifchanged");
+Client_SetProperty ($clientRef, "nbQueries", 2);
+Client_SetProperty ($clientRef, "expectedUnchangedCount", 1);
+Test_Run ("Client asking twice for an unchanged list (ifchanged)", 4);
+
+# Without the "ifchanged" option, it gets the whole list again
+Client_SetProperty ($clientRef, "queryFilters", "empty full");
+Client_SetProperty ($clientRef, "expectedUnchangedCount", 0);
+Test_Run ("Client asking twice for an unchanged list (no ifchanged)", 4);
+
+# If a server appears between the 2 queries, the list is sent again
+my $server3Ref = Server_New ();
+Server_SetProperty ($server3Ref, "startDelay", 1.5);
+Client_SetProperty ($clientRef, "queryFilters", "empty full ifchanged");
+Client_SetProperty ($clientRef, "queryInterval", 1.5);
+Test_Run ("Client asking twice for a list which has changed (ifchanged)", 4);
+
+# If the only server of a game times out and another one registers, the new list
+# isn't taken for the previous one
+Master_SetProperty ("extraOptions", [ "--server-timeout", "3" ]);
+my $server4Ref = Server_New ();
+Server_SetGameProperty ($server4Ref, "gamename", "DpmasterTestTimeout");
+Server_SetProperty ($server4Ref, "timesOut", 1);
+my $server5Ref = Server_New ();
+Server_SetGameProperty ($server5Ref, "gamename", "DpmasterTestTimeout");
+Server_SetProperty ($server5Ref, "startDelay", 6.5);
+my $client2Ref = Client_New ();
+Client_SetGameProperty ($client2Ref, "gamename", "DpmasterTestTimeout");
+Client_SetProperty ($client2Ref, "queryFilters", "empty full ifchanged");
+Client_SetProperty ($client2Ref, "nbQueries", 3);
+Client_SetProperty ($client2Ref, "queryInterval", 4);
+Client_SetProperty ($client2Ref, "expectedUnchangedCount", 0);
+Test_Run ("Client asking for a list after the only server of its game timed out (ifchanged)", 10);
@@ -17,6 +17,7 @@ use constant DEFAULT_DPMASTER_PATH => "../src/dpmaster";
 use constant IPV4_LOOPBACK_ADDRESS => "127.0.0.1";
 use constant IPV6_LOOPBACK_ADDRESS => "::1";
 use constant DEFAULT_DPMASTER_PORT => 27950;
+use constant GAME_CONFIG_FILE => "test-game_config.cfg";
 
 # Constants - game properties
 use constant DEFAULT_GAMENAME => "DpmasterTest";
@@ -41,9 +42,19 @@ use constant {
 
 # Global variables - dpmaster
 my $dpmasterPid = undef;
+my $peerMasterPid = undef;
+my $gameConfigReloaded = 0;
 my %dpmasterProperties = (
 	exitvalue => undef,
 	remoteAddress => undef,
+	peerPort => undef,  # if defined, a peer master is run on this port
+	peerSecret => "DpmasterTestSecret",
+	peerMasterSecret => undef,  # the secret of the peer master, if it's a different one
+	gameConfig => undef,  # if defined, the lines of the game configuration file
+	reloadedGameConfig => undef,  # if defined, the lines of the file once it's rewritten
+	reloadDelay => undef,  # time before the file is rewritten and reloaded, in seconds
+	reloadedGamePolicy => undef,  # the game policy set by the reloaded file, if any
+	reloadByRename => 0,  # is the file replaced by a new one instead of rewritten in place?
 
 	# Command line options
 	allowLoopback => 1,
@@ -141,43 +152,29 @@ END {
 sub Common_CreateSocket {
 	my $port = shift;
 	my $useIPv6 = shift;
+	my $unconnected = shift;  # the socket may exchange messages with several masters
 
 	my $proto = getprotobyname("udp");
 
-	my ($family, $loopbackAddr);
+	my ($family, $bindAddr);
 	if ($useIPv6) {
 		$family = AF_INET6;
-		$loopbackAddr = IPV6_LOOPBACK_ADDRESS;
+		$bindAddr = IPV6_LOOPBACK_ADDRESS;
 	}
 	else {
 		$family = AF_INET;
-		$loopbackAddr = IPV4_LOOPBACK_ADDRESS;
+		$bindAddr = IPV4_LOOPBACK_ADDRESS;
 	}
-
-	my ($connectAddr, $bindAddr);
 	if ($dpmasterProperties{remoteAddress}) {
-		$connectAddr = $dpmasterProperties{remoteAddress};
 		$bindAddr = "";
 	}
-	else {
-		$connectAddr = $loopbackAddr;
-		$bindAddr = $loopbackAddr;
-	}
-
-	# Build the address for connect()
-	my @res = getaddrinfo ($connectAddr, $dpmasterProperties{port}, $family, SOCK_DGRAM, $proto, 0);
-	if (scalar @res < 5) {
-		die "Can't resolve address \"$connectAddr\" (port: $port)";
-	}
-	my ($sockType, $dpmasterAddr, $canonName);
-	($family, $sockType, $proto, $dpmasterAddr, $canonName, @res) = @res;
 
 	# Build the address for bind()
-	@res = getaddrinfo ($bindAddr, $port, $family, SOCK_DGRAM, $proto, AI_PASSIVE);
+	my @res = getaddrinfo ($bindAddr, $port, $family, SOCK_DGRAM, $proto, AI_PASSIVE);
 	if (scalar @res < 5) {
 		die "Can't resolve address \"$bindAddr\" (port: $port)";
 	}
-	my $addr;
+	my ($sockType, $addr, $canonName);
 	($family, $sockType, $proto, $addr, $canonName, @res) = @res;
 
 	# Open an UDP socket
@@ -188,7 +185,10 @@ sub Common_CreateSocket {
 	bind ($socket, $addr) or die "Can't bind to port $port: $!\n";
 
 	# Connect the socket to the dpmaster address
-	connect ($socket, $dpmasterAddr) or die "Can't connect to the dpmaster address: $!\n";
+	if (not $unconnected) {
+		my $dpmasterAddr = Common_GetMasterAddress ($dpmasterProperties{port}, $useIPv6);
+		connect ($socket, $dpmasterAddr) or die "Can't connect to the dpmaster address: $!\n";
+	}
 
 	# Make the IOs from this socket non-blocking
 	Common_SetNonBlockingIO($socket);
@@ -197,6 +197,37 @@ sub Common_CreateSocket {
 }
 
 
+#***************************************************************************
+# Common_GetMasterAddress
+#***************************************************************************
+sub Common_GetMasterAddress {
+	my $port = shift;
+	my $useIPv6 = shift;
+
+	my $proto = getprotobyname("udp");
+
+	my ($family, $masterAddr);
+	if ($useIPv6) {
+		$family = AF_INET6;
+		$masterAddr = IPV6_LOOPBACK_ADDRESS;
+	}
+	else {
+		$family = AF_INET;
+		$masterAddr = IPV4_LOOPBACK_ADDRESS;
+	}
+	if ($dpmasterProperties{remoteAddress}) {
+		$masterAddr = $dpmasterProperties{remoteAddress};
+	}
+
+	my @res = getaddrinfo ($masterAddr, $port, $family, SOCK_DGRAM, $proto, 0);
+	if (scalar @res < 5) {
+		die "Can't resolve address \"$masterAddr\" (port: $port)";
+	}
+
+	return $res[3];
+}
+
+
 #***************************************************************************
 # Common_VerbosePrint
 #***************************************************************************
@@ -242,6 +273,24 @@ sub Client_CheckServerList {
 		return 0;
 	}
 
+	# Check the kinds of delta lists we got, if we know what they should be
+	my $expectedListStates = $clientRef->{expectedListStates};
+	if (defined $expectedListStates) {
+		my $expected = join (", ", @{$expectedListStates});
+		my $received = join (", ", @{$clientRef->{listStates}});
+		if ($received ne $expected) {
+			push @failureDiagnostic, "Client_CheckServerList: client $clientRef->{id} should have received delta lists \"$expected\", but it received \"$received\"";
+			return 0;
+		}
+	}
+
+	# Check the number of getserversUnchanged we got, if we know what it should be
+	my $expectedUnchangedCount = $clientRef->{expectedUnchangedCount};
+	if (defined $expectedUnchangedCount and $clientRef->{unchangedCount} != $expectedUnchangedCount) {
+		push @failureDiagnostic, "Client_CheckServerList: client $clientRef->{id} should have received $expectedUnchangedCount getserversUnchanged, but it received $clientRef->{unchangedCount}";
+		return 0;
+	}
+
 	my $clUseIPv6 = $clientRef->{useIPv6};
 	my $clPropertiesRef = $clientRef->{gameProperties};
 	my $clGamename = $clPropertiesRef->{gamename};
@@ -249,6 +298,7 @@ sub Client_CheckServerList {
 	my $clGametype = $clPropertiesRef->{gametype};
 
 	my $returnValue = 1;
+	my $nbMissedServers = 0;
 
 	my %clientServerList = %{$clientRef->{serverList}};
 	foreach my $serverRef (@serverList) {
@@ -273,6 +323,9 @@ sub Client_CheckServerList {
 		# Skip this server if it shouldn't be registered
 		next if ($serverRef->{cannotBeAnswered} or $serverRef->{cannotBeRegistered});
 
+		# Skip this server if it has timed out
+		next if ($serverRef->{timesOut});
+
 		my $fullAddress = ($svUseIPv6 ? "[" . IPV6_LOOPBACK_ADDRESS . "]" : IPV4_LOOPBACK_ADDRESS);
 		$fullAddress .= ":" . $serverRef->{port};
 		
@@ -280,11 +333,22 @@ sub Client_CheckServerList {
 			Common_VerbosePrint ("CheckServerList: found server $fullAddress\n");
 			delete $clientServerList{$fullAddress}
 		}
+		elsif ($clientRef->{truncatedList}) {
+			$nbMissedServers++;
+		}
 		else {
 			push @failureDiagnostic, "CheckServerList: server $fullAddress missed by client $clientRef->{id}";
 			$returnValue = 0;
 		}
 	}
+
+	# A truncated list must miss some servers, but not all of them
+	if ($clientRef->{truncatedList}) {
+		if ($nbMissedServers == 0 or not scalar %{$clientRef->{serverList}}) {
+			push @failureDiagnostic, "CheckServerList: client $clientRef->{id} should have received a truncated list";
+			$returnValue = 0;
+		}
+	}
 	
 	# If there is unknown servers in the list
 	if (scalar %clientServerList) {
@@ -298,6 +362,25 @@ sub Client_CheckServerList {
 }
 
 
+#***************************************************************************
+# Client_HandleDeltaHeader
+#***************************************************************************
+sub Client_HandleDeltaHeader {
+	my $clientRef = shift;
+	my $listState = shift;
+	my $listVersion = shift;
+
+	Common_VerbosePrint ("Client received a getserversDeltaResponse ($listState, version $listVersion)\n");
+
+	# Only the first packet of a list tells us what kind of list it is
+	if ($clientRef->{newList}) {
+		$clientRef->{listState} = $listState;
+		$clientRef->{receivedListVersion} = $listVersion;
+		push @{$clientRef->{listStates}}, ($listVersion eq "0" ? "$listState 0" : $listState);
+	}
+}
+
+
 #***************************************************************************
 # Client_HandleGetServersReponse
 #***************************************************************************
@@ -314,6 +397,13 @@ sub Client_HandleGetServersReponse {
 	while ($addrList) {
 		my ($address, $port, $fullAddress);
 
+		# A '-' before an address means the server must be removed from the list
+		my $removed = 0;
+		if (unpack ("a1", $addrList) eq "-") {
+			$removed = 1;
+			$addrList = substr ($addrList, 1);
+		}
+
 		my $separator = unpack ("a1", $addrList);
 		if ($separator eq "\\") {
 			($separator, $address, $port) = unpack ("a1a4n", $addrList);
@@ -343,7 +433,14 @@ sub Client_HandleGetServersReponse {
 		}
 
 		my $clientServerListRef =  $clientRef->{serverList};
-		if (exists $clientServerListRef->{$fullAddress}) {
+		if ($removed) {
+			Common_VerbosePrint ("        * Removed from the server list\n");
+			delete $clientServerListRef->{$fullAddress};
+		}
+		elsif (defined $clientRef->{listState} and $clientRef->{listState} eq "delta") {
+			$clientServerListRef->{$fullAddress} = 1;
+		}
+		elsif (exists $clientServerListRef->{$fullAddress}) {
 			Common_VerbosePrint ("        * ERROR: already in the server list!\n");
 			$clientServerListRef->{$fullAddress} += 1;
 			push @failureDiagnostic, "Client_HandleGetServersReponse: client $clientRef->{id} received address $fullAddress $clientServerListRef->{$fullAddress} times";
@@ -411,6 +508,22 @@ sub Client_New {
 		queryFilters => $queryFilters,
 		ignoreEOTMarks => 0,
 		retryDelay => undef,
+		nbQueries => 1,  # Nb of server lists to ask for, "queryInterval" seconds apart
+		queryInterval => 1,
+		nbQueriesSent => 0,
+		useDeltaQuery => 0,
+		listVersion => "0",  # version of the list sent in the first getserversDelta
+		crtListVersion => undef,
+		receivedListVersion => undef,
+		newList => 0,  # is the next list packet the first one of a new list?
+		listState => undef,  # state of the last delta list: "full" or "delta"
+		listStates => [],  # states of the delta lists received ("full", "full 0" or "delta")
+		expectedListStates => undef,
+		sendCookies => 0,  # send back the cookie from the last getserversCookie
+		cookie => undef,
+		truncatedList => 0,  # should the list we get be incomplete?
+		unchangedCount => 0,  # Nb of getserversUnchanged received
+		expectedUnchangedCount => undef,
 
 		gameProperties => {
 			gamename => $gamename,
@@ -445,9 +558,39 @@ sub Client_Run {
 		my $recvPacket;
 		if (recv ($clientRef->{socket}, $recvPacket, 1500, 0)) {
 			# If we received a server list, unpack it
+			my $addrList = undef;
+			my $extended = 0;
 			if ($recvPacket =~ /^\xFF\xFF\xFF\xFFgetservers(Ext)?Response[\\\/]/) {
-				my $extended = ((defined $1) and ($1 eq "Ext"));
-				my $addrList = substr ($recvPacket, $extended ? 25 : 22);
+				$extended = ((defined $1) and ($1 eq "Ext"));
+				$addrList = substr ($recvPacket, $extended ? 25 : 22);
+			}
+			elsif ($recvPacket =~ /^\xFF\xFF\xFF\xFFgetserversDeltaResponse (full|delta) (\S+)\x0A([\\\/-].*)$/s) {
+				$extended = 1;
+				$addrList = $3;
+				Client_HandleDeltaHeader ($clientRef, $1, $2);
+			}
+
+			# If we received a cookie, keep it for the next queries
+			if ($recvPacket =~ /^\xFF\xFF\xFF\xFFgetserversCookie ([0-9a-f]+)$/) {
+				Common_VerbosePrint ("Client received a getserversCookie ($1)\n");
+				$clientRef->{cookie} = $1;
+			}
+			# If the list hasn't changed since our last query, we keep it
+			elsif ($recvPacket =~ /^\xFF\xFF\xFF\xFFgetserversUnchanged$/) {
+				Common_VerbosePrint ("Client received a getserversUnchanged\n");
+				$clientRef->{serverListCount}++;
+				$clientRef->{unchangedCount}++;
+				$clientRef->{newList} = 0;
+				$clientRef->{state} = "Done";
+			}
+			elsif (defined $addrList) {
+				# A complete list replaces the one we got before
+				if ($clientRef->{newList}) {
+					$clientRef->{newList} = 0;
+					if (not $clientRef->{useDeltaQuery} or $clientRef->{listState} ne "delta") {
+						$clientRef->{serverList} = {};
+					}
+				}
 
 				my $eotFound = Client_HandleGetServersReponse($clientRef, $addrList, $extended);
 				if ($eotFound) {
@@ -455,6 +598,10 @@ sub Client_Run {
 						Common_VerbosePrint ("EOT mark ignored. Waiting for the next packet\n");
 					}
 					else {
+						# The next delta query will be based on the list we just got
+						if ($clientRef->{useDeltaQuery}) {
+							$clientRef->{crtListVersion} = $clientRef->{receivedListVersion};
+						}
 						$clientRef->{state} = "Done";
 					}
 				}
@@ -480,7 +627,12 @@ sub Client_Run {
 
 	# "Done" state
 	elsif ($state eq "Done") {
-		# Nothing to do
+		# If we must ask for the server list again, and if it's time to
+		if ($clientRef->{nbQueriesSent} < $clientRef->{nbQueries} and
+			$currentTime >= $clientRef->{lastRequestTime} + $clientRef->{queryInterval}) {
+			Client_SendGetServers ($clientRef);
+			$clientRef->{state} = "WaitingServerList";
+		}
 	}
 
 	# Invalid state
@@ -499,7 +651,11 @@ sub Client_SendGetServers {
 	my $getservers = "getservers";
 
 	my $useExtendedQuery;
-	if ($clientRef->{useIPv6} or $clientRef->{alwaysUseExtendedQuery}) {
+	if ($clientRef->{useDeltaQuery}) {
+		$useExtendedQuery = 1;
+		$getservers .= "Delta";
+	}
+	elsif ($clientRef->{useIPv6} or $clientRef->{alwaysUseExtendedQuery}) {
 		$useExtendedQuery = 1;
 		$getservers .= "Ext";
 	}
@@ -522,9 +678,15 @@ sub Client_SendGetServers {
 	if (defined $gameProp->{protocol}) {
 		$getservers .= " $gameProp->{protocol}";
 	}
+	if ($clientRef->{useDeltaQuery}) {
+		$getservers .= " $clientRef->{crtListVersion}";
+	}
 	if (defined $clientRef->{queryFilters}) {
 		$getservers .= " $clientRef->{queryFilters}";
 	}
+	if ($clientRef->{sendCookies} and defined $clientRef->{cookie}) {
+		$getservers .= " cookie=$clientRef->{cookie}";
+	}
 
 	my $gametype = $gameProp->{gametype};
 	if (defined $gametype) {
@@ -551,6 +713,8 @@ sub Client_SendGetServers {
 
 	send ($clientRef->{socket}, $getservers, 0) or die "Can't send packet: $!";
 	$clientRef->{lastRequestTime} = $currentTime;
+	$clientRef->{nbQueriesSent}++;
+	$clientRef->{newList} = 1;
 
 	if (not defined $clientRef->{cannotBeAnswered}) {
 		$clientRef->{cannotBeAnswered} = not (Client_ValidateGetServers ($getservers) and Master_IsGameAccepted ($gameProp->{gamename}));
@@ -594,6 +758,8 @@ sub Client_Start {
 	$clientRef->{socket} = Common_CreateSocket ($clientRef->{port}, $clientRef->{useIPv6});
 	$clientRef->{state} = "Init";
 	$clientRef->{lastRequestTime} = 0;
+	$clientRef->{nbQueriesSent} = 0;
+	$clientRef->{crtListVersion} = $clientRef->{listVersion};
 }
 
 	
@@ -612,6 +778,10 @@ sub Client_Stop {
 	# Clean the server list
 	$clientRef->{serverList} = {};
 	$clientRef->{serverListCount} = 0;
+	$clientRef->{listState} = undef;
+	$clientRef->{listStates} = [];
+	$clientRef->{cookie} = undef;
+	$clientRef->{unchangedCount} = 0;
 	
 	$clientRef->{cannotBeAnswered} = undef;
 }
@@ -623,10 +793,23 @@ sub Client_Stop {
 sub Client_ValidateGetServers {
 	my $getservers = shift;
 	
-	if ($getservers =~ /^\xFF\xFF\xFF\xFFgetservers(Ext)? (.*)$/) {
-		my $isExtended = (defined $1 and $1 eq "Ext");
+	if ($getservers =~ /^\xFF\xFF\xFF\xFFgetservers(Ext|Delta)? (.*)$/) {
+		my $isExtended = (defined $1);
+		my $isDelta = (defined $1 and $1 eq "Delta");
 		my $payload = $2;
 		
+		# A delta query must give the version of the client's list: "0" or "<registry id>.<epoch>"
+		if ($isDelta) {
+			my ($gameAndProtocol, $listVersion, $filters) = ($payload =~ /^ *([^ ]+ -?\d+) (\S+)( .*)?$/);
+			if (defined $listVersion and $listVersion =~ /^\d+(\.\d+)?$/) {
+				$payload = $gameAndProtocol . (defined $filters ? $filters : "");
+			}
+			else {
+				Common_VerbosePrint ("getservers NOT valided: invalid list version\n");
+				return 0;
+			}
+		}
+
 		if ($payload =~ /^ *([^ ]+ )?(-?\d+)( .*)?$/) {
 			my $gamename = $1;
 			my $protocol = $2;
@@ -659,6 +842,9 @@ sub Master_IsGameAccepted {
 	my $gamename = shift;
 	
 	my $gamePolicy = $dpmasterProperties{gamePolicy};
+	if ($gameConfigReloaded and defined $dpmasterProperties{reloadedGamePolicy}) {
+		$gamePolicy = $dpmasterProperties{reloadedGamePolicy};
+	}
 	if (not defined ($gamePolicy)) {
 		return 1;
 	}
@@ -684,6 +870,42 @@ sub Master_IsGameAccepted {
 }
 
 	
+#***************************************************************************
+# Master_ReloadGameConfig
+#***************************************************************************
+sub Master_ReloadGameConfig {
+	Common_VerbosePrint ("Reloading the game configuration of the master\n");
+
+	# The file is either rewritten in place, or replaced like some editors do
+	if ($dpmasterProperties{reloadByRename}) {
+		my $newFile = GAME_CONFIG_FILE . ".new";
+		Master_WriteGameConfig ($newFile, $dpmasterProperties{reloadedGameConfig});
+		rename ($newFile, GAME_CONFIG_FILE) or die "Can't replace the game configuration file: $!";
+	}
+	else {
+		Master_WriteGameConfig (GAME_CONFIG_FILE, $dpmasterProperties{reloadedGameConfig});
+	}
+	kill ("HUP", $dpmasterPid);
+	$gameConfigReloaded = 1;
+
+	# The servers of the games the master now rejects are removed from its list
+	foreach my $serverRef (@serverList) {
+		if (not Master_IsGameAccepted ($serverRef->{gameProperties}{gamename})) {
+			$serverRef->{cannotBeRegistered} = 1;
+		}
+	}
+
+	# And the clients of those games won't get any list anymore
+	foreach my $clientRef (@clientList) {
+		my $gamename = $clientRef->{gameProperties}{gamename};
+		if (defined $gamename and not Master_IsGameAccepted ($gamename)) {
+			$clientRef->{cannotBeAnswered} = 1;
+			$clientRef->{serverListCount} = 0;
+		}
+	}
+}
+
+
 #***************************************************************************
 # Master_Run
 #***************************************************************************
@@ -693,12 +915,27 @@ sub Master_Run {
 		return;
 	}
 
+	# If it's time to change the game configuration, tell the master about it
+	my $reloadDelay = $dpmasterProperties{reloadDelay};
+	if (defined $reloadDelay and not $gameConfigReloaded and $currentTime >= $testStartTime + $reloadDelay) {
+		Master_ReloadGameConfig ();
+	}
+
 	# Print the master server output
 	while (<DPMASTER_PROCESS>) {
 		if ($optDpmasterOutput) {
 			Common_VerbosePrint ("[DPM] $_");
 		}
 	}
+
+	# Same thing for the peer master, if any
+	if (defined ($peerMasterPid)) {
+		while (<PEER_MASTER_PROCESS>) {
+			if ($optDpmasterOutput) {
+				Common_VerbosePrint ("[PEER] $_");
+			}
+		}
+	}
 }
 
 	
@@ -780,6 +1017,19 @@ sub Master_Start {
 		}
 	}
 	
+	# Exchange the server lists with the peer master, if there's one
+	my $peerPort = $dpmasterProperties{peerPort};
+	if (defined $peerPort) {
+		$dpmasterCmdLine .= " --peer " . IPV4_LOOPBACK_ADDRESS . ":$peerPort --peer-secret $dpmasterProperties{peerSecret}";
+	}
+
+	my $gameConfigRef = $dpmasterProperties{gameConfig};
+	if (defined $gameConfigRef) {
+		Master_WriteGameConfig (GAME_CONFIG_FILE, $gameConfigRef);
+		$dpmasterCmdLine .= " --game-config " . GAME_CONFIG_FILE;
+	}
+	$gameConfigReloaded = 0;
+
 	my $extraOptionsRef = $dpmasterProperties{extraOptions};
 	if (defined $extraOptionsRef) {
 		foreach my $extraOption (@{$extraOptionsRef}) {
@@ -795,6 +1045,30 @@ sub Master_Start {
 
 	# Make the IOs from dpmaster's pipe non-blocking
 	Common_SetNonBlockingIO(\*DPMASTER_PROCESS);
+
+	# Start the peer master, if there's one, before waiting for the masters to be ready
+	if (defined $peerPort) {
+		my $peerSecret = $dpmasterProperties{peerMasterSecret};
+		if (not defined $peerSecret) {
+			$peerSecret = $dpmasterProperties{peerSecret};
+		}
+
+		# The listening ports are the master ports of the games
+		my $peerCmdLine = $optDpmasterPath . " -l " . IPV4_LOOPBACK_ADDRESS . " -g " . QUAKE3ARENA_GAMENAME . " masterport=$peerPort" .
+						  " --hash-ports --allow-loopback" .
+						  " --peer " . IPV4_LOOPBACK_ADDRESS . ":$dpmasterProperties{port} --peer-secret $peerSecret";
+		if ($optDpmasterOutput) {
+			$peerCmdLine .= " -v";
+		}
+
+		Common_VerbosePrint ("Launching the peer master as: $peerCmdLine\n");
+		$peerMasterPid = open PEER_MASTER_PROCESS, "$peerCmdLine |";
+		if (not defined $peerMasterPid) {
+		   die "Can't run the peer master: $!\n";
+		}
+
+		Common_SetNonBlockingIO(\*PEER_MASTER_PROCESS);
+	}
 	
 	# Wait for the master to be ready
 	# TODO: find a better way to do this
@@ -811,14 +1085,65 @@ sub Master_Stop {
 		return;
 	}
 
-	# Kill dpmaster if it's still running
+	# Kill dpmaster if it's still running (SIGHUP would only make it reload its game configuration)
 	if (defined ($dpmasterPid)) {
-		kill ("HUP", $dpmasterPid);
+		kill ("TERM", $dpmasterPid);
 		$dpmasterPid = undef;
 	}
 
 	# Close the pipe
 	close (DPMASTER_PROCESS);
+
+	# Same thing for the peer master, if any
+	if (defined ($peerMasterPid)) {
+		kill ("TERM", $peerMasterPid);
+		$peerMasterPid = undef;
+		close (PEER_MASTER_PROCESS);
+	}
+
+	unlink (GAME_CONFIG_FILE);
+}
+
+
+#***************************************************************************
+# Master_WriteGameConfig
+#***************************************************************************
+sub Master_WriteGameConfig {
+	my $filePath = shift;
+	my $linesRef = shift;
+
+	open (my $configFile, ">", $filePath) or die "Can't write the game configuration file: $!";
+	foreach my $line (@{$linesRef}) {
+		print $configFile "$line\n";
+	}
+	close ($configFile);
+}
+
+	
+#***************************************************************************
+# Server_CheckGetInfos
+#***************************************************************************
+sub Server_CheckGetInfos {
+	my $serverRef = shift;
+
+	# Only the servers with a trust window are checked
+	my $trustWindow = $serverRef->{trustWindow};
+	if (not defined $trustWindow) {
+		return 1;
+	}
+
+	if ($serverRef->{earlyGetInfo}) {
+		push @failureDiagnostic, "Server_CheckGetInfos: server $serverRef->{id} got a getinfo during its trust window";
+		return 0;
+	}
+
+	if ($serverRef->{state} eq "WaitingGetInfos" and defined $serverRef->{infoResponseTime} and
+		$currentTime >= $serverRef->{infoResponseTime} + $trustWindow + 1) {
+		push @failureDiagnostic, "Server_CheckGetInfos: server $serverRef->{id} got no getinfo at the end of its trust window";
+		return 0;
+	}
+
+	return 1;
 }
 
 	
@@ -886,6 +1211,16 @@ sub Server_New {
 		cannotBeRegistered => 0,
 		cannotBeAnswered => 0,
 		useIPv6 => 0,
+		startTime => undef,
+		startDelay => 0,  # time before the first heartbeat, in seconds
+		updateDelay => undef,  # time before the game properties are updated, if they are
+		updatedGameProperties => undef,
+		initialGameProperties => undef,
+		timesOut => 0,  # does the master drop it before the end of the test?
+		usePeerMaster => 0,  # does it send its heartbeats to the peer master only?
+		trustWindow => undef,  # trust window the master applies to its heartbeats, if any
+		infoResponseTime => undef,  # time of its last infoResponse
+		earlyGetInfo => 0,  # has it got a getinfo during its trust window?
 		
 		gameProperties => {
 			gamename => $gamename,
@@ -922,7 +1257,8 @@ sub Server_Run {
 	# "WaitingGetInfos" state
 	elsif ($state eq "WaitingGetInfos") {
 		my $recvPacket;
-		if (recv ($serverRef->{socket}, $recvPacket, 1500, 0)) {
+		my $senderAddr = recv ($serverRef->{socket}, $recvPacket, 1500, 0);
+		if ($senderAddr) {
 			# If we received a getinfo message, reply to it
 			if ($recvPacket =~ /^\xFF\xFF\xFF\xFFgetinfo +(\S+)$/) {
 				my $challenge = $1;
@@ -933,7 +1269,13 @@ sub Server_Run {
 					$mustExit = 1;
 				}
 
-				Server_SendInfoResponse ($serverRef, $challenge);
+				# The master counts the time in whole seconds, hence the 1 second of slack
+				if (defined $serverRef->{trustWindow} and defined $serverRef->{infoResponseTime} and
+					$currentTime < $serverRef->{infoResponseTime} + $serverRef->{trustWindow} - 1) {
+					$serverRef->{earlyGetInfo} = 1;
+				}
+
+				Server_SendInfoResponse ($serverRef, $challenge, $senderAddr);
 				$serverRef->{state} = "Done";
 			}
 			else {
@@ -945,7 +1287,30 @@ sub Server_Run {
 
 	# "Done" state
 	elsif ($state eq "Done") {
-		# Nothing to do
+		# A server known by the peer master is then checked by the main master
+		if ($serverRef->{usePeerMaster}) {
+			my $recvPacket;
+			my $senderAddr = recv ($serverRef->{socket}, $recvPacket, 1500, 0);
+			if ($senderAddr and $recvPacket =~ /^\xFF\xFF\xFF\xFFgetinfo +(\S+)$/) {
+				my $challenge = $1;
+				Common_VerbosePrint ("Server $serverRef->{id} received a getinfo with challenge \"$challenge\" from another master\n");
+				Server_SendInfoResponse ($serverRef, $challenge, $senderAddr);
+			}
+		}
+
+		# If it's time to update the game properties, tell the master about it
+		if (defined $serverRef->{updateDelay} and not defined $serverRef->{initialGameProperties} and
+			$currentTime >= $serverRef->{startTime} + $serverRef->{updateDelay}) {
+			Common_VerbosePrint ("Updating the game properties of server $serverRef->{id}\n");
+
+			$serverRef->{initialGameProperties} = { %{$serverRef->{gameProperties}} };
+			while (my ($propKey, $propValue) = each %{$serverRef->{updatedGameProperties}}) {
+				$serverRef->{gameProperties}{$propKey} = $propValue;
+			}
+
+			Server_SendHeartbeat ($serverRef);
+			$serverRef->{state} = "WaitingGetInfos";
+		}
 	}
 
 	# Invalid state
@@ -963,7 +1328,13 @@ sub Server_SendHeartbeat {
 
 	Common_VerbosePrint ("Sending heartbeat from server $serverRef->{id}\n");
 	my $heartbeat = "\xFF\xFF\xFF\xFFheartbeat $serverRef->{masterProtocol}\x0A";
-	send ($serverRef->{socket}, $heartbeat, 0) or die "Can't send packet: $!";
+	if ($serverRef->{usePeerMaster}) {
+		my $peerMasterAddr = Common_GetMasterAddress ($dpmasterProperties{peerPort}, $serverRef->{useIPv6});
+		send ($serverRef->{socket}, $heartbeat, 0, $peerMasterAddr) or die "Can't send packet: $!";
+	}
+	else {
+		send ($serverRef->{socket}, $heartbeat, 0) or die "Can't send packet: $!";
+	}
 	
 	if (not $serverRef->{cannotBeAnswered}) {
 		$serverRef->{cannotBeAnswered} = not $dpmasterProperties{allowLoopback};
@@ -980,6 +1351,7 @@ sub Server_SendHeartbeat {
 sub Server_SendInfoResponse {
 	my $serverRef = shift;
 	my $challenge = shift;
+	my $masterAddr = shift;
 
 	Common_VerbosePrint ("Sending infoResponse from server $serverRef->{id}\n");
 	my $infoResponse = "\xFF\xFF\xFF\xFFinfoResponse\x0A" . 
@@ -994,8 +1366,20 @@ sub Server_SendInfoResponse {
 	}
 	
 	$serverRef->{cannotBeRegistered} = not (Server_ValidateInfoResponse ($infoResponse) and Master_IsGameAccepted ($serverRef->{gameProperties}{gamename}));
+	$serverRef->{infoResponseTime} = $currentTime;
 
-	send ($serverRef->{socket}, $infoResponse, 0) or die "Can't send packet: $!";
+	# The main master only hears of the servers of its peer if it trusts its messages
+	if ($serverRef->{usePeerMaster} and defined $dpmasterProperties{peerMasterSecret} and
+		$dpmasterProperties{peerMasterSecret} ne $dpmasterProperties{peerSecret}) {
+		$serverRef->{cannotBeRegistered} = 1;
+	}
+
+	if ($serverRef->{usePeerMaster}) {
+		send ($serverRef->{socket}, $infoResponse, 0, $masterAddr) or die "Can't send packet: $!";
+	}
+	else {
+		send ($serverRef->{socket}, $infoResponse, 0) or die "Can't send packet: $!";
+	}
 }
 
 	
@@ -1032,9 +1416,12 @@ sub Server_SetProperty {
 sub Server_Start {
 	my $serverRef = shift;
 
-	$serverRef->{socket} = Common_CreateSocket($serverRef->{port}, $serverRef->{useIPv6});
+	$serverRef->{socket} = Common_CreateSocket($serverRef->{port}, $serverRef->{useIPv6}, $serverRef->{usePeerMaster});
 	$serverRef->{state} = "Init";
-	$serverRef->{heartbeatTime} = $currentTime;
+	$serverRef->{infoResponseTime} = undef;
+	$serverRef->{earlyGetInfo} = 0;
+	$serverRef->{startTime} = $currentTime;
+	$serverRef->{heartbeatTime} = $currentTime + $serverRef->{startDelay};
 }
 
 	
@@ -1051,6 +1438,12 @@ sub Server_Stop {
 	}
 
 	$serverRef->{cannotBeRegistered} = 0;
+
+	# Restore the game properties it had before its update, if any
+	if (defined $serverRef->{initialGameProperties}) {
+		$serverRef->{gameProperties} = $serverRef->{initialGameProperties};
+		$serverRef->{initialGameProperties} = undef;
+	}
 }
 
 	
@@ -1251,6 +1644,16 @@ sub Test_Run {
 		}
 	}
 
+	# Check that the servers got their getinfos when they should have
+	if ($Result == EXIT_SUCCESS) {
+		foreach my $server (@serverList) {
+			if (not Server_CheckGetInfos ($server)) {
+				$Result = EXIT_FAILURE;
+				last;
+			}
+		}
+	}
+
 	# TODO: any other tests?
 
 	if ($Result == EXIT_SUCCESS) {